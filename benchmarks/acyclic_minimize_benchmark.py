@@ -0,0 +1,139 @@
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+# Copyright 2017 and onwards Google, Inc.
+#
+# For general information on the Pynini grammar compilation library, see
+# pynini.opengrm.org.
+
+
+"""Compares acyclic and generic minimization of a large lexicon.
+
+This builds the prefix tree of a lexicon of random words, a deterministic,
+acyclic, unweighted acceptor, and minimizes it both with OpenFst's generic
+Minimize (via `Fst.minimize`) and with `optimize`, which dispatches such
+machines to bottom-up minimization by height. Each is run in a child process,
+so that its peak memory use can be reported; a child which only builds the
+prefix tree gives the baseline for the latter.
+
+This requires a POSIX system.
+
+Usage:
+
+    python acyclic_minimize_benchmark.py [--words N]
+"""
+
+
+from __future__ import print_function
+
+import argparse
+import os
+import random
+import string
+import time
+import traceback
+
+from pynini import *
+
+
+SEED = 212
+
+
+def random_words(count):
+  letters = string.ascii_lowercase.encode("ascii")
+  return [bytes(bytearray(random.choice(letters)
+                          for _ in range(random.randint(3, 12))))
+          for _ in range(count)]
+
+
+def build_prefix_tree(words):
+  """Builds the prefix tree of the words, one sorted word at a time."""
+  fst = Fst()
+  one = Weight.One(fst.weight_type())
+  path = [fst.add_state()]
+  fst.set_start(path[0])
+  previous = b""
+  for word in sorted(set(words)):
+    common = 0
+    limit = min(len(previous), len(word))
+    while common < limit and previous[common] == word[common]:
+      common += 1
+    del path[common + 1:]
+    for label in bytearray(word[common:]):
+      state = fst.add_state()
+      fst.add_arc(path[-1], Arc(label, label, one, state))
+      path.append(state)
+    fst.set_final(path[-1], one)
+    previous = word
+  return fst
+
+
+def minimize_generic(fst):
+  start = time.time()
+  fst.minimize()
+  return time.time() - start
+
+
+def minimize_optimize(fst):
+  stats = OptimizeStats()
+  fst.optimize(compute_props=True, stats=stats)
+  for phase in stats.phases():
+    if phase.name == b"acyclic_minimize":
+      return phase.seconds
+  raise RuntimeError("optimize did not use acyclic minimization")
+
+
+def run_child(words, method):
+  """Runs the method in a child; returns its time, state count and peak RSS."""
+  (read_fd, write_fd) = os.pipe()
+  pid = os.fork()
+  if pid == 0:
+    # The child must never return into the parent's code.
+    try:
+      os.close(read_fd)
+      fst = build_prefix_tree(words)
+      seconds = method(fst) if method else 0.0
+      os.write(write_fd, "{} {}".format(seconds, fst.num_states()).encode())
+    except Exception:  # pylint: disable=broad-except
+      traceback.print_exc()
+    finally:
+      os._exit(0)
+  os.close(write_fd)
+  with os.fdopen(read_fd) as source:
+    result = source.read().split()
+  (unused_pid, unused_status, usage) = os.wait4(pid, 0)
+  if not result:
+    raise RuntimeError("Child process failed")
+  (seconds, states) = result
+  # On Linux, ru_maxrss is given in kilobytes.
+  return (float(seconds), int(states), usage.ru_maxrss / 1024.0)
+
+
+def main():
+  parser = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+  parser.add_argument("--words", type=int, default=1000000,
+                      help="number of random words in the lexicon")
+  args = parser.parse_args()
+  random.seed(SEED)
+  words = random_words(args.words)
+  print("{:<18} {:>12} {:>10} {:>14}".format("method", "minimize (s)",
+                                             "states", "peak RSS (MB)"))
+  for (name, method) in (("prefix tree only", None),
+                         ("Minimize", minimize_generic),
+                         ("optimize", minimize_optimize)):
+    (seconds, states, rss) = run_child(words, method)
+    print("{:<18} {:>12.3f} {:>10} {:>14.1f}".format(name, seconds, states,
+                                                     rss))
+
+
+if __name__ == "__main__":
+  main()
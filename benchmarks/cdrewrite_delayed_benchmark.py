@@ -0,0 +1,109 @@
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+# Copyright 2017 and onwards Google, Inc.
+#
+# For general information on the Pynini grammar compilation library, see
+# pynini.opengrm.org.
+
+
+"""Compares eager and delayed application of context-dependent rewrite rules.
+
+For each rule in a small set of byte-level normalization rules, this times
+compiling the rule with `cdrewrite` and then applying it to a batch of random
+strings, against constructing it with `cdrewrite_delayed` and applying that to
+the same strings. The time to the first application and the time per string
+are reported separately, since the delayed rule pays for its states as they
+are first visited.
+
+Usage:
+
+    python cdrewrite_delayed_benchmark.py [--strings N] [--length N]
+"""
+
+
+from __future__ import print_function
+
+import argparse
+import random
+import string
+import time
+
+from pynini import *
+
+
+SEED = 212
+
+
+def make_rules():
+  """Returns a list of (name, tau, lambda, rho) tuples."""
+  vowel = union(*"aeiou")
+  consonant = union(*"bcdfghjklmnpqrstvwxyz")
+  digit = union(*string.digits)
+  abbreviations = string_map((("st", "street"), ("rd", "road"),
+                              ("ave", "avenue"), ("blvd", "boulevard"),
+                              ("dr", "drive"), ("ln", "lane")))
+  return [
+      ("voicing", transducer("s", "z"), vowel, vowel),
+      ("final devoicing", string_map((("b", "p"), ("d", "t"), ("g", "k"))),
+       "", "[EOS]"),
+      ("digit masking", transducer(digit, "#"), "", ""),
+      ("final e deletion", transducer("e", ""), consonant, "[EOS]"),
+      ("abbreviations", abbreviations, union(" ", "[BOS]"),
+       union(" ", "[EOS]")),
+  ]
+
+
+def random_strings(count, length):
+  # Spaces are repeated so that words are of a realistic length.
+  alphabet = string.ascii_lowercase + string.digits + " " * 6
+  return ["".join(random.choice(alphabet) for _ in range(length))
+          for _ in range(count)]
+
+
+def time_application(rule, strings):
+  """Returns the seconds spent on the first string and on the rest."""
+  start = time.time()
+  unused_lattice = strings[0] * rule
+  first = time.time() - start
+  start = time.time()
+  for istring in strings[1:]:
+    unused_lattice = istring * rule
+  return (first, time.time() - start)
+
+
+def main():
+  parser = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+  parser.add_argument("--strings", type=int, default=1000,
+                      help="number of strings to apply each rule to")
+  parser.add_argument("--length", type=int, default=40,
+                      help="length of each string, in bytes")
+  args = parser.parse_args()
+  random.seed(SEED)
+  sigma_star = union(*(string.ascii_lowercase + string.digits +
+                       " #")).closure().optimize()
+  strings = random_strings(max(args.strings, 1), args.length)
+  print("{:<20} {:>6} {:>10} {:>10} {:>12}".format(
+      "rule", "mode", "build (s)", "first (s)", "rest (ms/str)"))
+  for (name, tau, lambda_, rho) in make_rules():
+    for (mode, build) in (("eager", cdrewrite), ("delay", cdrewrite_delayed)):
+      start = time.time()
+      rule = build(tau, lambda_, rho, sigma_star)
+      built = time.time() - start
+      (first, rest) = time_application(rule, strings)
+      per_string = 1000 * rest / max(len(strings) - 1, 1)
+      print("{:<20} {:>6} {:>10.4f} {:>10.4f} {:>12.4f}".format(
+          name, mode, built, first, per_string))
+
+
+if __name__ == "__main__":
+  main()
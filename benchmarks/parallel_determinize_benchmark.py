@@ -0,0 +1,81 @@
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+# Copyright 2017 and onwards Google, Inc.
+#
+# For general information on the Pynini grammar compilation library, see
+# pynini.opengrm.org.
+
+
+"""Measures how determinization in optimize scales with determinize_threads.
+
+This optimizes copies of (a|b)* a (a|b)^n, a nondeterministic acceptor whose
+deterministic form has 2^(n + 1) states, with each requested number of
+determinization threads. One thread uses OpenFst's Determinize; more use the
+parallel subset construction. The time spent in the determinization phase, as
+recorded by OptimizeStats, and its speedup over the first number of threads
+listed (by default, one) are reported, after checking that every result is
+equivalent to the first.
+
+Usage:
+
+    python parallel_determinize_benchmark.py [--n N] [--threads 1,2,4,...]
+"""
+
+
+from __future__ import print_function
+
+import argparse
+
+from pynini import *
+
+
+def make_machine(n):
+  ab = union("a", "b")
+  return ab.closure() + "a" + ab.closure(n, n)
+
+
+def determinize_seconds(fst, threads):
+  stats = OptimizeStats()
+  fst.optimize(determinize_threads=threads, stats=stats)
+  for phase in stats.phases():
+    if phase.name == b"determinize":
+      return phase.seconds
+  raise RuntimeError("optimize did not determinize the machine")
+
+
+def main():
+  parser = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+  parser.add_argument("--n", type=int, default=18,
+                      help="length of the (a|b)^n suffix")
+  parser.add_argument("--threads", default="1,2,4,8,16,32",
+                      help="comma-separated numbers of threads")
+  args = parser.parse_args()
+  machine = make_machine(args.n)
+  print("{:>8} {:>15} {:>10} {:>8}".format("threads", "determinize (s)",
+                                           "states", "speedup"))
+  first = None
+  serial = None
+  for threads in (int(t) for t in args.threads.split(",")):
+    fst = machine.copy()
+    seconds = determinize_seconds(fst, threads)
+    if first is None:
+      first = fst
+      serial = seconds
+    elif not equivalent(fst, first):
+      raise RuntimeError("Result with {} threads differs".format(threads))
+    print("{:>8} {:>15.3f} {:>10} {:>8.2f}".format(
+        threads, seconds, fst.num_states(), serial / max(seconds, 1e-9)))
+
+
+if __name__ == "__main__":
+  main()
@@ -0,0 +1,84 @@
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+# Copyright 2017 and onwards Google, Inc.
+#
+# For general information on the Pynini grammar compilation library, see
+# pynini.opengrm.org.
+
+
+"""Measures how minimization in optimize scales with minimize_threads.
+
+This determinizes (a|b)* a (a|b)^n, a cyclic acceptor whose deterministic form
+has 2^(n + 1) states, and then optimizes copies of it with each requested
+number of minimization threads. One thread uses OpenFst's Minimize; more use
+parallel partition refinement. The time spent in the minimization phase, as
+recorded by OptimizeStats, and its speedup over the first number of threads
+listed (by default, one) are reported, after checking that every result has the
+same number of states.
+
+Usage:
+
+    python parallel_minimize_benchmark.py [--n N] [--threads 1,2,4,...]
+"""
+
+
+from __future__ import print_function
+
+import argparse
+
+from pynini import *
+
+
+def make_machine(n):
+  ab = union("a", "b")
+  return determinize(ab.closure() + "a" + ab.closure(n, n))
+
+
+def minimize_seconds(fst, threads):
+  stats = OptimizeStats()
+  fst.optimize(compute_props=True, minimize_threads=threads, stats=stats)
+  for phase in stats.phases():
+    if phase.name in (b"minimize", b"parallel_minimize"):
+      return phase.seconds
+  raise RuntimeError("optimize did not minimize the machine")
+
+
+def main():
+  parser = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+  parser.add_argument("--n", type=int, default=18,
+                      help="length of the (a|b)^n suffix")
+  parser.add_argument("--threads", default="1,2,4,8,16,32",
+                      help="comma-separated numbers of threads")
+  args = parser.parse_args()
+  machine = make_machine(args.n)
+  print("input: {} states".format(machine.num_states()))
+  print("{:>8} {:>12} {:>10} {:>8}".format("threads", "minimize (s)",
+                                           "states", "speedup"))
+  serial = None
+  states = None
+  for threads in (int(t) for t in args.threads.split(",")):
+    fst = machine.copy()
+    seconds = minimize_seconds(fst, threads)
+    if states is None:
+      states = fst.num_states()
+    elif fst.num_states() != states:
+      raise RuntimeError("Results differ in size: {} and {} states".format(
+          states, fst.num_states()))
+    if serial is None:
+      serial = seconds
+    print("{:>8} {:>12.3f} {:>10} {:>8.2f}".format(
+        threads, seconds, fst.num_states(), serial / max(seconds, 1e-9)))
+
+
+if __name__ == "__main__":
+  main()
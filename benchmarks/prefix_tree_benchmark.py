@@ -0,0 +1,118 @@
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+# Copyright 2017 and onwards Google, Inc.
+#
+# For general information on the Pynini grammar compilation library, see
+# pynini.opengrm.org.
+
+
+"""Measures string_file build time and peak memory on a large lexicon.
+
+This writes a lexicon of random word pairs, one tab-separated pair per line, to
+a temporary file, and compiles it with `string_file`, whose prefix tree holds
+every input and output string before the transducer is built. Each compilation
+is run in a child process, so that its peak memory use can be reported; a child
+which compiles nothing gives the baseline for the others. Run it against builds
+before and after a change to the prefix tree to compare them.
+
+This requires a POSIX system.
+
+Usage:
+
+    python prefix_tree_benchmark.py [--lines N] [--threads 1,2,...]
+"""
+
+
+from __future__ import print_function
+
+import argparse
+import os
+import random
+import shutil
+import string
+import tempfile
+import time
+import traceback
+
+from pynini import *
+
+
+SEED = 212
+
+
+def random_word():
+  return "".join(random.choice(string.ascii_lowercase)
+                 for _ in range(random.randint(3, 12)))
+
+
+def write_lexicon(filename, lines):
+  with open(filename, "w") as sink:
+    for _ in range(lines):
+      sink.write("{}\t{}\n".format(random_word(), random_word()))
+
+
+def run_child(filename, threads):
+  """Compiles the lexicon in a child; returns its time, states and peak RSS."""
+  (read_fd, write_fd) = os.pipe()
+  pid = os.fork()
+  if pid == 0:
+    # The child must never return into the parent's code.
+    try:
+      os.close(read_fd)
+      seconds = 0.0
+      states = 0
+      if threads:
+        start = time.time()
+        fst = string_file(filename, threads=threads)
+        seconds = time.time() - start
+        states = fst.num_states()
+      os.write(write_fd, "{} {}".format(seconds, states).encode())
+    except Exception:  # pylint: disable=broad-except
+      traceback.print_exc()
+    finally:
+      os._exit(0)
+  os.close(write_fd)
+  with os.fdopen(read_fd) as source:
+    result = source.read().split()
+  (unused_pid, unused_status, usage) = os.wait4(pid, 0)
+  if not result:
+    raise RuntimeError("Child process failed")
+  (seconds, states) = result
+  # On Linux, ru_maxrss is given in kilobytes.
+  return (float(seconds), int(states), usage.ru_maxrss / 1024.0)
+
+
+def main():
+  parser = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+  parser.add_argument("--lines", type=int, default=5000000,
+                      help="number of lines in the lexicon")
+  parser.add_argument("--threads", default="1",
+                      help="comma-separated numbers of threads")
+  args = parser.parse_args()
+  random.seed(SEED)
+  tmpdir = tempfile.mkdtemp()
+  try:
+    filename = os.path.join(tmpdir, "lexicon.tsv")
+    write_lexicon(filename, args.lines)
+    print("{:<10} {:>10} {:>10} {:>14}".format("threads", "build (s)",
+                                               "states", "peak RSS (MB)"))
+    for threads in [0] + [int(t) for t in args.threads.split(",")]:
+      (seconds, states, rss) = run_child(filename, threads)
+      print("{:<10} {:>10.3f} {:>10} {:>14.1f}".format(
+          threads if threads else "none", seconds, states, rss))
+  finally:
+    shutil.rmtree(tmpdir)
+
+
+if __name__ == "__main__":
+  main()
@@ -0,0 +1,110 @@
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+# Copyright 2017 and onwards Google, Inc.
+#
+# For general information on the Pynini grammar compilation library, see
+# pynini.opengrm.org.
+
+
+"""Compares SequentialTransducer throughput with composition.
+
+This compiles byte-level normalization rules (case folding, digit masking, and
+whitespace squeezing, separately and as one cascade), and applies each to a
+batch of random strings in three ways: by composing the string with the rule
+and reading off the output string, with a RuleApplier, and with a
+SequentialTransducer. The throughput of each, in input bytes per second, is
+reported, after checking that all three give the same output.
+
+Usage:
+
+    python sequential_transducer_benchmark.py [--strings N] [--length N]
+"""
+
+
+from __future__ import print_function
+
+import argparse
+import random
+import string
+import time
+
+from pynini import *
+
+
+SEED = 212
+
+
+def make_rules():
+  """Returns a list of (name, rule) pairs."""
+  printable = union(*(string.ascii_letters + string.digits + " .,#"))
+  sigma_star = printable.closure().optimize()
+  case_fold = cdrewrite(
+      string_map(zip(string.ascii_uppercase, string.ascii_lowercase)), "", "",
+      sigma_star)
+  digit_mask = cdrewrite(transducer(union(*string.digits), "#"), "", "",
+                         sigma_star)
+  squeeze = cdrewrite(transducer(" ", ""), " ", "", sigma_star)
+  cascade = case_fold * digit_mask * squeeze
+  rules = [("case fold", case_fold), ("digit mask", digit_mask),
+           ("squeeze", squeeze), ("cascade", cascade)]
+  return [(name, rule.optimize()) for (name, rule) in rules]
+
+
+def random_strings(count, length):
+  alphabet = string.ascii_letters + string.digits + "  .,"
+  return ["".join(random.choice(alphabet) for _ in range(length))
+          for _ in range(count)]
+
+
+def compose_and_print(rule, istring):
+  return (istring * rule).project(True).stringify()
+
+
+def main():
+  parser = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+  parser.add_argument("--strings", type=int, default=10000,
+                      help="number of strings to apply each rule to")
+  parser.add_argument("--length", type=int, default=80,
+                      help="length of each string, in bytes")
+  args = parser.parse_args()
+  random.seed(SEED)
+  strings = random_strings(args.strings, args.length)
+  nbytes = sum(len(istring) for istring in strings)
+  print("{:<12} {:>10} {:>14} {:>14} {:>14}".format(
+      "rule", "states", "compose (B/s)", "applier (B/s)", "table (B/s)"))
+  for (name, rule) in make_rules():
+    applier = RuleApplier(rule)
+    try:
+      table = SequentialTransducer(rule)
+    except FstArgError:
+      print("{:<12} {:>10} rule is not sequential".format(name,
+                                                          rule.num_states()))
+      continue
+    appliers = (lambda istring: compose_and_print(rule, istring),
+                lambda istring: applier.top_rewrites(istring)[0],
+                table.apply)
+    for istring in strings[:100]:
+      outputs = [apply_rule(istring) for apply_rule in appliers]
+      assert outputs[0] == outputs[1] == outputs[2], (istring, outputs)
+    rates = []
+    for apply_rule in appliers:
+      start = time.time()
+      for istring in strings:
+        apply_rule(istring)
+      rates.append(nbytes / max(time.time() - start, 1e-9))
+    print("{:<12} {:>10} {:>14.0f} {:>14.0f} {:>14.0f}".format(
+        name, rule.num_states(), *rates))
+
+
+if __name__ == "__main__":
+  main()
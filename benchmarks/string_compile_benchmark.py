@@ -0,0 +1,97 @@
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+# Copyright 2017 and onwards Google, Inc.
+#
+# For general information on the Pynini grammar compilation library, see
+# pynini.opengrm.org.
+
+
+r"""Times the compilation of short strings, with and without brackets.
+
+This compiles batches of short random strings with `acceptor`, as byte and as
+UTF-8 strings, and reports the time per string for each kind: plain strings,
+strings with escaped brackets, and strings with bracketed generated symbols
+and integer labels. Tokenizing these strings is the part of compilation done
+by the bracketed-string scanner.
+
+For reference, the tokenizer which the scanner replaced ran RE2 with the
+pattern
+
+    ((?:\\[\[\]]|[^\[\]])+)|\[((?:\\[\[\]]|[^\[\]])+)\]|(.+)
+
+once per span and removed bracket escapes with two more regular expressions.
+Tokenizing 200,000 such strings took about 0.43 s that way (about 2.2 us per
+string), against 0.03 to 0.04 s with the scanner, measured by calling both
+tokenizers directly from C++.
+
+Usage:
+
+    python string_compile_benchmark.py [--strings N] [--length N]
+"""
+
+
+from __future__ import print_function
+
+import argparse
+import random
+import string
+import time
+
+from pynini import *
+
+
+SEED = 212
+
+
+def plain(length):
+  return "".join(random.choice(string.ascii_lowercase + " ")
+                 for _ in range(length))
+
+
+def escaped(length):
+  return "".join(random.choice((random.choice(string.ascii_lowercase),
+                                "\\[", "\\]"))
+                 for _ in range(length // 2))
+
+
+def bracketed(length):
+  pieces = []
+  while sum(len(piece) for piece in pieces) < length:
+    pieces.append(random.choice((plain(4), "[foo]", "[bar baz]", "[32]",
+                                 "[0x41]")))
+  return "".join(pieces)
+
+
+def main():
+  parser = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+  parser.add_argument("--strings", type=int, default=200000,
+                      help="number of strings of each kind")
+  parser.add_argument("--length", type=int, default=16,
+                      help="approximate length of each string, in bytes")
+  args = parser.parse_args()
+  random.seed(SEED)
+  print("{:<10} {:<6} {:>12}".format("strings", "type", "us/string"))
+  for (name, generate) in (("plain", plain), ("escaped", escaped),
+                           ("bracketed", bracketed)):
+    strings = [generate(args.length) for _ in range(args.strings)]
+    for token_type in ("byte", "utf8"):
+      start = time.time()
+      for istring in strings:
+        acceptor(istring, token_type=token_type)
+      seconds = time.time() - start
+      print("{:<10} {:<6} {:>12.3f}".format(
+          name, token_type, 1e6 * seconds / max(len(strings), 1)))
+
+
+if __name__ == "__main__":
+  main()
@@ -0,0 +1,105 @@
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+# Copyright 2017 and onwards Google, Inc.
+#
+# For general information on the Pynini grammar compilation library, see
+# pynini.opengrm.org.
+
+
+"""Times the compilation of mixed-script strings as UTF-8 acceptors.
+
+This compiles a million random strings drawn from several scripts (Latin,
+Greek, Cyrillic, Devanagari, and CJK, with spaces and ASCII digits) with
+`acceptor(..., token_type="utf8")`, and reports the time per string. The
+symbol table attached to each acceptor must hold every code point of the
+string; the strings are compiled plain, and again with a bracketed generated
+symbol, which is the only case in which the shared UTF-8 table is copied. Run
+it against builds before and after a change to the UTF-8 symbol tables to
+compare them.
+
+Usage:
+
+    python utf8_compile_benchmark.py [--strings N] [--length N]
+"""
+
+
+from __future__ import print_function
+
+import argparse
+import random
+import time
+
+from pynini import *
+
+
+try:
+  unichr
+except NameError:
+  unichr = chr  # pylint: disable=redefined-builtin,invalid-name
+
+
+SEED = 212
+
+
+def code_points(start, stop):
+  return u"".join(unichr(c) for c in range(start, stop))
+
+
+# Latin (with some accented letters), Greek, Cyrillic, Devanagari, and CJK.
+SCRIPTS = (u"abcdefghijklmnopqrstuvwxyz\u00e7\u00e8\u00e9\u00f1\u00fc",
+           code_points(0x03b1, 0x03ca),
+           code_points(0x0430, 0x0450),
+           code_points(0x0915, 0x0939),
+           code_points(0x4e00, 0x4e80))
+
+
+def random_string(length):
+  """Returns a string of words, each in a randomly chosen script."""
+  chars = []
+  while len(chars) < length:
+    if chars:
+      chars.append(u" ")
+    script = random.choice(SCRIPTS)
+    chars.extend(random.choice(script) for _ in range(random.randint(2, 8)))
+    if random.random() < 0.1:
+      chars.extend(random.choice(u"0123456789") for _ in range(2))
+  return u"".join(chars[:length])
+
+
+def time_compilation(strings):
+  start = time.time()
+  for istring in strings:
+    acceptor(istring, token_type="utf8")
+  return time.time() - start
+
+
+def main():
+  parser = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+  parser.add_argument("--strings", type=int, default=1000000,
+                      help="number of strings to compile")
+  parser.add_argument("--length", type=int, default=24,
+                      help="length of each string, in code points")
+  args = parser.parse_args()
+  random.seed(SEED)
+  strings = [random_string(args.length) for _ in range(args.strings)]
+  bracketed = [u"[tag]" + istring for istring in strings]
+  print("{:<22} {:>10} {:>12}".format("strings", "total (s)", "us/string"))
+  for (name, batch) in (("mixed-script", strings),
+                        ("mixed-script + [tag]", bracketed)):
+    seconds = time_compilation(batch)
+    print("{:<22} {:>10.3f} {:>12.3f}".format(
+        name, seconds, 1e6 * seconds / max(len(batch), 1)))
+
+
+if __name__ == "__main__":
+  main()
@@ -11,6 +11,7 @@ import math
 import os
 import pickle
 import string
+import struct
 import tempfile
 import unittest
 
@@ -85,6 +86,85 @@ class PyniniCDRewriteTest(unittest.TestCase):
     self.assertEqual(optimize(project("FIST" * td_deletion, True)),
                      optimize(union("FIS", "FIST")))
 
+  def testCDRewriteCompilerReusesFilters(self):
+    with CDRewriteCompiler() as compiler:
+      a_to_b = compiler.cdrewrite(transducer("A", "B"), "C", "D", self.sigstar)
+      self.TestRule(a_to_b, "CADCAD", "CBDCBD")
+      misses = compiler.cache_info().misses
+      a_to_e = compiler.cdrewrite(transducer("A", "E"), "C", "D", self.sigstar)
+      self.TestRule(a_to_e, "CADCAD", "CEDCED")
+      self.assertEqual(compiler.cache_info().misses, misses)
+      self.assertGreater(compiler.cache_info().hits, 0)
+
+  def testCDRewriteCompilerWithThreads(self):
+    tau = transducer(self.coronal, "")
+    serial = cdrewrite(tau, "", "S[EOS]", self.sigstar)
+    compiler = CDRewriteCompiler(threads=4)
+    parallel = compiler.cdrewrite(tau, "", "S[EOS]", self.sigstar)
+    self.assertEqual(parallel, serial)
+    self.assertEqual(sorted(name for (name, _) in compiler.filter_times()),
+                     ["f", "l1", "l2", "r", "replace"])
+
+  def testCDRewriteCompilerBounded(self):
+    tau = transducer(self.coronal, "")
+    serial = cdrewrite(tau, "", "S[EOS]", self.sigstar)
+    compiler = CDRewriteCompiler(bounded=True)
+    bounded = compiler.cdrewrite(tau, "", "S[EOS]", self.sigstar)
+    self.assertEqual(bounded, serial)
+    self.assertEqual([stage.name for stage in compiler.stage_info()],
+                     ["f", "replace", "l1", "l2"])
+
+  def testCDRewriteCompactSigma(self):
+    tau = transducer(self.coronal, "")
+    eager = cdrewrite(tau, "", "S[EOS]", self.sigstar)
+    compact = cdrewrite(tau, "", "S[EOS]", self.sigstar, compact_sigma=True)
+    for istring in ("CONCORDS", "PVLTS", "HONORS", "SANGVINS"):
+      self.assertEqual(optimize(project(istring * compact, True)),
+                       optimize(project(istring * eager, True)))
+
+  def testCDRewriteClosureSigmaStarMatchesGeneralSigmaStar(self):
+    # The optimized sigma_star is a one-state closure, so the boundary symbols
+    # are stripped directly; the unoptimized one is composed with the boundary
+    # inserter and deleter.
+    general = union(*string.letters).closure()
+    tau = transducer(self.coronal, "")
+    lambda_ = union("[BOS]", "A", "O")
+    rho = union("S", "[EOS]")
+    for direction in ("ltr", "rtl", "sim"):
+      for mode in ("obl", "opt"):
+        closure_rule = cdrewrite(tau, lambda_, rho, self.sigstar,
+                                 direction=direction, mode=mode)
+        general_rule = cdrewrite(tau, lambda_, rho, general,
+                                 direction=direction, mode=mode)
+        self.assertTrue(randequivalent(closure_rule, general_rule, npath=100,
+                                       seed=SEED))
+        for istring in ("CONCORDS", "ANTS", "TONS", "DORT", "LAND"):
+          self.assertTrue(
+              equivalent(optimize(project(istring * closure_rule, True)),
+                         optimize(project(istring * general_rule, True))))
+
+  def testCDRewriteDelayed(self):
+    tau = transducer(self.coronal, "")
+    eager = cdrewrite(tau, "", "S[EOS]", self.sigstar)
+    delayed = cdrewrite_delayed(tau, "", "S[EOS]", self.sigstar)
+    for istring in ("CONCORDS", "PVLTS", "HONORS"):
+      self.assertEqual(optimize(project(istring * delayed, True)),
+                       optimize(project(istring * eager, True)))
+
+  def testCDRewriteMany(self):
+    rules = [(transducer("A", "B"), "C", "D"),
+             (transducer(self.coronal, ""), "", "S[EOS]"),
+             (transducer("S", "R"), "A", "E")]
+    many = cdrewrite_many(rules, self.sigstar, threads=2)
+    self.assertEqual(len(many), len(rules))
+    for (rule, (tau, lambda_, rho)) in zip(many, rules):
+      self.assertEqual(rule, cdrewrite(tau, lambda_, rho, self.sigstar))
+
+  def testCDRewriteManyReportsFailedRules(self):
+    rules = [(transducer("A", "B"), "C", "D"), (transducer("", "I"), "", "")]
+    with self.assertRaisesRegexp(FstOpError, "rules: 1$"):
+      unused_rules = cdrewrite_many(rules, self.sigstar, threads=2)
+
   def testLambdaTransducerRaisesFstOpError(self):
     with self.assertRaises(FstOpError):
       unused_f = cdrewrite(transducer("[phi]", "[psi]"),
@@ -422,6 +502,64 @@ class PyniniMatchesTest(unittest.TestCase):
     self.assertFalse(matches(m1, m2))
 
 
+class PyniniOptimizeTest(unittest.TestCase):
+
+  def testOptimizeAcyclicAcceptorIsMinimal(self):
+    lexicon = union("cat", "cats", "dog", "dogs")
+    optimized = optimize(lexicon, compute_props=True)
+    self.assertEqual(optimized.num_states(), 7)
+    self.assertItemsEqual(optimized.paths().iter_istrings(),
+                          ["cat", "cats", "dog", "dogs"])
+
+  def testOptimizeWithDeterminizeThreadsMatchesSerial(self):
+    ab = union("a", "b")
+    blowup = ab.closure() + "a" + ab.closure(6, 6)
+    serial = optimize(blowup)
+    for threads in (2, 4, 8):
+      parallel = optimize(blowup, determinize_threads=threads)
+      self.assertEqual(parallel.num_states(), serial.num_states())
+      self.assertTrue(equivalent(parallel, serial))
+    bounded = optimize(blowup, max_states=20, determinize_threads=4)
+    self.assertLess(bounded.num_states(), 20)
+
+  def testOptimizeWithDeterminizeThreadsSumsLogWeights(self):
+    a = acceptor("a", arc_type="log")
+    serial = optimize(union(a, a))
+    parallel = optimize(union(a, a), determinize_threads=2)
+    self.assertTrue(equivalent(parallel, serial))
+    self.assertFalse(equivalent(parallel, optimize(a)))
+
+  def testOptimizeWithinBudget(self):
+    # The minimal deterministic acceptor has 2^9 states.
+    ab = union("a", "b")
+    blowup = ab.closure() + "a" + ab.closure(8, 8)
+    self.assertEqual(optimize(blowup).num_states(), 512)
+    bounded = optimize(blowup, max_states=100)
+    self.assertLess(bounded.num_states(), 100)
+    self.assertTrue(matches("baaaaaaaaa", bounded))
+    self.assertFalse(matches("bbaaaaaaaa", bounded))
+
+  def testOptimizeWithThreadsMatchesSerial(self):
+    ab = union("a", "b")
+    cyclic = (ab.closure() + "a" + ab.closure(4, 4)).closure()
+    serial = optimize(cyclic, compute_props=True)
+    for threads in (2, 4, 8):
+      parallel = optimize(cyclic, compute_props=True,
+                          minimize_threads=threads)
+      self.assertEqual(parallel.num_states(), serial.num_states())
+      self.assertTrue(equivalent(parallel, serial))
+
+  def testOptimizeStatsRecordsPhases(self):
+    stats = OptimizeStats()
+    optimize(union("ab", "ac"), stats=stats)
+    self.assertTrue(stats.acceptor())
+    self.assertFalse(stats.abandoned())
+    phases = stats.phases()
+    self.assertEqual(phases[0].name, "rmepsilon")
+    self.assertIn("determinize", [phase.name for phase in phases])
+    self.assertEqual(phases[-1].states_after, 3)
+
+
 class PyniniPdtReplaceTest(unittest.TestCase):
 
   def testPdtReplace(self):
@@ -467,6 +605,83 @@ class PyniniReplaceTest(unittest.TestCase):
       unused_f = replace("[S]", (("S", s_rhs),))
 
 
+class PyniniRuleApplierTest(unittest.TestCase):
+
+  @classmethod
+  def setUpClass(cls):
+    sigstar = union(*string.letters).closure().optimize()
+    cls.rule = cdrewrite(union(transducer("T", ""), transducer("T", "D", 1)),
+                         "", "S[EOS]", sigstar)
+    cls.applier = RuleApplier(cls.rule)
+
+  def testLatticeMatchesComposition(self):
+    lattice = self.applier.lattice("PVLTS")
+    self.assertTrue(equivalent(optimize(lattice),
+                               optimize(project("PVLTS" * self.rule, True))))
+
+  def testLatticeWithGeneratedSymbolMatchesComposition(self):
+    sigstar = union("[foo]", *string.letters).closure().optimize()
+    rule = cdrewrite(transducer("[foo]", "X"), "", "", sigstar)
+    applier = RuleApplier(rule)
+    lattice = applier.lattice("a[foo]b")
+    self.assertTrue(equivalent(optimize(lattice),
+                               optimize(project("a[foo]b" * rule, True))))
+    self.assertEqual(applier.top_rewrites("a[foo]b"), ["aXb"])
+
+  def testTopRewrites(self):
+    self.assertEqual(self.applier.top_rewrites("PVLTS", 3), ["PVLS", "PVLDS"])
+
+  def testRejectedStringRaisesFstOpError(self):
+    with self.assertRaises(FstOpError):
+      unused_rewrites = self.applier.top_rewrites("PVLTS!")
+
+
+class PyniniSequentialTransducerTest(unittest.TestCase):
+
+  @classmethod
+  def setUpClass(cls):
+    sigstar = union(*string.letters).closure().optimize()
+    cls.rule = cdrewrite(transducer("T", "D"), "", "", sigstar).optimize()
+    cls.transducer = SequentialTransducer(cls.rule)
+
+  def testApplyMatchesComposition(self):
+    for istring in ("TATA", "PVLTS", ""):
+      self.assertEqual(self.transducer.apply(istring),
+                       (istring * self.rule).stringify())
+
+  def testFileIO(self):
+    tmp = os.path.join(tempfile.gettempdir(), "tmp.seq")
+    self.transducer.write(tmp)
+    try:
+      transducer = SequentialTransducer.read(tmp)
+      self.assertEqual(transducer.num_states(), self.transducer.num_states())
+      self.assertEqual(transducer.apply("TATA"), "DADA")
+    finally:
+      os.remove(tmp)
+
+  def testFileWithStartOutOfRangeRaisesFstIOError(self):
+    tmp = os.path.join(tempfile.gettempdir(), "tmp.seq")
+    self.transducer.write(tmp)
+    try:
+      # The start state follows the magic number and the arc type string.
+      with open(tmp, "r+b") as sink:
+        sink.seek(4 + 4 + len(self.transducer.arc_type()))
+        sink.write(struct.pack("=i", self.transducer.num_states()))
+      with self.assertRaises(FstIOError):
+        unused_transducer = SequentialTransducer.read(tmp)
+    finally:
+      os.remove(tmp)
+
+  def testNondeterministicRuleRaisesFstArgError(self):
+    with self.assertRaises(FstArgError):
+      unused_transducer = SequentialTransducer(
+          union(transducer("a", "b"), transducer("a", "c")))
+
+  def testRejectedStringRaisesFstOpError(self):
+    with self.assertRaises(FstOpError):
+      unused_ostring = self.transducer.apply("TATA!")
+
+
 class PyniniStringTest(unittest.TestCase):
 
   """Tests string compilation and stringification."""
@@ -621,6 +836,13 @@ class PyniniStringTest(unittest.TestCase):
     self.assertEqual(ac.stringify(ac.output_symbols()),
                      b"P o n t <SPACE> l ' E v <0xea> q u e")
 
+  def testUnicodeSymbolStringifyWithGeneratedSymbol(self):
+    ac = acceptor(u"[Tilsit]" + self.imported_cheese, token_type="utf8")
+    self.assertEqual(ac.stringify(ac.output_symbols()),
+                     b"Tilsit P o n t <SPACE> l ' E v <0xea> q u e")
+    self.assertEqual(ac.output_symbols().find("Tilsit"),
+                     ac.input_symbols().find("Tilsit"))
+
   def testStringifyOnNonkStringFstRaisesFstArgError(self):
     with self.assertRaises(FstArgError):
       unused_ac = union(self.cheese, self.imported_cheese).stringify()
@@ -666,6 +888,53 @@ class PyniniStringTest(unittest.TestCase):
     self.assertIsNone(tr.input_symbols())
     self.assertIsNone(tr.output_symbols())
 
+  def testAcceptors(self):
+    strings = [self.cheese, self.reply, b"[Wensleydale] [Wensleydale]", b""]
+    for (string, ac) in zip(strings, acceptors(strings)):
+      self.assertEqual(ac, acceptor(string))
+    (first, second) = acceptors([b"[Stilton]", b"Blue [Stilton]"])
+    stilton = first.input_symbols().find(b"Stilton")
+    self.assertEqual(stilton, second.input_symbols().find(b"Stilton"))
+
+  def testAcceptorCache(self):
+    set_acceptor_cache_size(1)
+    clear_acceptor_cache()
+    try:
+      first = acceptor(self.cheese)
+      first.closure()
+      second = acceptor(self.cheese)
+      self.assertEqual(second.stringify(), self.cheese)
+      unused_reply = acceptor(self.reply)
+      unused_cheese = acceptor(self.cheese)
+      self.assertEqual(acceptor_cache_info(),
+                       AcceptorCacheInfo(1, 3, 1, 1))
+    finally:
+      set_acceptor_cache_size(0)
+      clear_acceptor_cache()
+
+  def testCompactAcceptor(self):
+    compact = compact_acceptor(self.cheese)
+    self.assertEqual(compact.stringify(), self.cheese)
+    self.assertEqual(compact, acceptor(self.cheese))
+    self.assertEqual((compact * self.cheese).stringify(), self.cheese)
+    self.assertEqual(list(compact.paths().iter_ostrings()), [self.cheese])
+    self.assertEqual((compact + compact).stringify(), self.cheese * 2)
+    self.assertTrue(matches(self.reply, compact | self.reply))
+
+  def testWeightedCompactAcceptor(self):
+    self.assertEqual(compact_acceptor(self.cheese, weight=2),
+                     acceptor(self.cheese, weight=2))
+
+  def testAcceptorsToFar(self):
+    filename = os.path.join(tempfile.gettempdir(), "acceptors.far")
+    strings = [self.cheese, self.reply]
+    far = Far(filename, mode="w")
+    acceptors(strings, far=far, keys=[b"cheese", b"reply"])
+    far.close()
+    far = Far(filename)
+    self.assertEqual(far[b"cheese"], self.cheese)
+    self.assertEqual(far[b"reply"], self.reply)
+
 
 class PyniniStringFileTest(unittest.TestCase):
 
@@ -700,6 +969,19 @@ class PyniniStringFileTest(unittest.TestCase):
     self.ContainsMapping(utf8("[Bel Paese]"), mapper, utf8("Sorry"))
     self.ContainsMapping(utf8("Pont-l'Évêque"), mapper, utf8("Camembert"))
 
+  def testThreadedStringFile(self):
+    mapper = string_file(self.map_file, output_token_type="utf8")
+    threaded_mapper = string_file(self.map_file, output_token_type="utf8",
+                                  threads=3)
+    self.assertTrue(equal(mapper, threaded_mapper))
+
+  def testStringFileWithoutFinalNewline(self):
+    # The last line is read even though no newline follows it.
+    nonewline_file = "testdata/str_nonewline.map"
+    mapper = string_file(nonewline_file)
+    self.ContainsMapping("Red#Leicester", mapper, "Tilsit")
+    self.ContainsMapping("Caithness", mapper, "Camembert")
+    self.assertTrue(equal(mapper, string_file(nonewline_file, threads=2)))
 
   def testByteToSymbolStringFile(self):
     syms = SymbolTable()
@@ -756,6 +1038,41 @@ class PyniniStringMapTest(unittest.TestCase):
     self.ContainsMapping(utf8("[Bel Paese]"), mapper, utf8("Sorry"))
     self.ContainsMapping(utf8("Pont-l'Évêque"), mapper, utf8("Camembert"))
 
+  def testThreadedStringMap(self):
+    lines = self.lines + (("[Limburger]", "[Bel Paese]"),)
+    mapper = string_map(lines, input_token_type="utf8")
+    threaded_mapper = string_map(lines, input_token_type="utf8", threads=4)
+    self.assertTrue(equal(mapper, threaded_mapper))
+    self.assertEqual(mapper.input_symbols().find("Limburger"),
+                     threaded_mapper.input_symbols().find("Limburger"))
+
+  def testThreadedStringMapWithLargeIntegerLabels(self):
+    # 2^30 + 1 is also the first label a shard gives to generated symbols.
+    lines = self.lines + (("[Limburger]", "[1073741825]"),
+                          ("[1073741825]", "[Limburger]"))
+    mapper = string_map(lines)
+    threaded_mapper = string_map(lines, threads=4)
+    self.assertTrue(equal(mapper, threaded_mapper))
+
+  def testThreadedStringMapWithShardPlaceholderSymbol(self):
+    # Shards reserve their first generated label with this symbol.
+    lines = self.lines + (("[NorwegianBlue]", "[Limburger]"),)
+    mapper = string_map(lines)
+    threaded_mapper = string_map(lines, threads=4)
+    self.assertTrue(equal(mapper, threaded_mapper))
+
+  def testPresortedStringMap(self):
+    lines = sorted(self.lines[1:])
+    mapper = string_map(lines, presorted=True)
+    self.ContainsMapping("Cheddar", mapper, "Cheddar")
+    self.ContainsMapping("Caithness", mapper, "Pont-l'Évêque")
+    self.ContainsMapping("Pont-l'Évêque", mapper, "Camembert")
+    # Unsorted input falls back to the prefix tree.
+    mapper = string_map(reversed(lines), presorted=True)
+    self.ContainsMapping("Cheddar", mapper, "Cheddar")
+    self.ContainsMapping("Caithness", mapper, "Pont-l'Évêque")
+    self.ContainsMapping("Pont-l'Évêque", mapper, "Camembert")
+
   def testByteToSymbolStringMap(self):
     syms = SymbolTable()
     syms.add_symbol("<epsilon>")
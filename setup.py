@@ -16,6 +16,7 @@
 # pynini.opengrm.org.
 
 
+from Cython.Build import cythonize
 from setuptools import Extension
 from setuptools import setup
 
@@ -25,7 +26,8 @@ COMPILE_ARGS = ["-std=c++11",
                 "-Wno-unused-local-typedef",
                 "-funsigned-char",
                 "-O3",
-                "-march=native"]
+                "-march=native",
+                "-pthread"]
 
 pywrapfst = Extension(name="pywrapfst", language="c++",
                       extra_compile_args=COMPILE_ARGS,
@@ -43,19 +45,23 @@ pynini = Extension(name="pynini", language="c++",
                               "fstfar",
                               "fst",
                               "m",
-                              "dl"],
+                              "dl",
+                              "pthread"],
                    sources=["src/wildcardcomposescript.cc",
+                            "src/utf8.cc",
                             "src/special_arcs.cc",
+                            "src/sequentialtransducerscript.cc",
                             "src/stringtokentype.cc",
                             "src/stringprintscript.cc",
                             "src/stringmapscript.cc",
                             "src/stringfile.cc",
                             "src/stringcompilescript.cc",
                             "src/stringcompile.cc",
+                            "src/ruleapplierscript.cc",
                             "src/repeatscript.cc",
                             "src/pynini_replace.cc",
                             "src/pynini_cdrewrite.cc",
-                            "src/pynini.cc",
+                            "src/pynini.pyx",
                             "src/pathsscript.cc",
                             "src/optimizescript.cc",
                             "src/mergescript.cc",
@@ -87,7 +93,13 @@ setup(
         "Topic :: Scientific/Engineering :: Artificial Intelligence",
         "Topic :: Scientific/Engineering :: Mathematics"
     ],
-    ext_modules=[pywrapfst, pynini],
+    # pywrapfst is built from its pre-generated C++ source; pynini is
+    # generated from its Cython source at build time. The operator methods of
+    # the FST classes also handle reflected operands (e.g., "a" * fst), so they
+    # are installed directly as the C-API number slots.
+    ext_modules=cythonize([pywrapfst, pynini],
+                          compiler_directives={"language_level": 3,
+                                               "c_api_binop_methods": True}),
     packages=[''],
     package_dir={'': '.'},
     package_data={'': ['lib/libre2.so.0', 'lib/libfstfarscript.so.0', 'lib/libfstpdtscript.so.0', 'lib/libfstmpdtscript.so.0', 'lib/libfstscript.so.0', 'lib/libfstfar.so.0', 'lib/libfst.so.0']},
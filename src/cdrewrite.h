@@ -20,7 +20,19 @@
 #ifndef PYNINI_CDREWRITE_H_
 #define PYNINI_CDREWRITE_H_
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <string>
+using std::string;
+#include <thread>
+#include <tuple>
+#include <unordered_map>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 
@@ -35,8 +47,165 @@ namespace fst {
 enum CDRewriteDirection { LEFT_TO_RIGHT, RIGHT_TO_LEFT, SIMULTANEOUS };
 enum CDRewriteMode { OBLIGATORY, OPTIONAL };
 
+// The size of the result of one composition in a rewrite rule's cascade, named
+// for the FST composed with the result of the previous stage, both as composed
+// and after optimization (in bounded compilation).
+struct CDRewriteStageStats {
+  string name;
+  size_t states;
+  size_t arcs;
+  size_t shrunk_states;
+  size_t shrunk_arcs;
+};
+
 namespace internal {
 
+// Computes a fingerprint of the states, arcs, and final weights of an FST,
+// ignoring its symbol tables. Equal FSTs (with identical state numbering)
+// receive the same fingerprint.
+template <class Arc>
+uint64 FstFingerprint(const Fst<Arc> &fst) {
+  uint64 h = static_cast<uint64>(fst.Start()) + 1;
+  for (StateIterator<Fst<Arc>> siter(fst); !siter.Done(); siter.Next()) {
+    const auto s = siter.Value();
+    h = h * 7853 + s;
+    h = h * 7867 + fst.Final(s).Hash();
+    for (ArcIterator<Fst<Arc>> aiter(fst, s); !aiter.Done(); aiter.Next()) {
+      const auto &arc = aiter.Value();
+      h = h * 7873 + static_cast<uint64>(arc.ilabel);
+      h = h * 7877 + static_cast<uint64>(arc.olabel);
+      h = h * 7879 + arc.weight.Hash();
+      h = h * 7883 + static_cast<uint64>(arc.nextstate);
+    }
+  }
+  return h;
+}
+
+// Memoizes the filters, and the alphabet-derived FSTs used to build them, of
+// context-dependent rewrite rules, so that they can be reused across rules
+// which share an alphabet and contexts. Entries are keyed by fingerprint;
+// since fingerprints may collide, a copy of each FST from which an entry was
+// derived is kept with it and compared against on lookup.
+//
+// This class is thread-safe; entries are immutable once added, and are handed
+// out by shared pointer, so they may be read without holding the lock.
+template <class Arc>
+class CDRewriteFilterCache {
+ public:
+  using Label = typename Arc::Label;
+  using Markers = std::vector<std::pair<Label, Label>>;
+
+  // The unweighted alphabet, and its reverse (with epsilons removed).
+  struct SigmaEntry {
+    VectorFst<Arc> sigma;
+    VectorFst<StdArc> usigma;
+    VectorFst<StdArc> reversed_usigma;
+  };
+
+  CDRewriteFilterCache() : hits_(0), misses_(0) {}
+
+  // Returns the alphabet entry for sigma, creating it if necessary.
+  std::shared_ptr<const SigmaEntry> FindSigma(const Fst<Arc> &sigma) {
+    const auto fingerprint = FstFingerprint(sigma);
+    std::lock_guard<std::mutex> lock(mu_);
+    auto &entry = sigmas_[fingerprint];
+    if (!entry || !Equal(entry->sigma, sigma, kDelta)) {
+      // On a collision, filters built over the other alphabet are discarded.
+      if (entry) EraseFilters(fingerprint);
+      std::shared_ptr<SigmaEntry> new_entry(new SigmaEntry);
+      new_entry->sigma = sigma;
+      Map(sigma, &new_entry->usigma, RmWeightMapper<Arc, StdArc>());
+      Reverse(new_entry->usigma, &new_entry->reversed_usigma);
+      RmEpsilon(&new_entry->reversed_usigma);
+      entry = new_entry;
+    }
+    return entry;
+  }
+
+  // Returns the cached filter built from beta and sigma with the given marker
+  // type and markers, in the given direction, or null if there is none.
+  std::shared_ptr<const Fst<Arc>> FindFilter(const Fst<Arc> &beta,
+                                             const Fst<Arc> &sigma, int type,
+                                             const Markers &markers,
+                                             bool reverse) {
+    const auto key = MakeKey(beta, sigma, type, markers, reverse);
+    std::lock_guard<std::mutex> lock(mu_);
+    const auto it = filters_.find(key);
+    if (it == filters_.end() || !Equal(*it->second.beta, beta, kDelta)) {
+      ++misses_;
+      return nullptr;
+    }
+    ++hits_;
+    return it->second.filter;
+  }
+
+  void InsertFilter(const Fst<Arc> &beta, const Fst<Arc> &sigma, int type,
+                    const Markers &markers, bool reverse,
+                    const Fst<Arc> &filter) {
+    const auto key = MakeKey(beta, sigma, type, markers, reverse);
+    FilterEntry entry;
+    entry.beta = std::make_shared<VectorFst<Arc>>(beta);
+    entry.filter = std::make_shared<VectorFst<Arc>>(filter);
+    std::lock_guard<std::mutex> lock(mu_);
+    filters_[key] = std::move(entry);
+  }
+
+  size_t Hits() const {
+    std::lock_guard<std::mutex> lock(mu_);
+    return hits_;
+  }
+
+  size_t Misses() const {
+    std::lock_guard<std::mutex> lock(mu_);
+    return misses_;
+  }
+
+  size_t Size() const {
+    std::lock_guard<std::mutex> lock(mu_);
+    return filters_.size();
+  }
+
+  void Clear() {
+    std::lock_guard<std::mutex> lock(mu_);
+    sigmas_.clear();
+    filters_.clear();
+    hits_ = 0;
+    misses_ = 0;
+  }
+
+ private:
+  using FilterKey = std::tuple<uint64, uint64, int, Markers, bool>;
+
+  struct FilterEntry {
+    std::shared_ptr<const Fst<Arc>> beta;
+    std::shared_ptr<const Fst<Arc>> filter;
+  };
+
+  // The sigma fingerprint suffices here, as sigma has been checked for
+  // collisions by the time a filter is looked up.
+  static FilterKey MakeKey(const Fst<Arc> &beta, const Fst<Arc> &sigma,
+                           int type, const Markers &markers, bool reverse) {
+    return FilterKey(FstFingerprint(beta), FstFingerprint(sigma), type,
+                     markers, reverse);
+  }
+
+  void EraseFilters(uint64 sigma_fingerprint) {
+    for (auto it = filters_.begin(); it != filters_.end();) {
+      if (std::get<1>(it->first) == sigma_fingerprint) {
+        it = filters_.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+
+  mutable std::mutex mu_;
+  std::map<uint64, std::shared_ptr<const SigmaEntry>> sigmas_;
+  std::map<FilterKey, FilterEntry> filters_;
+  size_t hits_;
+  size_t misses_;
+};
+
 // This class is used to represent context-dependent rewrite rules.  A
 // given rule can be compile into a weighted transducer using
 // different parameters (direction, mode, alphabet) by calling
@@ -62,13 +231,18 @@ class CDRewriteRule {
   // phi, lambda, and rho must be unweighted acceptors and psi must be a
   // weighted transducer when phiXpsi is true and a weighted acceptor
   // otherwise.
+  //
+  // If a filter cache is provided, filters are looked up in, and added to, it.
   CDRewriteRule(const Fst<Arc> &phi, const Fst<Arc> &psi,
-                const Fst<Arc> &lambda, const Fst<Arc> &rho, bool phiXpsi)
+                const Fst<Arc> &lambda, const Fst<Arc> &rho, bool phiXpsi,
+                CDRewriteFilterCache<Arc> *cache = nullptr)
       : phi_(phi.Copy()),
         psi_(psi.Copy()),
         lambda_(lambda.Copy()),
         rho_(rho.Copy()),
-        phiXpsi_(phiXpsi) {}
+        phiXpsi_(phiXpsi),
+        cache_(cache),
+        delayed_(nullptr) {}
 
   // Builds the transducer representing the context-dependent rewrite rule.
   // sigma is an FST specifying (the closure of) the alphabet for the resulting
@@ -78,10 +252,52 @@ class CDRewriteRule {
   //
   // The error bit on the output FST is set if any argument does not satisfy the
   // preconditions.
+  //
+  // The filters are built on up to the given number of threads. If times is
+  // non-null, it is filled with the name of each filter and the number of
+  // seconds spent building it.
+  //
+  // If bounded is true, peak memory use is bounded by freeing each filter as
+  // soon as it has been composed and optimizing each intermediate result
+  // before the next composition. If stats is non-null, it is filled with the
+  // size of the result of each composition.
   void Compile(const Fst<Arc> &sigma, MutableFst<Arc> *fst,
-               CDRewriteDirection dir, CDRewriteMode mode);
+               CDRewriteDirection dir, CDRewriteMode mode, int threads = 1,
+               std::vector<std::pair<string, double>> *times = nullptr,
+               bool bounded = false,
+               std::vector<CDRewriteStageStats> *stats = nullptr);
+
+  // As above, but rather than composing the cascade of filters, returns their
+  // delayed composition, whose states are computed (and cached) only as they
+  // are visited; when the rule is applied to a string, only the states of the
+  // cascade reachable on that string are ever expanded. The result is neither
+  // optimized nor arc-sorted. Returns null if any argument does not satisfy
+  // the preconditions.
+  Fst<Arc> *CompileDelayed(
+      const Fst<Arc> &sigma, CDRewriteDirection dir, CDRewriteMode mode,
+      int threads = 1,
+      std::vector<std::pair<string, double>> *times = nullptr);
 
  private:
+  // A named task which builds one filter.
+  struct FilterTask {
+    const char *name;
+    std::function<void()> build;
+  };
+
+  void BuildFilters(const std::vector<FilterTask> &tasks);
+
+  // A named FST in the composition cascade.
+  struct CascadeStage {
+    const char *name;
+    MutableFst<Arc> *fst;
+  };
+
+  void ComposeCascade(const std::vector<CascadeStage> &stages,
+                      MutableFst<Arc> *fst);
+
+  void RecordStage(const char *name, const ExpandedFst<Arc> &fst);
+
   enum MarkerType { MARK = 1, CHECK = 2, CHECK_COMPLEMENT = 3};
 
   void MakeMarker(VectorFst<StdArc> *fst, const VectorFst<StdArc> &sigma,
@@ -111,13 +327,25 @@ class CDRewriteRule {
 
   static Label MaxLabel(const Fst<Arc> &fst);
 
+  static void Materialize(std::unique_ptr<Fst<Arc>> *fst);
+
+  static size_t TotalArcs(const ExpandedFst<Arc> &fst);
+
   std::unique_ptr<Fst<Arc>> phi_;
   std::unique_ptr<Fst<Arc>> psi_;
   std::unique_ptr<Fst<Arc>> lambda_;
   std::unique_ptr<Fst<Arc>> rho_;
   const bool phiXpsi_;
+  CDRewriteFilterCache<Arc> *cache_;
   CDRewriteDirection dir_;
   CDRewriteMode mode_;
+  int threads_;
+  std::vector<std::pair<string, double>> *times_;
+  bool bounded_;
+  std::vector<CDRewriteStageStats> *stats_;
+  // If non-null, Compile stores the delayed cascade here instead of composing
+  // it.
+  std::unique_ptr<Fst<Arc>> *delayed_;
 
   // The following labels are used to represent the symbols: <_1, <_2 and > in
   // Mohri and Sproat. For instance, for left-to-right obligatory rules, <_1 is
@@ -304,10 +532,28 @@ void CDRewriteRule<Arc>::MakeFilter(
     const Fst<Arc> &beta, const Fst<Arc> &sigma, MutableFst<Arc> *filter,
     MarkerType type, const std::vector<std::pair<Label, Label>> &markers,
     bool reverse) {
+  using SigmaEntry = typename CDRewriteFilterCache<Arc>::SigmaEntry;
+  std::shared_ptr<const SigmaEntry> entry;
+  if (cache_) {
+    entry = cache_->FindSigma(sigma);
+    const auto cached = cache_->FindFilter(beta, sigma, type, markers,
+                                           reverse);
+    if (cached) {
+      *filter = *cached;
+      return;
+    }
+  } else {
+    std::shared_ptr<SigmaEntry> local(new SigmaEntry);
+    Map(sigma, &local->usigma, RmWeightMapper<Arc, StdArc>());
+    if (reverse) {
+      Reverse(local->usigma, &local->reversed_usigma);
+      RmEpsilon(&local->reversed_usigma);
+    }
+    entry = local;
+  }
+  const auto &usigma = entry->usigma;
   VectorFst<StdArc> ufilter;
   Map(beta, &ufilter, RmWeightMapper<Arc, StdArc>());
-  VectorFst<StdArc> usigma;
-  Map(sigma, &usigma, RmWeightMapper<Arc, StdArc>());
   if (ufilter.Start() == kNoStateId) {
     ufilter.SetStart(ufilter.AddState());
   }
@@ -315,10 +561,7 @@ void CDRewriteRule<Arc>::MakeFilter(
     Reverse(MapFst<StdArc, StdArc, IdentityMapper<StdArc>>(
                 ufilter, IdentityMapper<StdArc>()),
             &ufilter);
-    VectorFst<StdArc> reversed_sigma;
-    Reverse(usigma, &reversed_sigma);
-    RmEpsilon(&reversed_sigma);
-    PrependSigmaStar<StdArc>(&ufilter, reversed_sigma);
+    PrependSigmaStar<StdArc>(&ufilter, entry->reversed_usigma);
   } else {
     PrependSigmaStar<StdArc>(&ufilter, usigma);
   }
@@ -334,6 +577,9 @@ void CDRewriteRule<Arc>::MakeFilter(
   }
   ArcSort(&ufilter, ILabelCompare<StdArc>());
   Map(ufilter, filter, RmWeightMapper<StdArc, Arc>());
+  if (cache_) {
+    cache_->InsertFilter(beta, sigma, type, markers, reverse, *filter);
+  }
 }
 
 // Turns the FST representing phi X psi into a "replace" transducer.
@@ -424,6 +670,103 @@ void CDRewriteRule<Arc>::MakeReplace(MutableFst<Arc> *fst,
   ArcSort(fst, ILabelCompare<Arc>());
 }
 
+// Runs the filter-building tasks, on up to threads_ threads (including the
+// calling thread), each taking the next unstarted task until none remain. As
+// each task writes only to its own filter, the result does not depend on the
+// number of threads.
+template <class Arc>
+void CDRewriteRule<Arc>::BuildFilters(const std::vector<FilterTask> &tasks) {
+  std::vector<double> seconds(tasks.size());
+  std::atomic<size_t> next(0);
+  const auto work = [&tasks, &seconds, &next] {
+    for (size_t i = next++; i < tasks.size(); i = next++) {
+      const auto start = std::chrono::steady_clock::now();
+      tasks[i].build();
+      seconds[i] = std::chrono::duration<double>(
+          std::chrono::steady_clock::now() - start).count();
+    }
+  };
+  const auto nthreads = std::min<size_t>(std::max(threads_, 1), tasks.size());
+  std::vector<std::thread> workers;
+  for (size_t i = 1; i < nthreads; ++i) workers.emplace_back(work);
+  work();
+  for (auto &worker : workers) worker.join();
+  if (times_) {
+    times_->clear();
+    for (size_t i = 0; i < tasks.size(); ++i) {
+      times_->emplace_back(tasks[i].name, seconds[i]);
+    }
+  }
+}
+
+// Composes the cascade of FSTs from left to right. Eager compositions alternate
+// between a temporary and the output FST, so that the last one writes to the
+// latter; when a delayed cascade is requested, each composition is instead a
+// ComposeFst over the previous one, with its own state cache. In bounded
+// compilation, each FST is freed once composed, and each intermediate result
+// is optimized before it is composed with the next; the last result is
+// optimized by Compile. (Compose already trims each result.)
+template <class Arc>
+void CDRewriteRule<Arc>::ComposeCascade(
+    const std::vector<CascadeStage> &stages, MutableFst<Arc> *fst) {
+  if (delayed_) {
+    std::unique_ptr<Fst<Arc>> cascade(stages[0].fst->Copy());
+    for (size_t i = 1; i < stages.size(); ++i) {
+      cascade.reset(new ComposeFst<Arc>(*cascade, *stages[i].fst));
+    }
+    *delayed_ = std::move(cascade);
+    return;
+  }
+  if (stats_) stats_->clear();
+  VectorFst<Arc> c;
+  MutableFst<Arc> *left = stages[0].fst;
+  for (size_t i = 1; i < stages.size(); ++i) {
+    MutableFst<Arc> *out = (stages.size() - 1 - i) % 2 ? &c : fst;
+    Compose(*left, *stages[i].fst, out);
+    if (bounded_) {
+      left->DeleteStates();
+      stages[i].fst->DeleteStates();
+    }
+    RecordStage(stages[i].name, *out);
+    if (bounded_ && i + 1 < stages.size()) {
+      Optimize(out);
+      if (stats_) {
+        stats_->back().shrunk_states = out->NumStates();
+        stats_->back().shrunk_arcs = TotalArcs(*out);
+      }
+    }
+    left = out;
+  }
+}
+
+// Records the size of a composition's result, if stats are requested.
+template <class Arc>
+void CDRewriteRule<Arc>::RecordStage(const char *name,
+                                     const ExpandedFst<Arc> &fst) {
+  if (!stats_) return;
+  const size_t states = fst.NumStates();
+  const size_t arcs = TotalArcs(fst);
+  stats_->push_back({name, states, arcs, states, arcs});
+}
+
+template <class Arc>
+size_t CDRewriteRule<Arc>::TotalArcs(const ExpandedFst<Arc> &fst) {
+  size_t arcs = 0;
+  for (StateIterator<Fst<Arc>> siter(fst); !siter.Done(); siter.Next()) {
+    arcs += fst.NumArcs(siter.Value());
+  }
+  return arcs;
+}
+
+// Replaces the FST with a VectorFst copy unless it is already expanded. A
+// delayed FST caches its states in a table which its shallow copies share, so
+// it may not be read on more than one thread at once.
+template <class Arc>
+void CDRewriteRule<Arc>::Materialize(std::unique_ptr<Fst<Arc>> *fst) {
+  if ((*fst)->Properties(kExpanded, false)) return;
+  fst->reset(new VectorFst<Arc>(**fst));
+}
+
 template <class Arc>
 typename Arc::Label CDRewriteRule<Arc>::MaxLabel(const Fst<Arc> &fst) {
   Label max = kNoLabel;
@@ -447,10 +790,17 @@ typename Arc::Label CDRewriteRule<Arc>::MaxLabel(const Fst<Arc> &fst) {
 // The error bit on the output FST is set if any argument does not satisfy the
 // preconditions.
 template <class Arc>
-void CDRewriteRule<Arc>::Compile(const Fst<Arc> &sigma, MutableFst<Arc> *fst,
-                                 CDRewriteDirection dir, CDRewriteMode mode) {
+void CDRewriteRule<Arc>::Compile(
+    const Fst<Arc> &sigma, MutableFst<Arc> *fst, CDRewriteDirection dir,
+    CDRewriteMode mode, int threads,
+    std::vector<std::pair<string, double>> *times, bool bounded,
+    std::vector<CDRewriteStageStats> *stats) {
   dir_ = dir;
   mode_ = mode;
+  threads_ = threads;
+  times_ = times;
+  bounded_ = bounded;
+  stats_ = stats;
   const auto props = kAcceptor | kUnweighted;
   if (phi_->Properties(props, true) != props) {
     FSTERROR() << "CDRewriteRule::Compile: phi must be an unweighted acceptor";
@@ -480,6 +830,12 @@ void CDRewriteRule<Arc>::Compile(const Fst<Arc> &sigma, MutableFst<Arc> *fst,
     fst->SetProperties(kError, kError);
     return;
   }
+  // Several filter tasks read lambda or rho, so when they may run on more
+  // than one thread, these are first materialized.
+  if (threads_ > 1) {
+    Materialize(&lambda_);
+    Materialize(&rho_);
+  }
   rbrace_ = MaxLabel(sigma) + 1;
   lbrace1_ = rbrace_ + 1;
   lbrace2_ = rbrace_ + 2;
@@ -496,12 +852,18 @@ void CDRewriteRule<Arc>::Compile(const Fst<Arc> &sigma, MutableFst<Arc> *fst,
                 *psi_, InputEpsilonMapper<Arc>()),
             &replace);
   }
-  MakeReplace(&replace, sigma);
+  // The filters and the replace transducer are independent of one another, so
+  // they are collected as tasks and built (possibly concurrently) just before
+  // the cascade is composed.
+  std::vector<FilterTask> tasks;
+  tasks.push_back({"replace", [&] { MakeReplace(&replace, sigma); }});
   switch (dir_) {
     case LEFT_TO_RIGHT: {
       // Builds r filter.
       VectorFst<Arc> r;
-      MakeFilter(*rho_, sigma, &r, MARK, {{0, rbrace_}}, true);
+      tasks.push_back({"r", [&] {
+        MakeFilter(*rho_, sigma, &r, MARK, {{0, rbrace_}}, true);
+      }});
       switch (mode_) {
         case OBLIGATORY: {
           VectorFst<Arc> phi_rbrace;  // Appends > after phi_, matches all >.
@@ -510,33 +872,38 @@ void CDRewriteRule<Arc>::Compile(const Fst<Arc> &sigma, MutableFst<Arc> *fst,
           AppendMarkers(&phi_rbrace, {{rbrace_, rbrace_}});
           // Builds f filter.
           VectorFst<Arc> f;
-          MakeFilter(phi_rbrace, sigma_rbrace, &f, MARK,
-                     {{0, lbrace1_}, {0, lbrace2_}}, true);
+          tasks.push_back({"f", [&] {
+            MakeFilter(phi_rbrace, sigma_rbrace, &f, MARK,
+                       {{0, lbrace1_}, {0, lbrace2_}}, true);
+          }});
           // Builds l1 filter.
           VectorFst<Arc> l1;
-          MakeFilter(*lambda_, sigma, &l1, CHECK, {{lbrace1_, 0}}, false);
-          IgnoreMarkers(&l1, {{lbrace2_, lbrace2_}});
-          ArcSort(&l1, ILabelCompare<Arc>());
+          tasks.push_back({"l1", [&] {
+            MakeFilter(*lambda_, sigma, &l1, CHECK, {{lbrace1_, 0}}, false);
+            IgnoreMarkers(&l1, {{lbrace2_, lbrace2_}});
+            ArcSort(&l1, ILabelCompare<Arc>());
+          }});
           // Builds l2 filter.
           VectorFst<Arc> l2;
-          MakeFilter(*lambda_, sigma, &l2, CHECK_COMPLEMENT, {{lbrace2_, 0}},
-                     false);
+          tasks.push_back({"l2", [&] {
+            MakeFilter(*lambda_, sigma, &l2, CHECK_COMPLEMENT,
+                       {{lbrace2_, 0}}, false);
+          }});
+          BuildFilters(tasks);
           // Builds (((r o f) o replace) o l1) o l2.
-          VectorFst<Arc> c;
-          Compose(r, f, &c);
-          Compose(c, replace, fst);
-          Compose(*fst, l1, &c);
-          Compose(c, l2, fst);
+          ComposeCascade({{"r", &r}, {"f", &f}, {"replace", &replace},
+                          {"l1", &l1}, {"l2", &l2}}, fst);
           break;
         }
         case OPTIONAL: {
           // Builds l filter.
           VectorFst<Arc> l;
-          MakeFilter(*lambda_, sigma, &l, CHECK, {{lbrace1_, 0}}, false);
+          tasks.push_back({"l", [&] {
+            MakeFilter(*lambda_, sigma, &l, CHECK, {{lbrace1_, 0}}, false);
+          }});
+          BuildFilters(tasks);
           // Builds (r o replace) o l.
-          VectorFst<Arc> c;
-          Compose(r, replace, &c);
-          Compose(c, l, fst);
+          ComposeCascade({{"r", &r}, {"replace", &replace}, {"l", &l}}, fst);
           break;
         }
       }
@@ -545,7 +912,9 @@ void CDRewriteRule<Arc>::Compile(const Fst<Arc> &sigma, MutableFst<Arc> *fst,
     case RIGHT_TO_LEFT: {
       // Builds l filter.
       VectorFst<Arc> l;
-      MakeFilter(*lambda_, sigma, &l, MARK, {{0, rbrace_}}, false);
+      tasks.push_back({"l", [&] {
+        MakeFilter(*lambda_, sigma, &l, MARK, {{0, rbrace_}}, false);
+      }});
       switch (mode_) {
         case OBLIGATORY: {
           VectorFst<Arc> rbrace_phi;  // Prepends > before phi, matches all >
@@ -554,33 +923,38 @@ void CDRewriteRule<Arc>::Compile(const Fst<Arc> &sigma, MutableFst<Arc> *fst,
           PrependMarkers(&rbrace_phi, {{rbrace_, rbrace_}});
           // Builds f filter.
           VectorFst<Arc> f;
-          MakeFilter(rbrace_phi, sigma_rbrace, &f, MARK,
-                     {{0, lbrace1_}, {0, lbrace2_}}, false);
+          tasks.push_back({"f", [&] {
+            MakeFilter(rbrace_phi, sigma_rbrace, &f, MARK,
+                       {{0, lbrace1_}, {0, lbrace2_}}, false);
+          }});
           // Builds r1 filter.
           VectorFst<Arc> r1;
-          MakeFilter(*rho_, sigma, &r1, CHECK, {{lbrace1_, 0}}, true);
-          IgnoreMarkers(&r1, {{lbrace2_, lbrace2_}});
-          ArcSort(&r1, ILabelCompare<Arc>());
+          tasks.push_back({"r1", [&] {
+            MakeFilter(*rho_, sigma, &r1, CHECK, {{lbrace1_, 0}}, true);
+            IgnoreMarkers(&r1, {{lbrace2_, lbrace2_}});
+            ArcSort(&r1, ILabelCompare<Arc>());
+          }});
           // Builds r2 filter.
           VectorFst<Arc> r2;
-          MakeFilter(*rho_, sigma, &r2, CHECK_COMPLEMENT, {{lbrace2_, 0}},
-                     true);
+          tasks.push_back({"r2", [&] {
+            MakeFilter(*rho_, sigma, &r2, CHECK_COMPLEMENT, {{lbrace2_, 0}},
+                       true);
+          }});
+          BuildFilters(tasks);
           // Builds (((l o f) o replace) o r1) o r2.
-          VectorFst<Arc> c;
-          Compose(l, f, &c);
-          Compose(c, replace, fst);
-          Compose(*fst, r1, &c);
-          Compose(c, r2, fst);
+          ComposeCascade({{"l", &l}, {"f", &f}, {"replace", &replace},
+                          {"r1", &r1}, {"r2", &r2}}, fst);
           break;
         }
         case OPTIONAL: {
           // Builds r filter.
           VectorFst<Arc> r;
-          MakeFilter(*rho_, sigma, &r, CHECK, {{lbrace1_, 0}}, true);
+          tasks.push_back({"r", [&] {
+            MakeFilter(*rho_, sigma, &r, CHECK, {{lbrace1_, 0}}, true);
+          }});
+          BuildFilters(tasks);
           // Builds (l o replace) o r.
-          VectorFst<Arc> c;
-          Compose(l, replace, &c);
-          Compose(c, r, fst);
+          ComposeCascade({{"l", &l}, {"replace", &replace}, {"r", &r}}, fst);
           break;
         }
       }
@@ -589,7 +963,9 @@ void CDRewriteRule<Arc>::Compile(const Fst<Arc> &sigma, MutableFst<Arc> *fst,
     case SIMULTANEOUS: {
       // Builds r filter.
       VectorFst<Arc> r;
-      MakeFilter(*rho_, sigma, &r, MARK, {{0, rbrace_}}, true);
+      tasks.push_back({"r", [&] {
+        MakeFilter(*rho_, sigma, &r, MARK, {{0, rbrace_}}, true);
+      }});
       switch (mode_) {
         case OBLIGATORY: {
           VectorFst<Arc> phi_rbrace;  // Appends > after phi, matches all >.
@@ -598,48 +974,219 @@ void CDRewriteRule<Arc>::Compile(const Fst<Arc> &sigma, MutableFst<Arc> *fst,
           AppendMarkers(&phi_rbrace, {{rbrace_, rbrace_}});
           // Builds f filter.
           VectorFst<Arc> f;
-          MakeFilter(phi_rbrace, sigma_rbrace, &f, MARK,
-                     {{0, lbrace1_}, {0, lbrace2_}}, true);
+          tasks.push_back({"f", [&] {
+            MakeFilter(phi_rbrace, sigma_rbrace, &f, MARK,
+                       {{0, lbrace1_}, {0, lbrace2_}}, true);
+          }});
           // Builds l1 filter.
           VectorFst<Arc> l1;
-          MakeFilter(*lambda_, sigma, &l1, CHECK, {{lbrace1_, lbrace1_}},
-                     false);
-          IgnoreMarkers(&l1, {{lbrace2_, lbrace2_}, {rbrace_, rbrace_}});
-          ArcSort(&l1, ILabelCompare<Arc>());
+          tasks.push_back({"l1", [&] {
+            MakeFilter(*lambda_, sigma, &l1, CHECK, {{lbrace1_, lbrace1_}},
+                       false);
+            IgnoreMarkers(&l1, {{lbrace2_, lbrace2_}, {rbrace_, rbrace_}});
+            ArcSort(&l1, ILabelCompare<Arc>());
+          }});
           // Builds l2 filter.
           VectorFst<Arc> l2;
-          MakeFilter(*lambda_, sigma, &l2, CHECK_COMPLEMENT,
-                     {{lbrace2_, lbrace2_}}, false);
-          IgnoreMarkers(&l2, {{lbrace1_, lbrace1_}, {rbrace_, rbrace_}});
-          ArcSort(&l2, ILabelCompare<Arc>());
+          tasks.push_back({"l2", [&] {
+            MakeFilter(*lambda_, sigma, &l2, CHECK_COMPLEMENT,
+                       {{lbrace2_, lbrace2_}}, false);
+            IgnoreMarkers(&l2, {{lbrace1_, lbrace1_}, {rbrace_, rbrace_}});
+            ArcSort(&l2, ILabelCompare<Arc>());
+          }});
+          BuildFilters(tasks);
           // Builds (((r o f) o l1) o l2) o replace.
-          VectorFst<Arc> c;
-          Compose(r, f, &c);
-          Compose(c, l1, fst);
-          Compose(*fst, l2, &c);
-          Compose(c, replace, fst);
+          ComposeCascade({{"r", &r}, {"f", &f}, {"l1", &l1}, {"l2", &l2},
+                          {"replace", &replace}}, fst);
           break;
         }
         case OPTIONAL: {
           // Builds l filter.
           VectorFst<Arc> l;
-          MakeFilter(*lambda_, sigma, &l, CHECK, {{0, lbrace1_}}, false);
-          IgnoreMarkers(&l, {{rbrace_, rbrace_}});
-          ArcSort(&l, ILabelCompare<Arc>());
+          tasks.push_back({"l", [&] {
+            MakeFilter(*lambda_, sigma, &l, CHECK, {{0, lbrace1_}}, false);
+            IgnoreMarkers(&l, {{rbrace_, rbrace_}});
+            ArcSort(&l, ILabelCompare<Arc>());
+          }});
+          BuildFilters(tasks);
           // Builds (r o l) o replace.
-          VectorFst<Arc> c;
-          Compose(r, l, &c);
-          Compose(c, replace, fst);
+          ComposeCascade({{"r", &r}, {"l", &l}, {"replace", &replace}}, fst);
           break;
         }
       }
       break;
     }
   }
+  // A delayed cascade is neither optimized nor sorted, as doing so would
+  // expand it.
+  if (delayed_) return;
   Optimize(fst);
   ArcSort(fst, ILabelCompare<Arc>());
+  if (bounded_ && stats_ && !stats_->empty()) {
+    stats_->back().shrunk_states = fst->NumStates();
+    stats_->back().shrunk_arcs = TotalArcs(*fst);
+  }
 }
 
+template <class Arc>
+Fst<Arc> *CDRewriteRule<Arc>::CompileDelayed(
+    const Fst<Arc> &sigma, CDRewriteDirection dir, CDRewriteMode mode,
+    int threads, std::vector<std::pair<string, double>> *times) {
+  VectorFst<Arc> fst;
+  std::unique_ptr<Fst<Arc>> delayed;
+  delayed_ = &delayed;
+  Compile(sigma, &fst, dir, mode, threads, times);
+  delayed_ = nullptr;
+  if (fst.Properties(kError, false) == kError) return nullptr;
+  return delayed.release();
+}
+
+// Computes phi, the unweighted input projection of tau, reading tau through
+// delayed projection and mapping rather than copying it.
+template <class Arc>
+void MakePhi(const Fst<Arc> &tau, MutableFst<Arc> *phi) {
+  ArcMap(ProjectFst<Arc>(tau, PROJECT_INPUT), phi, RmWeightMapper<Arc>());
+  Optimize(phi);
+}
+
+// Partitions the labels of sigma into classes of labels which are
+// interchangeable for the purposes of rule compilation: those which label
+// exactly the same transitions of (unweighted) sigma and which are not
+// mentioned by any of the other FSTs given (i.e., the rule's arguments), nor
+// in the given list of labels. Compiling a rule over sigma with each class
+// collapsed to a single representative label, then expanding the
+// representative to each member of its class, gives the same rule as
+// compiling it over sigma itself, so that, for instance, a rule over all of
+// Unicode whose arguments mention only a handful of characters is compiled
+// over an alphabet of a few labels rather than over a million.
+template <class Arc>
+class LabelClasses {
+ public:
+  using Label = typename Arc::Label;
+  using StateId = typename Arc::StateId;
+
+  LabelClasses(const Fst<Arc> &sigma, const std::vector<const Fst<Arc> *> &fsts,
+               const std::vector<Label> &labels = {}) {
+    // Classes are only formed over unweighted alphabets, as cdrewrite
+    // requires.
+    if (sigma.Properties(kUnweighted, true) != kUnweighted) return;
+    std::unordered_set<Label> mentioned(labels.begin(), labels.end());
+    for (const auto *fst : fsts) {
+      for (StateIterator<Fst<Arc>> siter(*fst); !siter.Done(); siter.Next()) {
+        for (ArcIterator<Fst<Arc>> aiter(*fst, siter.Value()); !aiter.Done();
+             aiter.Next()) {
+          mentioned.insert(aiter.Value().ilabel);
+          mentioned.insert(aiter.Value().olabel);
+        }
+      }
+    }
+    // The signature of a label is the sorted list of transitions it labels.
+    using Signature = std::vector<std::pair<StateId, StateId>>;
+    std::map<Label, Signature> signatures;
+    for (StateIterator<Fst<Arc>> siter(sigma); !siter.Done(); siter.Next()) {
+      const auto s = siter.Value();
+      for (ArcIterator<Fst<Arc>> aiter(sigma, s); !aiter.Done();
+           aiter.Next()) {
+        const auto &arc = aiter.Value();
+        if (arc.ilabel == 0 || mentioned.count(arc.ilabel)) continue;
+        signatures[arc.ilabel].emplace_back(s, arc.nextstate);
+      }
+    }
+    // The representative of each class is its smallest label.
+    std::map<Signature, Label> classes;
+    for (auto &signature : signatures) {
+      std::sort(signature.second.begin(), signature.second.end());
+      const auto it = classes.emplace(signature.second, signature.first).first;
+      auto &members = members_[it->second];
+      members.push_back(signature.first);
+      if (it->second != signature.first) {
+        representatives_[signature.first] = it->second;
+      }
+    }
+    // Singleton classes need not be expanded.
+    for (auto it = members_.begin(); it != members_.end();) {
+      if (it->second.size() == 1) {
+        it = members_.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+
+  // Deletes all arcs bearing a label which is not the representative of its
+  // class. This collapses sigma, or any FST in which every such arc is paired
+  // with an otherwise-identical arc bearing the representative instead.
+  void Collapse(MutableFst<Arc> *fst) const {
+    if (representatives_.empty()) return;
+    std::vector<Arc> arcs;
+    for (StateId s = 0; s < fst->NumStates(); ++s) {
+      arcs.clear();
+      bool collapsed = false;
+      for (ArcIterator<MutableFst<Arc>> aiter(*fst, s); !aiter.Done();
+           aiter.Next()) {
+        const auto &arc = aiter.Value();
+        if (representatives_.count(arc.ilabel) ||
+            representatives_.count(arc.olabel)) {
+          collapsed = true;
+        } else {
+          arcs.push_back(arc);
+        }
+      }
+      if (!collapsed) continue;
+      fst->DeleteArcs(s);
+      for (const auto &arc : arcs) fst->AddArc(s, arc);
+    }
+  }
+
+  // Replaces each arc bearing the representative of a class with one arc for
+  // each member of the class. An arc bearing the same representative on both
+  // sides is replaced by identity arcs.
+  void Expand(MutableFst<Arc> *fst) const {
+    if (members_.empty()) return;
+    std::vector<Arc> arcs;
+    for (StateId s = 0; s < fst->NumStates(); ++s) {
+      arcs.clear();
+      bool expanded = false;
+      for (ArcIterator<MutableFst<Arc>> aiter(*fst, s); !aiter.Done();
+           aiter.Next()) {
+        const auto &arc = aiter.Value();
+        const auto imembers = members_.find(arc.ilabel);
+        const auto omembers = members_.find(arc.olabel);
+        if (imembers == members_.end() && omembers == members_.end()) {
+          arcs.push_back(arc);
+          continue;
+        }
+        expanded = true;
+        if (arc.ilabel == arc.olabel) {
+          for (const auto label : imembers->second) {
+            arcs.emplace_back(label, label, arc.weight, arc.nextstate);
+          }
+          continue;
+        }
+        const std::vector<Label> ilabels = imembers == members_.end()
+            ? std::vector<Label>{arc.ilabel} : imembers->second;
+        const std::vector<Label> olabels = omembers == members_.end()
+            ? std::vector<Label>{arc.olabel} : omembers->second;
+        for (const auto ilabel : ilabels) {
+          for (const auto olabel : olabels) {
+            arcs.emplace_back(ilabel, olabel, arc.weight, arc.nextstate);
+          }
+        }
+      }
+      if (!expanded) continue;
+      fst->DeleteArcs(s);
+      for (const auto &arc : arcs) fst->AddArc(s, arc);
+    }
+  }
+
+ private:
+  // Maps each collapsed label to the representative of its class.
+  std::unordered_map<Label, Label> representatives_;
+  // Maps the representative of each class of two or more labels to the
+  // members of that class (including itself).
+  std::unordered_map<Label, std::vector<Label>> members_;
+};
+
 }  // namespace internal.
 
 // Builds a transducer representing the context-dependent rewrite rule:
@@ -706,13 +1253,104 @@ void CDRewriteCompile(const Fst<Arc> &tau, const Fst<Arc> &lambda,
                       const Fst<Arc> &rho, const Fst<Arc> &sigma,
                       MutableFst<Arc> *fst, CDRewriteDirection dir,
                       CDRewriteMode mode) {
-  VectorFst<Arc> phi(tau);
-  Project(&phi, PROJECT_INPUT);
-  ArcMap(&phi, RmWeightMapper<Arc>());
-  Optimize(&phi);
+  VectorFst<Arc> phi;
+  internal::MakePhi(tau, &phi);
   CDRewriteCompile(phi, tau, lambda, rho, sigma, fst, dir, mode, true);
 }
 
+// Builds a delayed transducer representing the context-dependent rewrite rule
+//
+//   phi -> psi / lamba __ rho .
+//
+// where tau represents the cross-product of phi X psi, with the same
+// preconditions as CDRewriteCompile. The returned FST is a lazy composition of
+// the rule's filters, so that applying it to a short string visits only a
+// small part of the rule. Returns null if any argument does not satisfy the
+// preconditions.
+template <class Arc>
+Fst<Arc> *CDRewriteCompileDelayed(const Fst<Arc> &tau, const Fst<Arc> &lambda,
+                                  const Fst<Arc> &rho, const Fst<Arc> &sigma,
+                                  CDRewriteDirection dir, CDRewriteMode mode) {
+  VectorFst<Arc> phi;
+  internal::MakePhi(tau, &phi);
+  internal::CDRewriteRule<Arc> cdrule(phi, tau, lambda, rho, true);
+  return cdrule.CompileDelayed(sigma, dir, mode);
+}
+
+// Compiles context-dependent rewrite rules as do the CDRewriteCompile
+// functions, but memoizes the filters built for each rule (which depend only on
+// the alphabet, the contexts, phi, and the direction and mode), so that rules
+// sharing an alphabet and contexts need not rebuild them. The filters for each
+// rule are built on up to the given number of threads, and the time spent
+// building each, as well as the size of each stage of the composition cascade,
+// is recorded.
+//
+// This class is neither thread-safe nor thread-hostile.
+template <class Arc>
+class CDRewriteCompiler {
+ public:
+  // If bounded is true, rules are compiled so as to bound peak memory use; see
+  // CDRewriteRule::Compile.
+  explicit CDRewriteCompiler(int threads = 1, bool bounded = false)
+      : threads_(threads), bounded_(bounded) {}
+
+  void Compile(const Fst<Arc> &phi, const Fst<Arc> &psi,
+               const Fst<Arc> &lambda, const Fst<Arc> &rho,
+               const Fst<Arc> &sigma, MutableFst<Arc> *fst,
+               CDRewriteDirection dir, CDRewriteMode mode, bool phiXpsi) {
+    internal::CDRewriteRule<Arc> cdrule(phi, psi, lambda, rho, phiXpsi,
+                                        &cache_);
+    cdrule.Compile(sigma, fst, dir, mode, threads_, &times_, bounded_,
+                   &stats_);
+  }
+
+  // Compiles a rule where tau represents the cross-product of phi X psi.
+  void Compile(const Fst<Arc> &tau, const Fst<Arc> &lambda,
+               const Fst<Arc> &rho, const Fst<Arc> &sigma,
+               MutableFst<Arc> *fst, CDRewriteDirection dir,
+               CDRewriteMode mode) {
+    VectorFst<Arc> phi;
+    internal::MakePhi(tau, &phi);
+    Compile(phi, tau, lambda, rho, sigma, fst, dir, mode, true);
+  }
+
+  // The number of filter lookups which were, and were not, satisfied by the
+  // cache.
+  size_t Hits() const { return cache_.Hits(); }
+
+  size_t Misses() const { return cache_.Misses(); }
+
+  // The number of cached filters.
+  size_t Size() const { return cache_.Size(); }
+
+  void Clear() { cache_.Clear(); }
+
+  int Threads() const { return threads_; }
+
+  bool Bounded() const { return bounded_; }
+
+  // The name of each filter built for the last rule compiled, and the number
+  // of seconds spent building it (or retrieving it from the cache).
+  const std::vector<std::pair<string, double>> &FilterTimes() const {
+    return times_;
+  }
+
+  // The size of the result of each composition for the last rule compiled.
+  const std::vector<CDRewriteStageStats> &StageStats() const {
+    return stats_;
+  }
+
+ private:
+  const int threads_;
+  const bool bounded_;
+  internal::CDRewriteFilterCache<Arc> cache_;
+  std::vector<std::pair<string, double>> times_;
+  std::vector<CDRewriteStageStats> stats_;
+
+  CDRewriteCompiler(const CDRewriteCompiler &) = delete;
+  CDRewriteCompiler &operator=(const CDRewriteCompiler &) = delete;
+};
+
 }  // namespace fst
 
 #endif  // PYNINI_CD_REWRITE_H_
@@ -24,8 +24,11 @@ from libcpp.string cimport string
 
 from basictypes cimport int32
 from basictypes cimport int64
+from basictypes cimport uint32
+from basictypes cimport uint64
 
 from fst cimport ComposeOptions
+from fst cimport FarWriterClass
 from fst cimport FstClass
 from fst cimport MutableFstClass
 from fst cimport SymbolTable
@@ -39,10 +42,49 @@ cdef extern from "crossproductscript.h" \
                     const WeightClass &)
 
 
+cdef extern from "optimize.h" \
+    namespace "fst" nogil:
+
+  cdef cppclass OptimizeOptions:
+
+    OptimizeOptions(int64, int64, float, int, int)
+
+  cdef cppclass OptimizePhaseStats:
+
+    string name
+
+    double seconds
+
+    size_t states_before
+
+    size_t arcs_before
+
+    uint64 props_before
+
+    size_t states_after
+
+    size_t arcs_after
+
+    uint64 props_after
+
+  cdef cppclass OptimizeStats:
+
+    bool acceptor
+
+    bool idempotent
+
+    uint32 encode_flags
+
+    bool abandoned
+
+    vector[OptimizePhaseStats] phases
+
+
 cdef extern from "optimizescript.h" \
     namespace "fst::script" nogil:
 
-  void Optimize(MutableFstClass *, bool)
+  bool Optimize(MutableFstClass *, bool, const OptimizeOptions &,
+                OptimizeStats *)
 
   void OptimizeAcceptor(MutableFstClass *, bool)
 
@@ -105,6 +147,53 @@ cdef extern from "repeatscript.h" \
   void Repeat(MutableFstClass *, int32, int32)
 
 
+cdef extern from "ruleapplierscript.h" \
+    namespace "fst::script" nogil:
+
+  cdef cppclass RuleApplierClass:
+
+    RuleApplierClass(const FstClass &)
+
+    const string &ArcType()
+
+    bool Error()
+
+    bool Lattice(const string &, StringTokenType, const SymbolTable *,
+                 MutableFstClass *)
+
+    bool TopRewrites(const string &, StringTokenType, const SymbolTable *,
+                     int32, vector[string] *)
+
+
+cdef extern from "sequentialtransducerscript.h" \
+    namespace "fst" nogil:
+
+  int64 kSequentialTransducerMaxTableSize
+
+
+cdef extern from "sequentialtransducerscript.h" \
+    namespace "fst::script" nogil:
+
+  cdef cppclass SequentialTransducerClass:
+
+    SequentialTransducerClass(const FstClass &, int64)
+
+    @staticmethod
+    SequentialTransducerClass *Read(const string &)
+
+    const string &ArcType()
+
+    bool Error()
+
+    int64 NumStates()
+
+    size_t NumColumns()
+
+    bool Apply(const string &, StringTokenType, string *)
+
+    bool Write(const string &)
+
+
 cdef extern from "stringcompilescript.h" \
     namespace "fst::script" nogil:
 
@@ -112,18 +201,30 @@ cdef extern from "stringcompilescript.h" \
                      StringTokenType, MutableFstClass *,
                      const SymbolTable *, bool)
 
+  FstClass *CompileCompactString(const string &, const WeightClass &,
+                                 const string &, StringTokenType,
+                                 const SymbolTable *, bool)
+
+  bool CompileStrings(const vector[string] &, const WeightClass &,
+                      StringTokenType, const vector[MutableFstClass *] &,
+                      const SymbolTable *, bool)
+
+  bool CompileStringsToFar(const vector[string] &, const vector[string] &,
+                           const WeightClass &, StringTokenType,
+                           FarWriterClass *, const SymbolTable *, bool)
+
 
 cdef extern from "stringmapscript.h" \
     namespace "fst::script" nogil:
 
   bool StringFile(const string &, StringTokenType, StringTokenType,
                   MutableFstClass *, const SymbolTable *, const SymbolTable *,
-                  bool, bool)
+                  bool, bool, int, bool)
 
   bool StringMap(const vector[vector[string]] &,
                  StringTokenType, StringTokenType, MutableFstClass *,
                  const SymbolTable *, const SymbolTable *,
-                 bool, bool)
+                 bool, bool, int, bool)
 
 
 cdef extern from "stringprintscript.h" \
@@ -0,0 +1,275 @@
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Copyright 2017 and onwards Google, Inc.
+//
+// For general information on the Pynini grammar compilation library, see
+// pynini.opengrm.org.
+
+#ifndef PYNINI_MINIMAL_ACYCLIC_BUILDER_H_
+#define PYNINI_MINIMAL_ACYCLIC_BUILDER_H_
+
+#include <algorithm>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include <fst/compat.h>
+#include <fst/log.h>
+#include <fst/arc.h>
+#include <fst/vector-fst.h>
+#include "prefix_tree.h"
+
+namespace fst {
+
+// Incrementally builds the minimal acyclic transducer for a lexicographically
+// sorted sequence of entries, following Daciuk et al. (2000), "Incremental
+// construction of minimal acyclic finite-state automata". Each entry is a pair
+// of label sequences plus a weight, and is treated as a single string of label
+// pairs: (i_1, 0) ... (i_n, 0) (0, o_1) ... (0, o_m), with the weight as the
+// final weight. Entries must therefore be sorted by input labels, then by
+// output labels, where a sequence precedes all of its extensions. As soon as
+// an entry arrives, the states no later entry can reach are merged with any
+// equivalent state already built, so memory use is bounded by the size of the
+// minimal automaton rather than that of the prefix tree.
+//
+// This class is neither thread-safe nor thread-hostile.
+template <class Arc>
+class MinimalAcyclicBuilder {
+ public:
+  using Label = typename Arc::Label;
+  using StateId = typename Arc::StateId;
+  using Weight = typename Arc::Weight;
+
+  MinimalAcyclicBuilder()
+      : register_(0, StateHash(&states_), StateEqual(&states_)) {
+    Clear();
+  }
+
+  MinimalAcyclicBuilder(const MinimalAcyclicBuilder &) = delete;
+
+  MinimalAcyclicBuilder &operator=(const MinimalAcyclicBuilder &) = delete;
+
+  // Adds an entry, consisting of two label sequences and a weight, each label
+  // sequence given as a pair of iterators. Epsilons are skipped. Returns false,
+  // leaving the builder unchanged, if the entry sorts before the previous one.
+  template <class Iterator1, class Iterator2>
+  bool Add(Iterator1 iter1, Iterator1 end1,
+           Iterator2 iter2, Iterator2 end2,
+           const Weight &weight = Weight::One()) {
+    word_.clear();
+    for (/* empty */; iter1 != end1; ++iter1) {
+      if (*iter1) word_.push_back(Pack(*iter1, 0));
+    }
+    for (/* empty */; iter2 != end2; ++iter2) {
+      if (*iter2) word_.push_back(Pack(0, *iter2));
+    }
+    const auto mismatch = std::mismatch(
+        word_.begin(), word_.begin() + std::min(word_.size(), prev_.size()),
+        prev_.begin());
+    const size_t prefix = mismatch.first - word_.begin();
+    if (prefix < prev_.size() &&
+        (prefix == word_.size() || word_[prefix] < prev_[prefix])) {
+      return false;
+    }
+    if (prefix == word_.size() && prefix == prev_.size()) {
+      // Repeats the previous entry.
+      auto &state = states_[path_.back()];
+      state.weight = Plus(state.weight, weight);
+      return true;
+    }
+    Minimize(prefix);
+    for (auto i = prefix; i < word_.size(); ++i) {
+      const auto q = NewState();
+      states_[path_.back()].arcs.emplace_back(word_[i], q);
+      path_.push_back(q);
+    }
+    states_[path_.back()].weight = weight;
+    prev_.swap(word_);
+    return true;
+  }
+
+  // Adds all entries so far, in order, to a prefix tree.
+  void CopyTo(PrefixTree<Arc> *ptree) const {
+    std::vector<Label> ilabels;
+    std::vector<Label> olabels;
+    // Depth-first traversal; each stack entry is a state and the index of its
+    // next arc.
+    std::vector<std::pair<StateId, size_t>> stack;
+    std::vector<uint64> labels;
+    stack.emplace_back(0, 0);
+    const auto &root = states_[0];
+    if (root.weight != Weight::Zero()) {
+      ptree->Add(ilabels.begin(), ilabels.end(), olabels.begin(),
+                 olabels.end(), root.weight);
+    }
+    while (!stack.empty()) {
+      auto &top = stack.back();
+      const auto &state = states_[top.first];
+      if (top.second == state.arcs.size()) {
+        stack.pop_back();
+        if (!labels.empty()) labels.pop_back();
+        continue;
+      }
+      const auto &arc = state.arcs[top.second++];
+      labels.push_back(arc.first);
+      stack.emplace_back(arc.second, 0);
+      const auto &next = states_[arc.second];
+      if (next.weight != Weight::Zero()) {
+        ilabels.clear();
+        olabels.clear();
+        for (const auto label : labels) {
+          if (ILabel(label)) {
+            ilabels.push_back(ILabel(label));
+          } else {
+            olabels.push_back(OLabel(label));
+          }
+        }
+        ptree->Add(ilabels.begin(), ilabels.end(), olabels.begin(),
+                   olabels.end(), next.weight);
+      }
+    }
+  }
+
+  // Removes all entries.
+  void Clear() {
+    states_.clear();
+    free_.clear();
+    register_.clear();
+    prev_.clear();
+    path_.clear();
+    path_.push_back(NewState());
+  }
+
+  // Writes the minimal transducer to a mutable FST. The builder cannot be
+  // added to afterwards, except after a call to Clear.
+  void ToFst(MutableFst<Arc> *fst) {
+    Minimize(0);
+    fst->DeleteStates();
+    // Assigns state IDs in depth-first order, since freed states leave gaps.
+    std::vector<StateId> ids(states_.size(), kNoStateId);
+    std::vector<StateId> stack;
+    stack.push_back(0);
+    ids[0] = fst->AddState();
+    fst->SetStart(ids[0]);
+    while (!stack.empty()) {
+      const auto q = stack.back();
+      stack.pop_back();
+      const auto &state = states_[q];
+      fst->SetFinal(ids[q], state.weight);
+      fst->ReserveArcs(ids[q], state.arcs.size());
+      for (const auto &arc : state.arcs) {
+        if (ids[arc.second] == kNoStateId) {
+          ids[arc.second] = fst->AddState();
+          stack.push_back(arc.second);
+        }
+        fst->AddArc(ids[q], Arc(ILabel(arc.first), OLabel(arc.first),
+                                Weight::One(), ids[arc.second]));
+      }
+    }
+    prev_.clear();
+    path_.resize(1);
+  }
+
+ private:
+  // A label pair, packed so that its integer order is lexicographic.
+  static uint64 Pack(Label ilabel, Label olabel) {
+    return (static_cast<uint64>(ilabel) << 32) | static_cast<uint32>(olabel);
+  }
+
+  static Label ILabel(uint64 label) { return label >> 32; }
+
+  static Label OLabel(uint64 label) { return label & 0xffffffff; }
+
+  struct State {
+    // Arcs as (label pair, destination) pairs, in increasing label order.
+    std::vector<std::pair<uint64, StateId>> arcs;
+    Weight weight;
+
+    State() : weight(Weight::Zero()) {}
+  };
+
+  class StateHash {
+   public:
+    explicit StateHash(const std::vector<State> *states) : states_(states) {}
+
+    size_t operator()(StateId q) const {
+      const auto &state = (*states_)[q];
+      size_t h = state.weight.Hash();
+      for (const auto &arc : state.arcs) {
+        h = h * 7853 + arc.first;
+        h = h * 7867 + arc.second;
+      }
+      return h;
+    }
+
+   private:
+    const std::vector<State> *states_;
+  };
+
+  class StateEqual {
+   public:
+    explicit StateEqual(const std::vector<State> *states) : states_(states) {}
+
+    bool operator()(StateId q, StateId r) const {
+      const auto &x = (*states_)[q];
+      const auto &y = (*states_)[r];
+      return x.weight == y.weight && x.arcs == y.arcs;
+    }
+
+   private:
+    const std::vector<State> *states_;
+  };
+
+  StateId NewState() {
+    if (free_.empty()) {
+      states_.emplace_back();
+      return states_.size() - 1;
+    }
+    const auto q = free_.back();
+    free_.pop_back();
+    states_[q] = State();
+    return q;
+  }
+
+  // Replaces or registers the states of the current path deeper than the
+  // given depth, from the bottom up, and truncates the path to that depth.
+  void Minimize(size_t depth) {
+    for (auto i = path_.size() - 1; i > depth; --i) {
+      const auto q = path_[i];
+      const auto it = register_.find(q);
+      if (it == register_.end()) {
+        register_.insert(q);
+      } else {
+        states_[path_[i - 1]].arcs.back().second = *it;
+        states_[q].arcs.clear();
+        free_.push_back(q);
+      }
+    }
+    path_.resize(depth + 1);
+  }
+
+  std::vector<State> states_;
+  std::vector<StateId> free_;
+  std::unordered_set<StateId, StateHash, StateEqual> register_;
+  // The previous entry, and the states along its path (starting with the
+  // initial state) which have not yet been replaced or registered.
+  std::vector<uint64> prev_;
+  std::vector<StateId> path_;
+
+  // Transient data.
+  std::vector<uint64> word_;
+};
+
+}  // namespace fst
+
+#endif  // PYNINI_MINIMAL_ACYCLIC_BUILDER_H_
@@ -18,14 +18,91 @@
 #ifndef PYNINI_OPTIMIZE_H_
 #define PYNINI_OPTIMIZE_H_
 
+#include <algorithm>
+#include <chrono>
+#include <string>
 #include <type_traits>
+#include <unordered_set>
+#include <vector>
 
 #include <fst/fstlib.h>
+#include "parallel_determinize.h"
+#include "parallel_minimize.h"
 
 // These functions are generic optimization methods for mutable FSTs, inspired
 // by those originally included in Thrax.
 
 namespace fst {
+
+// Limits on determinization during optimization, which may otherwise blow up
+// exponentially. If the determinized FST would have more than max_states
+// states or max_arcs arcs, or determinization takes longer than timeout
+// seconds, it is abandoned, and the FST is left epsilon-free and arc-summed
+// but otherwise unoptimized. Negative limits, and a non-positive timeout, are
+// ignored.
+//
+// If determinize_threads is greater than one, epsilon-free unweighted
+// acceptors (including those encoded for determinization) with idempotent
+// weights are determinized on that many threads; see ParallelDeterminize. If
+// minimize_threads is greater than one, deterministic unweighted acceptors
+// which are not acyclic are minimized on that many threads; see
+// ParallelMinimize.
+struct OptimizeOptions {
+  int64 max_states;
+  int64 max_arcs;
+  float timeout;
+  int minimize_threads;
+  int determinize_threads;
+
+  explicit OptimizeOptions(int64 max_states = -1, int64 max_arcs = -1,
+                           float timeout = 0.0, int minimize_threads = 1,
+                           int determinize_threads = 1)
+      : max_states(max_states),
+        max_arcs(max_arcs),
+        timeout(timeout),
+        minimize_threads(minimize_threads),
+        determinize_threads(determinize_threads) {}
+
+  bool Bounded() const {
+    return max_states >= 0 || max_arcs >= 0 || timeout > 0.0;
+  }
+};
+
+// The duration of one phase of optimization, and the size and (known)
+// properties of the FST before and after it.
+struct OptimizePhaseStats {
+  string name;
+  double seconds;
+  size_t states_before;
+  size_t arcs_before;
+  uint64 props_before;
+  size_t states_after;
+  size_t arcs_after;
+  uint64 props_after;
+};
+
+// Records the phases of one call to Optimize, in order, and the branch taken:
+// whether the FST was optimized as an acceptor, whether its weights are
+// idempotent, how it was encoded for determinization (if at all), and whether
+// determinization was abandoned for exceeding its budget.
+struct OptimizeStats {
+  bool acceptor;
+  bool idempotent;
+  uint32 encode_flags;
+  bool abandoned;
+  std::vector<OptimizePhaseStats> phases;
+
+  OptimizeStats() { Clear(); }
+
+  void Clear() {
+    acceptor = false;
+    idempotent = false;
+    encode_flags = 0;
+    abandoned = false;
+    phases.clear();
+  }
+};
+
 namespace internal {
 
 constexpr uint64 kDoNotEncodeWeights = (kAcyclic | kUnweighted |
@@ -35,22 +112,264 @@ constexpr uint64 kDifferenceRhsProperties = kUnweighted | kAcceptor;
 
 // Helpers.
 
+// Records one phase of optimization, from construction to destruction, if
+// stats are requested; otherwise, does nothing.
+template <class Arc>
+class OptimizePhaseRecorder {
+ public:
+  OptimizePhaseRecorder(const char *name, const MutableFst<Arc> &fst,
+                        OptimizeStats *stats)
+      : fst_(fst), stats_(stats) {
+    if (!stats_) return;
+    OptimizePhaseStats phase;
+    phase.name = name;
+    Measure(&phase.states_before, &phase.arcs_before, &phase.props_before);
+    index_ = stats_->phases.size();
+    stats_->phases.push_back(phase);
+    start_ = std::chrono::steady_clock::now();
+  }
+
+  ~OptimizePhaseRecorder() {
+    if (!stats_) return;
+    auto &phase = stats_->phases[index_];
+    phase.seconds = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start_).count();
+    Measure(&phase.states_after, &phase.arcs_after, &phase.props_after);
+  }
+
+ private:
+  void Measure(size_t *states, size_t *arcs, uint64 *props) const {
+    *states = fst_.NumStates();
+    *arcs = 0;
+    for (StateIterator<MutableFst<Arc>> siter(fst_); !siter.Done();
+         siter.Next()) {
+      *arcs += fst_.NumArcs(siter.Value());
+    }
+    *props = fst_.Properties(kFstProperties, false);
+  }
+
+  const MutableFst<Arc> &fst_;
+  OptimizeStats *stats_;
+  size_t index_;
+  std::chrono::steady_clock::time_point start_;
+
+  OptimizePhaseRecorder(const OptimizePhaseRecorder &) = delete;
+  OptimizePhaseRecorder &operator=(const OptimizePhaseRecorder &) = delete;
+};
+
 // Calls RmEpsilon if the FST is not (known to be) epsilon-free.
 template <class Arc>
-void MaybeRmEpsilon(MutableFst<Arc> *fst, bool compute_props = false) {
+void MaybeRmEpsilon(MutableFst<Arc> *fst, bool compute_props = false,
+                    OptimizeStats *stats = nullptr) {
   if (fst->Properties(kNoEpsilons, compute_props) != kNoEpsilons) {
+    OptimizePhaseRecorder<Arc> phase("rmepsilon", *fst, stats);
     RmEpsilon(fst);
   }
 }
 
+// Minimizes a deterministic, acyclic, unweighted acceptor bottom-up, following
+// Revuz (1992), "Minimisation of acyclic deterministic automata in linear
+// time". States are grouped by height (the length of the longest path to a
+// state without arcs), as only states of the same height can be equivalent.
+// Heights are visited in increasing order, and each state is merged with any
+// already-visited state of its height with the same finality and the same
+// arcs, up to merging of their destinations. Unlike the partition refinement
+// done by Minimize, this takes time and space linear in the size of the FST
+// (given hashing), and merges states in place.
+template <class Arc>
+void AcyclicMinimize(MutableFst<Arc> *fst) {
+  using StateId = typename Arc::StateId;
+  Connect(fst);
+  if (fst->Start() == kNoStateId) return;
+  ArcSort(fst, ILabelCompare<Arc>());
+  // Visiting states in reverse topological order, computes their heights.
+  std::vector<StateId> order;
+  bool acyclic;
+  TopOrderVisitor<Arc> visitor(&order, &acyclic);
+  DfsVisit(*fst, &visitor);
+  const StateId nstates = order.size();
+  std::vector<StateId> states(nstates);
+  for (StateId s = 0; s < nstates; ++s) states[order[s]] = s;
+  std::vector<size_t> heights(nstates, 0);
+  size_t max_height = 0;
+  for (auto it = states.rbegin(); it != states.rend(); ++it) {
+    auto &height = heights[*it];
+    for (ArcIterator<MutableFst<Arc>> aiter(*fst, *it); !aiter.Done();
+         aiter.Next()) {
+      height = std::max(height, heights[aiter.Value().nextstate] + 1);
+    }
+    max_height = std::max(max_height, height);
+  }
+  // Buckets the states by height, by counting sort.
+  std::vector<size_t> offsets(max_height + 2, 0);
+  for (const auto height : heights) ++offsets[height + 1];
+  for (size_t h = 0; h <= max_height; ++h) offsets[h + 1] += offsets[h];
+  {
+    auto next = offsets;
+    for (StateId s = 0; s < nstates; ++s) states[next[heights[s]]++] = s;
+  }
+  // Maps each state to the state it is merged with, or to itself.
+  std::vector<StateId> merged(nstates, kNoStateId);
+  const auto hash = [&](StateId s) {
+    size_t h = fst->Final(s) != Arc::Weight::Zero();
+    for (ArcIterator<MutableFst<Arc>> aiter(*fst, s); !aiter.Done();
+         aiter.Next()) {
+      const auto &arc = aiter.Value();
+      h = h * 7853 + arc.ilabel;
+      h = h * 7867 + merged[arc.nextstate];
+    }
+    return h;
+  };
+  const auto equal = [&](StateId s, StateId t) {
+    if ((fst->Final(s) == Arc::Weight::Zero()) !=
+            (fst->Final(t) == Arc::Weight::Zero()) ||
+        fst->NumArcs(s) != fst->NumArcs(t)) {
+      return false;
+    }
+    ArcIterator<MutableFst<Arc>> siter(*fst, s);
+    ArcIterator<MutableFst<Arc>> titer(*fst, t);
+    for (; !siter.Done(); siter.Next(), titer.Next()) {
+      const auto &sarc = siter.Value();
+      const auto &tarc = titer.Value();
+      if (sarc.ilabel != tarc.ilabel ||
+          merged[sarc.nextstate] != merged[tarc.nextstate]) {
+        return false;
+      }
+    }
+    return true;
+  };
+  std::vector<StateId> dead;
+  for (size_t h = 0; h <= max_height; ++h) {
+    // Only states of the current height are ever registered.
+    std::unordered_set<StateId, decltype(hash), decltype(equal)> registry(
+        offsets[h + 1] - offsets[h], hash, equal);
+    for (auto i = offsets[h]; i < offsets[h + 1]; ++i) {
+      const auto s = states[i];
+      const auto it = registry.insert(s);
+      merged[s] = *it.first;
+      if (!it.second) dead.push_back(s);
+    }
+  }
+  // Redirects arcs to the surviving states, then deletes the others.
+  for (StateId s = 0; s < nstates; ++s) {
+    if (merged[s] != s) continue;
+    for (MutableArcIterator<MutableFst<Arc>> aiter(fst, s); !aiter.Done();
+         aiter.Next()) {
+      auto arc = aiter.Value();
+      arc.nextstate = merged[arc.nextstate];
+      aiter.SetValue(arc);
+    }
+  }
+  fst->SetStart(merged[fst->Start()]);
+  fst->DeleteStates(dead);
+}
+
+// Minimizes a deterministic FST. AcyclicMinimize is used if it is (known to be)
+// an acyclic unweighted acceptor; otherwise, ParallelMinimize is used if it is
+// (known to be) an unweighted acceptor and more than one thread is requested.
 template <class Arc>
-void DeterminizeAndMinimize(MutableFst<Arc> *fst) {
-  Determinize(*fst, fst);
-  Minimize(fst);
+void MinimizeDeterministic(MutableFst<Arc> *fst, bool compute_props = false,
+                           const OptimizeOptions &opts = OptimizeOptions(),
+                           OptimizeStats *stats = nullptr) {
+  static constexpr uint64 kProps = kAcceptor | kUnweighted;
+  const auto props = fst->Properties(kAcyclic | kProps, compute_props);
+  if (props == (kAcyclic | kProps)) {
+    OptimizePhaseRecorder<Arc> phase("acyclic_minimize", *fst, stats);
+    AcyclicMinimize(fst);
+  } else if ((props & kProps) == kProps && opts.minimize_threads > 1) {
+    OptimizePhaseRecorder<Arc> phase("parallel_minimize", *fst, stats);
+    ParallelMinimize(fst, opts.minimize_threads);
+  } else {
+    OptimizePhaseRecorder<Arc> phase("minimize", *fst, stats);
+    Minimize(fst);
+  }
 }
 
+// Determinizes the FST within the limits given by the options. The delayed
+// determinization is expanded one state at a time, in the order states are
+// discovered, and the budget is checked after each. Returns false, leaving the
+// FST unchanged, if a limit is exceeded. Epsilon-free unweighted acceptors with
+// idempotent weights are instead determinized by ParallelDeterminize, if more
+// than one thread is requested; with non-idempotent weights, determinization
+// sums the weights of paths with the same labels, which the subset
+// construction does not.
 template <class Arc>
-void ArcSumMap(MutableFst<Arc> *fst) {
+bool BoundedDeterminize(MutableFst<Arc> *fst, const OptimizeOptions &opts) {
+  using StateId = typename Arc::StateId;
+  static constexpr uint64 kParallelProps =
+      kAcceptor | kUnweighted | kNoEpsilons;
+  if (opts.determinize_threads > 1 &&
+      (Arc::Weight::Properties() & kIdempotent) == kIdempotent &&
+      fst->Properties(kParallelProps, true) == kParallelProps) {
+    return ParallelDeterminize(*fst, fst, opts.determinize_threads,
+                               opts.max_states, opts.max_arcs, opts.timeout);
+  }
+  if (!opts.Bounded()) {
+    Determinize(*fst, fst);
+    return true;
+  }
+  const auto start_time = std::chrono::steady_clock::now();
+  // Expanded states are not retained by the cache.
+  const DeterminizeFst<Arc> dfst(
+      *fst, DeterminizeFstOptions<Arc>(CacheOptions(true, 0)));
+  VectorFst<Arc> result;
+  const auto start = dfst.Start();
+  if (start != kNoStateId) {
+    int64 narcs = 0;
+    // States of the delayed FST are numbered densely as they are discovered.
+    while (start >= result.NumStates()) result.AddState();
+    for (StateId s = 0; s < result.NumStates(); ++s) {
+      result.SetFinal(s, dfst.Final(s));
+      for (ArcIterator<DeterminizeFst<Arc>> aiter(dfst, s); !aiter.Done();
+           aiter.Next()) {
+        const auto &arc = aiter.Value();
+        while (arc.nextstate >= result.NumStates()) result.AddState();
+        result.AddArc(s, arc);
+        ++narcs;
+      }
+      const std::chrono::duration<float> elapsed =
+          std::chrono::steady_clock::now() - start_time;
+      if ((opts.max_states >= 0 && result.NumStates() > opts.max_states) ||
+          (opts.max_arcs >= 0 && narcs > opts.max_arcs) ||
+          (opts.timeout > 0.0 && elapsed.count() > opts.timeout)) {
+        LOG(WARNING) << "Optimize: Determinization abandoned after "
+                     << elapsed.count() << " seconds, with "
+                     << result.NumStates() << " states and " << narcs
+                     << " arcs (limits: " << opts.max_states << " states, "
+                     << opts.max_arcs << " arcs, " << opts.timeout
+                     << " seconds)";
+        return false;
+      }
+    }
+    result.SetStart(start);
+  }
+  result.SetProperties(dfst.Properties(kCopyProperties, false),
+                       kCopyProperties);
+  result.SetInputSymbols(dfst.InputSymbols());
+  result.SetOutputSymbols(dfst.OutputSymbols());
+  *fst = result;
+  return true;
+}
+
+// Returns false if determinization is abandoned; see BoundedDeterminize.
+template <class Arc>
+bool DeterminizeAndMinimize(MutableFst<Arc> *fst, bool compute_props = false,
+                            const OptimizeOptions &opts = OptimizeOptions(),
+                            OptimizeStats *stats = nullptr) {
+  {
+    OptimizePhaseRecorder<Arc> phase("determinize", *fst, stats);
+    if (!BoundedDeterminize(fst, opts)) {
+      if (stats) stats->abandoned = true;
+      return false;
+    }
+  }
+  MinimizeDeterministic(fst, compute_props, opts, stats);
+  return true;
+}
+
+template <class Arc>
+void ArcSumMap(MutableFst<Arc> *fst, OptimizeStats *stats = nullptr) {
+  OptimizePhaseRecorder<Arc> phase("arcsum", *fst, stats);
   StateMap(fst, ArcSumMapper<Arc>(*fst));
 }
 
@@ -59,12 +378,26 @@ void ArcSumMap(MutableFst<Arc> *fst) {
 //   kEncodeLabels: optimize as a weighted acceptor
 //   kEncodeWeights: optimize as an unweighted transducer
 //   kEncodeLabels | kEncodeWeights: optimize as an unweighted acceptor
+//
+// Returns false if determinization is abandoned, in which case the FST is
+// decoded but otherwise left unchanged.
 template <class Arc>
-void OptimizeAs(MutableFst<Arc> *fst, uint32 flags) {
+bool OptimizeAs(MutableFst<Arc> *fst, uint32 flags,
+                bool compute_props = false,
+                const OptimizeOptions &opts = OptimizeOptions(),
+                OptimizeStats *stats = nullptr) {
+  if (stats) stats->encode_flags = flags;
   EncodeMapper<Arc> encoder(flags, ENCODE);
-  Encode(fst, &encoder);
-  DeterminizeAndMinimize(fst);
-  Decode(fst, encoder);
+  {
+    OptimizePhaseRecorder<Arc> phase("encode", *fst, stats);
+    Encode(fst, &encoder);
+  }
+  const bool success = DeterminizeAndMinimize(fst, compute_props, opts, stats);
+  {
+    OptimizePhaseRecorder<Arc> phase("decode", *fst, stats);
+    Decode(fst, encoder);
+  }
+  return success;
 }
 
 // Generic FST optimization function to be used when the FST is known to be an
@@ -73,46 +406,54 @@ void OptimizeAs(MutableFst<Arc> *fst, uint32 flags) {
 template <class Arc,
           typename std::enable_if<(Arc::Weight::Properties() & kIdempotent) !=
                                   kIdempotent>::type * = nullptr>
-void OptimizeAcceptor(MutableFst<Arc> *fst, bool compute_props = false) {
+bool OptimizeAcceptor(MutableFst<Arc> *fst, bool compute_props = false,
+                      const OptimizeOptions &opts = OptimizeOptions(),
+                      OptimizeStats *stats = nullptr) {
   // If the FST is not (known to be) epsilon-free, perform epsilon-removal.
-  MaybeRmEpsilon(fst, compute_props);
+  MaybeRmEpsilon(fst, compute_props, stats);
   // Combines identically labeled arcs with the same source and destination,
   // and sums their weights.
-  ArcSumMap(fst);
+  ArcSumMap(fst, stats);
   // The FST has non-idempotent weights; limiting optimization possibilities.
   if (fst->Properties(kIDeterministic, compute_props) != kIDeterministic) {
     // But "any acyclic weighted automaton over a zero-sum-free semiring has
     // the twins property and is determinizable" (Mohri 2006).
     if (fst->Properties(kAcyclic, compute_props) == kAcyclic) {
-      DeterminizeAndMinimize(fst);
+      return DeterminizeAndMinimize(fst, compute_props, opts, stats);
     }
   } else {
-    Minimize(fst);
+    MinimizeDeterministic(fst, compute_props, opts, stats);
   }
+  return true;
 }
 
 template <class Arc,
           typename std::enable_if<(Arc::Weight::Properties() & kIdempotent) ==
                                   kIdempotent>::type * = nullptr>
-void OptimizeAcceptor(MutableFst<Arc> *fst, bool compute_props = false) {
+bool OptimizeAcceptor(MutableFst<Arc> *fst, bool compute_props = false,
+                      const OptimizeOptions &opts = OptimizeOptions(),
+                      OptimizeStats *stats = nullptr) {
   // If the FST is not (known to be) epsilon-free, perform epsilon-removal.
-  MaybeRmEpsilon(fst, compute_props);
+  MaybeRmEpsilon(fst, compute_props, stats);
   // Combines identically labeled arcs with the same source and destination,
   // and sums their weights.
-  ArcSumMap(fst);
+  ArcSumMap(fst, stats);
   // If the FST is not (known to be) deterministic, determinize it.
   if (fst->Properties(kIDeterministic, compute_props) != kIDeterministic) {
     // If the FST is not known to have no weighted cycles, it is encoded
     // before determinization and minimization.
     if (!fst->Properties(kDoNotEncodeWeights, compute_props)) {
-      OptimizeAs(fst, kEncodeWeights);
-      ArcSumMap(fst);
+      const bool success =
+          OptimizeAs(fst, kEncodeWeights, compute_props, opts, stats);
+      ArcSumMap(fst, stats);
+      return success;
     } else {
-      DeterminizeAndMinimize(fst);
+      return DeterminizeAndMinimize(fst, compute_props, opts, stats);
     }
   } else {
-    Minimize(fst);
+    MinimizeDeterministic(fst, compute_props, opts, stats);
   }
+  return true;
 }
 
 // Generic FST optimization function to be used when the FST is (may be) a
@@ -121,48 +462,56 @@ void OptimizeAcceptor(MutableFst<Arc> *fst, bool compute_props = false) {
 template <class Arc,
           typename std::enable_if<(Arc::Weight::Properties() & kIdempotent) !=
                                   kIdempotent>::type * = nullptr>
-void OptimizeTransducer(MutableFst<Arc> *fst, bool compute_props = false) {
+bool OptimizeTransducer(MutableFst<Arc> *fst, bool compute_props = false,
+                        const OptimizeOptions &opts = OptimizeOptions(),
+                        OptimizeStats *stats = nullptr) {
   // If the FST is not (known to be) epsilon-free, perform epsilon-removal.
-  MaybeRmEpsilon(fst, compute_props);
+  MaybeRmEpsilon(fst, compute_props, stats);
   // Combines identically labeled arcs with the same source and destination,
   // and sums their weights.
-  ArcSumMap(fst);
+  ArcSumMap(fst, stats);
   // The FST has non-idempotent weights; limiting optimization possibilities.
   if (fst->Properties(kIDeterministic, compute_props) != kIDeterministic) {
     // But "any acyclic weighted automaton over a zero-sum-free semiring has
     // the twins property and is determinizable" (Mohri 2006). We just have to
     // encode labels.
     if (fst->Properties(kAcyclic, compute_props)) {
-      OptimizeAs(fst, kEncodeLabels);
+      return OptimizeAs(fst, kEncodeLabels, compute_props, opts, stats);
     }
   } else {
-    Minimize(fst);
+    MinimizeDeterministic(fst, compute_props, opts, stats);
   }
+  return true;
 }
 
 template <class Arc,
           typename std::enable_if<(Arc::Weight::Properties() & kIdempotent) ==
                                   kIdempotent>::type * = nullptr>
-void OptimizeTransducer(MutableFst<Arc> *fst, bool compute_props = false) {
+bool OptimizeTransducer(MutableFst<Arc> *fst, bool compute_props = false,
+                        const OptimizeOptions &opts = OptimizeOptions(),
+                        OptimizeStats *stats = nullptr) {
   // If the FST is not (known to be) epsilon-free, perform epsilon-removal.
-  MaybeRmEpsilon(fst, compute_props);
+  MaybeRmEpsilon(fst, compute_props, stats);
   // Combines identically labeled arcs with the same source and destination,
   // and sums their weights.
-  ArcSumMap(fst);
+  ArcSumMap(fst, stats);
   // If the FST is not (known to be) deterministic, determinize it.
   if (fst->Properties(kIDeterministic, compute_props) != kIDeterministic) {
     // FST labels are always encoded before determinization and minimization.
     // If the FST is not known to have no weighted cycles, its weights are
     // also encoded before determinization and minimization.
     if (!fst->Properties(kDoNotEncodeWeights, compute_props)) {
-      OptimizeAs(fst, kEncodeLabels | kEncodeWeights);
-      ArcSumMap(fst);
+      const bool success = OptimizeAs(fst, kEncodeLabels | kEncodeWeights,
+                                      compute_props, opts, stats);
+      ArcSumMap(fst, stats);
+      return success;
     } else {
-      OptimizeAs(fst, kEncodeLabels);
+      return OptimizeAs(fst, kEncodeLabels, compute_props, opts, stats);
     }
   } else {
-    Minimize(fst);
+    MinimizeDeterministic(fst, compute_props, opts, stats);
   }
+  return true;
 }
 
 }  // namespace internal
@@ -170,15 +519,27 @@ void OptimizeTransducer(MutableFst<Arc> *fst, bool compute_props = false) {
 // Generic FST optimization function; use the more-specialized forms below if
 // the FST is known to be an acceptor or a transducer.
 
-// Destructive signature.
+// Destructive signature. Returns false if determinization is abandoned because
+// it exceeds the limits given by the options; see OptimizeOptions. If stats is
+// non-null, it is cleared and then filled in; see OptimizeStats.
 template <class Arc>
-void Optimize(MutableFst<Arc> *fst, bool compute_props = false) {
-  if (fst->Properties(kAcceptor, compute_props) != kAcceptor) {
+bool Optimize(MutableFst<Arc> *fst, bool compute_props = false,
+              const OptimizeOptions &opts = OptimizeOptions(),
+              OptimizeStats *stats = nullptr) {
+  const bool acceptor =
+      fst->Properties(kAcceptor, compute_props) == kAcceptor;
+  if (stats) {
+    stats->Clear();
+    stats->acceptor = acceptor;
+    stats->idempotent =
+        (Arc::Weight::Properties() & kIdempotent) == kIdempotent;
+  }
+  if (!acceptor) {
     // The FST is (may be) a transducer.
-    internal::OptimizeTransducer(fst, compute_props);
+    return internal::OptimizeTransducer(fst, compute_props, opts, stats);
   } else {
     // The FST is (known to be) an acceptor.
-    internal::OptimizeAcceptor(fst, compute_props);
+    return internal::OptimizeAcceptor(fst, compute_props, opts, stats);
   }
 }
 
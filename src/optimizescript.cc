@@ -22,9 +22,13 @@
 namespace fst {
 namespace script {
 
-void Optimize(MutableFstClass *fst, bool compute_props) {
-  OptimizeArgs args(fst, compute_props);
-  Apply<Operation<OptimizeArgs>>("Optimize", fst->ArcType(), &args);
+bool Optimize(MutableFstClass *fst, bool compute_props,
+              const OptimizeOptions &opts, OptimizeStats *stats) {
+  OptimizeWithOptionsInnerArgs iargs(fst, compute_props, opts, stats);
+  OptimizeWithOptionsArgs args(iargs);
+  Apply<Operation<OptimizeWithOptionsArgs>>("Optimize", fst->ArcType(),
+                                            &args);
+  return args.retval;
 }
 
 void OptimizeStringCrossProducts(MutableFstClass *fst, bool compute_props) {
@@ -39,9 +43,9 @@ void OptimizeDifferenceRhs(MutableFstClass *fst, bool compute_props) {
                                  &args);
 }
 
-REGISTER_FST_OPERATION(Optimize, StdArc, OptimizeArgs);
-REGISTER_FST_OPERATION(Optimize, LogArc, OptimizeArgs);
-REGISTER_FST_OPERATION(Optimize, Log64Arc, OptimizeArgs);
+REGISTER_FST_OPERATION(Optimize, StdArc, OptimizeWithOptionsArgs);
+REGISTER_FST_OPERATION(Optimize, LogArc, OptimizeWithOptionsArgs);
+REGISTER_FST_OPERATION(Optimize, Log64Arc, OptimizeWithOptionsArgs);
 
 REGISTER_FST_OPERATION(OptimizeStringCrossProducts, StdArc, OptimizeArgs);
 REGISTER_FST_OPERATION(OptimizeStringCrossProducts, LogArc, OptimizeArgs);
@@ -27,13 +27,25 @@ namespace script {
 
 using OptimizeArgs = std::tuple<MutableFstClass *, bool>;
 
+using OptimizeWithOptionsInnerArgs =
+    std::tuple<MutableFstClass *, bool, const OptimizeOptions &,
+               OptimizeStats *>;
+
+using OptimizeWithOptionsArgs =
+    WithReturnValue<bool, OptimizeWithOptionsInnerArgs>;
+
 template <class Arc>
-void Optimize(OptimizeArgs *args) {
-  MutableFst<Arc> *fst = std::get<0>(*args)->GetMutableFst<Arc>();
-  Optimize(fst, std::get<1>(*args));
+void Optimize(OptimizeWithOptionsArgs *args) {
+  MutableFst<Arc> *fst = std::get<0>(args->args)->GetMutableFst<Arc>();
+  args->retval = Optimize(fst, std::get<1>(args->args),
+                          std::get<2>(args->args), std::get<3>(args->args));
 }
 
-void Optimize(MutableFstClass *fst, bool compute_props = false);
+// Returns false if determinization is abandoned; see OptimizeOptions. If stats
+// is non-null, the phases of optimization are recorded in it.
+bool Optimize(MutableFstClass *fst, bool compute_props = false,
+              const OptimizeOptions &opts = OptimizeOptions(),
+              OptimizeStats *stats = nullptr);
 
 template <class Arc>
 void OptimizeStringCrossProducts(OptimizeArgs *args) {
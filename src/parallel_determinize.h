@@ -0,0 +1,258 @@
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Copyright 2017 and onwards Google, Inc.
+//
+// For general information on the Pynini grammar compilation library, see
+// pynini.opengrm.org.
+
+#ifndef PYNINI_PARALLEL_DETERMINIZE_H_
+#define PYNINI_PARALLEL_DETERMINIZE_H_
+
+// Determinizes epsilon-free unweighted acceptors with idempotent weights on
+// several threads.
+//
+// This is the subset construction, expanded breadth-first one level at a time.
+// Threads claim batches of subsets from the current level through a shared
+// cursor, so that a thread which finishes early takes on the rest of the
+// level. The subset table is split into shards, each guarded by its own mutex
+// and chosen by the hash of the subset, so threads rarely contend for a lock.
+// States are given provisional IDs in whatever order threads discover them;
+// once the construction is done, the result is renumbered breadth-first from
+// the start state, visiting arcs in label order. The output therefore does not
+// depend on the number of threads or on their scheduling.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <fst/types.h>
+#include <fst/fstlib.h>
+#include "parallel_minimize.h"
+
+namespace fst {
+namespace internal {
+
+template <class StateId>
+struct SubsetHash {
+  size_t operator()(const std::vector<StateId> &subset) const {
+    size_t h = subset.size();
+    for (const auto s : subset) h = h * 7853 + s;
+    return h;
+  }
+};
+
+}  // namespace internal
+
+// Determinizes an epsilon-free unweighted acceptor with idempotent weights
+// using the given number of threads; see above. (In a non-idempotent semiring,
+// the result would have to sum the weights of paths with the same labels.) If
+// the result would have more than max_states states or more than max_arcs
+// arcs, or takes more than timeout seconds, returns false, leaving the output
+// unchanged; negative limits, and a non-positive timeout, are ignored. The
+// input and output may be the same FST.
+template <class Arc>
+bool ParallelDeterminize(const ExpandedFst<Arc> &ifst, MutableFst<Arc> *ofst,
+                         int threads, int64 max_states = -1,
+                         int64 max_arcs = -1, float timeout = 0.0) {
+  using Label = typename Arc::Label;
+  using StateId = typename Arc::StateId;
+  using Weight = typename Arc::Weight;
+  using Subset = std::vector<StateId>;
+  using SubsetTable =
+      std::unordered_map<Subset, StateId, internal::SubsetHash<StateId>>;
+  static constexpr uint64 kProps = kAcceptor | kUnweighted | kNoEpsilons;
+  static constexpr size_t kShardsPerThread = 16;
+  static constexpr size_t kBatchSize = 64;
+  if ((Weight::Properties() & kIdempotent) != kIdempotent) {
+    FSTERROR() << "ParallelDeterminize: Weight must be idempotent: "
+               << Weight::Type();
+    ofst->SetProperties(kError, kError);
+    return true;
+  }
+  if (ifst.Properties(kProps, true) != kProps) {
+    FSTERROR() << "ParallelDeterminize: Input must be an epsilon-free "
+               << "unweighted acceptor";
+    ofst->SetProperties(kError, kError);
+    return true;
+  }
+  const auto start_time = std::chrono::steady_clock::now();
+  VectorFst<Arc> result;
+  result.SetInputSymbols(ifst.InputSymbols());
+  result.SetOutputSymbols(ifst.OutputSymbols());
+  const auto acyclic = ifst.Properties(kAcyclic, false);
+  const auto start = ifst.Start();
+  if (start == kNoStateId) {
+    *ofst = result;
+    return true;
+  }
+  threads = std::max(threads, 1);
+  // Copies the arcs into flat arrays, sorted by label and destination; arcs
+  // of state s are [offsets[s], offsets[s + 1]).
+  const StateId nstates = ifst.NumStates();
+  std::vector<size_t> offsets(nstates + 1, 0);
+  std::vector<std::pair<Label, StateId>> arcs;
+  std::vector<bool> finals(nstates);
+  for (StateId s = 0; s < nstates; ++s) {
+    for (ArcIterator<ExpandedFst<Arc>> aiter(ifst, s); !aiter.Done();
+         aiter.Next()) {
+      arcs.emplace_back(aiter.Value().ilabel, aiter.Value().nextstate);
+    }
+    offsets[s + 1] = arcs.size();
+    std::sort(arcs.begin() + offsets[s], arcs.end());
+    finals[s] = ifst.Final(s) != Weight::Zero();
+  }
+  // The subset table, in shards.
+  const auto nshards = threads * kShardsPerThread;
+  std::vector<SubsetTable> shards(nshards);
+  std::unique_ptr<std::mutex[]> locks(new std::mutex[nshards]);
+  // Each subset's finality and arcs, keyed by provisional ID, are appended by
+  // the thread which expands it to its own list.
+  struct Expansion {
+    StateId state;
+    bool final;
+    std::vector<std::pair<Label, StateId>> arcs;
+  };
+  std::vector<std::vector<Expansion>> expansions(threads);
+  std::atomic<StateId> next_state(1);
+  std::atomic<int64> narcs(0);
+  std::atomic<bool> exceeded(false);
+  const internal::SubsetHash<StateId> hash;
+  // Each level of the frontier is a list of subsets, with their IDs; subsets
+  // are stored as the keys of the table, which are never moved.
+  using Frontier = std::vector<std::pair<StateId, const Subset *>>;
+  Frontier frontier;
+  {
+    Subset subset(1, start);
+    const auto shard = hash(subset) % nshards;
+    const auto it = shards[shard].emplace(std::move(subset), 0).first;
+    frontier.emplace_back(0, &it->first);
+  }
+  std::vector<Frontier> next_frontiers(threads);
+  while (!frontier.empty() && !exceeded) {
+    std::atomic<size_t> cursor(0);
+    internal::RunOnThreads(threads, [&](int t) {
+      std::vector<std::pair<Label, StateId>> pairs;
+      Subset subset;
+      while (!exceeded) {
+        const size_t begin = cursor.fetch_add(kBatchSize);
+        if (begin >= frontier.size()) break;
+        const auto end = std::min(frontier.size(), begin + kBatchSize);
+        for (auto i = begin; i < end; ++i) {
+          Expansion expansion;
+          expansion.state = frontier[i].first;
+          expansion.final = false;
+          pairs.clear();
+          for (const auto s : *frontier[i].second) {
+            if (finals[s]) expansion.final = true;
+            pairs.insert(pairs.end(), arcs.begin() + offsets[s],
+                         arcs.begin() + offsets[s + 1]);
+          }
+          std::sort(pairs.begin(), pairs.end());
+          for (auto it = pairs.begin(); it != pairs.end();) {
+            const auto label = it->first;
+            subset.clear();
+            for (; it != pairs.end() && it->first == label; ++it) {
+              if (subset.empty() || subset.back() != it->second) {
+                subset.push_back(it->second);
+              }
+            }
+            const auto shard = hash(subset) % nshards;
+            StateId nextstate;
+            {
+              std::lock_guard<std::mutex> lock(locks[shard]);
+              const auto inserted =
+                  shards[shard].emplace(subset, kNoStateId);
+              if (inserted.second) {
+                inserted.first->second = next_state++;
+                next_frontiers[t].emplace_back(inserted.first->second,
+                                               &inserted.first->first);
+              }
+              nextstate = inserted.first->second;
+            }
+            expansion.arcs.emplace_back(label, nextstate);
+          }
+          const auto total_arcs = narcs += expansion.arcs.size();
+          expansions[t].push_back(std::move(expansion));
+          const std::chrono::duration<float> elapsed =
+              std::chrono::steady_clock::now() - start_time;
+          if ((max_states >= 0 && next_state > max_states) ||
+              (max_arcs >= 0 && total_arcs > max_arcs) ||
+              (timeout > 0.0 && elapsed.count() > timeout)) {
+            exceeded = true;
+            break;
+          }
+        }
+      }
+    });
+    frontier.clear();
+    for (auto &next_frontier : next_frontiers) {
+      frontier.insert(frontier.end(), next_frontier.begin(),
+                      next_frontier.end());
+      next_frontier.clear();
+    }
+  }
+  if (exceeded) {
+    const std::chrono::duration<float> elapsed =
+        std::chrono::steady_clock::now() - start_time;
+    LOG(WARNING) << "ParallelDeterminize: Determinization abandoned after "
+                 << elapsed.count() << " seconds, with " << next_state.load()
+                 << " states and " << narcs.load() << " arcs (limits: "
+                 << max_states
+                 << " states, " << max_arcs << " arcs, " << timeout
+                 << " seconds)";
+    return false;
+  }
+  shards.clear();
+  // Gathers the expansions by provisional ID, then renumbers the states
+  // breadth-first.
+  std::vector<Expansion> states(next_state.load());
+  for (auto &thread_expansions : expansions) {
+    for (auto &expansion : thread_expansions) {
+      states[expansion.state] = std::move(expansion);
+    }
+    thread_expansions.clear();
+  }
+  std::vector<StateId> ids(states.size(), kNoStateId);
+  std::vector<StateId> queue(1, 0);
+  ids[0] = result.AddState();
+  for (size_t i = 0; i < queue.size(); ++i) {
+    const auto &state = states[queue[i]];
+    const auto q = ids[queue[i]];
+    if (state.final) result.SetFinal(q, Weight::One());
+    result.ReserveArcs(q, state.arcs.size());
+    for (const auto &arc : state.arcs) {
+      if (ids[arc.second] == kNoStateId) {
+        ids[arc.second] = result.AddState();
+        queue.push_back(arc.second);
+      }
+      result.AddArc(q, Arc(arc.first, arc.first, Weight::One(),
+                           ids[arc.second]));
+    }
+  }
+  result.SetStart(0);
+  result.SetProperties(kIDeterministic | kODeterministic | kAcceptor |
+                           kUnweighted | kNoEpsilons | kAccessible | acyclic,
+                       kIDeterministic | kODeterministic | kAcceptor |
+                           kUnweighted | kNoEpsilons | kAccessible | acyclic);
+  *ofst = result;
+  return true;
+}
+
+}  // namespace fst
+
+#endif  // PYNINI_PARALLEL_DETERMINIZE_H_
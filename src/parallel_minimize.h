@@ -0,0 +1,186 @@
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Copyright 2017 and onwards Google, Inc.
+//
+// For general information on the Pynini grammar compilation library, see
+// pynini.opengrm.org.
+
+#ifndef PYNINI_PARALLEL_MINIMIZE_H_
+#define PYNINI_PARALLEL_MINIMIZE_H_
+
+// Minimizes deterministic unweighted acceptors on several threads.
+//
+// Hopcroft's algorithm, as used by Minimize, refines the partition of states
+// one splitter at a time, and does not parallelize well. This instead uses
+// Moore's algorithm: each round, every state receives a signature made up of
+// its current block and the blocks reached by each of its arcs, and states are
+// partitioned anew by signature, until a round creates no new blocks. Each
+// round is data-parallel: signatures are hashed on all threads, and each
+// thread then numbers the distinct signatures whose hashes fall in its own
+// shard, so no table is shared between threads. Moore's algorithm may take
+// more rounds than Hopcroft's takes splitters to converge on machines with
+// long chains of states, but each round is a linear scan of the arcs.
+//
+// Blocks are finally numbered by their least state, so the result does not
+// depend on the number of threads; as the minimal deterministic acceptor is
+// unique, it is isomorphic to the result of Minimize.
+
+#include <algorithm>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+#include <fst/types.h>
+#include <fst/fstlib.h>
+
+namespace fst {
+namespace internal {
+
+// Calls fn(t) for each t in [0, threads), on that many threads.
+template <class Function>
+void RunOnThreads(int threads, const Function &fn) {
+  std::vector<std::thread> workers;
+  for (int t = 1; t < threads; ++t) workers.emplace_back(fn, t);
+  fn(0);
+  for (auto &worker : workers) worker.join();
+}
+
+}  // namespace internal
+
+// Minimizes a deterministic unweighted acceptor using the given number of
+// threads; see above.
+template <class Arc>
+void ParallelMinimize(MutableFst<Arc> *fst, int threads) {
+  using Label = typename Arc::Label;
+  using StateId = typename Arc::StateId;
+  using Weight = typename Arc::Weight;
+  static constexpr uint64 kProps = kAcceptor | kUnweighted | kIDeterministic;
+  if (fst->Properties(kProps, true) != kProps) {
+    FSTERROR() << "ParallelMinimize: Input must be a deterministic unweighted "
+               << "acceptor";
+    fst->SetProperties(kError, kError);
+    return;
+  }
+  Connect(fst);
+  const StateId nstates = fst->NumStates();
+  if (nstates == 0) return;
+  threads = std::max(1, std::min<int>(threads, nstates));
+  ArcSort(fst, ILabelCompare<Arc>());
+  // Copies the arcs into flat arrays, so that threads read them without
+  // virtual calls; arcs of state s are [offsets[s], offsets[s + 1]).
+  std::vector<size_t> offsets(nstates + 1, 0);
+  std::vector<Label> labels;
+  std::vector<StateId> nextstates;
+  std::vector<StateId> blocks(nstates);
+  for (StateId s = 0; s < nstates; ++s) {
+    for (ArcIterator<MutableFst<Arc>> aiter(*fst, s); !aiter.Done();
+         aiter.Next()) {
+      labels.push_back(aiter.Value().ilabel);
+      nextstates.push_back(aiter.Value().nextstate);
+    }
+    offsets[s + 1] = labels.size();
+    // The initial partition separates final from non-final states.
+    blocks[s] = fst->Final(s) != Weight::Zero();
+  }
+  // The number of blocks before the last round; none, before the first.
+  size_t nblocks = 0;
+  const auto chunk = (nstates + threads - 1) / threads;
+  std::vector<size_t> hashes(nstates);
+  std::vector<StateId> locals(nstates);
+  std::vector<StateId> next_blocks(nstates);
+  std::vector<size_t> counts(threads + 1);
+  const auto hash = [&](StateId s) { return hashes[s]; };
+  const auto equal = [&](StateId s, StateId t) {
+    if (blocks[s] != blocks[t] ||
+        offsets[s + 1] - offsets[s] != offsets[t + 1] - offsets[t]) {
+      return false;
+    }
+    for (auto i = offsets[s], j = offsets[t]; i < offsets[s + 1]; ++i, ++j) {
+      if (labels[i] != labels[j] ||
+          blocks[nextstates[i]] != blocks[nextstates[j]]) {
+        return false;
+      }
+    }
+    return true;
+  };
+  while (true) {
+    // Hashes the signature of each state.
+    internal::RunOnThreads(threads, [&](int t) {
+      const StateId end = std::min<StateId>(nstates, (t + 1) * chunk);
+      for (StateId s = t * chunk; s < end; ++s) {
+        size_t h = blocks[s];
+        for (auto i = offsets[s]; i < offsets[s + 1]; ++i) {
+          h = h * 7853 + labels[i];
+          h = h * 7867 + blocks[nextstates[i]];
+        }
+        hashes[s] = h;
+      }
+    });
+    // Numbers the distinct signatures in each shard, in state order.
+    internal::RunOnThreads(threads, [&](int t) {
+      std::unordered_set<StateId, decltype(hash), decltype(equal)> shard(
+          0, hash, equal);
+      std::vector<StateId> ids;
+      for (StateId s = 0; s < nstates; ++s) {
+        if (hashes[s] % threads != static_cast<size_t>(t)) continue;
+        const auto it = shard.insert(s);
+        if (it.second) {
+          locals[s] = ids.size();
+          ids.push_back(s);
+        } else {
+          locals[s] = locals[*it.first];
+        }
+      }
+      counts[t + 1] = ids.size();
+    });
+    for (int t = 0; t < threads; ++t) counts[t + 1] += counts[t];
+    internal::RunOnThreads(threads, [&](int t) {
+      const StateId end = std::min<StateId>(nstates, (t + 1) * chunk);
+      for (StateId s = t * chunk; s < end; ++s) {
+        next_blocks[s] = counts[hashes[s] % threads] + locals[s];
+      }
+    });
+    blocks.swap(next_blocks);
+    // Each round refines the last, so the partition is stable once the number
+    // of blocks stops growing.
+    if (counts[threads] == nblocks) break;
+    nblocks = counts[threads];
+  }
+  // Numbers the blocks by their least state, which represents the block, and
+  // builds the result.
+  std::vector<StateId> ids(nblocks, kNoStateId);
+  std::vector<StateId> representatives;
+  for (StateId s = 0; s < nstates; ++s) {
+    if (ids[blocks[s]] != kNoStateId) continue;
+    ids[blocks[s]] = representatives.size();
+    representatives.push_back(s);
+  }
+  VectorFst<Arc> result;
+  for (const auto s : representatives) {
+    const auto q = result.AddState();
+    result.SetFinal(q, fst->Final(s));
+    result.ReserveArcs(q, offsets[s + 1] - offsets[s]);
+    for (auto i = offsets[s]; i < offsets[s + 1]; ++i) {
+      result.AddArc(q, Arc(labels[i], labels[i], Weight::One(),
+                           ids[blocks[nextstates[i]]]));
+    }
+  }
+  result.SetStart(ids[blocks[fst->Start()]]);
+  result.SetInputSymbols(fst->InputSymbols());
+  result.SetOutputSymbols(fst->OutputSymbols());
+  *fst = result;
+}
+
+}  // namespace fst
+
+#endif  // PYNINI_PARALLEL_MINIMIZE_H_
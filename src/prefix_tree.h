@@ -18,18 +18,24 @@
 #ifndef PYNINI_PREFIX_TREE_H_
 #define PYNINI_PREFIX_TREE_H_
 
-#include <map>
-#include <stack>
+#include <algorithm>
+#include <utility>
+#include <vector>
 
 #include <fst/compat.h>
 #include <fst/log.h>
 #include <fst/arc.h>
 #include <fst/vector-fst.h>
-#include "gtl.h"
 
 namespace fst {
 
 // This class is neither thread-safe nor thread-hostile.
+//
+// Nodes are stored in two contiguous pools, one for the input trie and one for
+// the output tries, and refer to each other by pool index rather than by
+// pointer. The children of each node are kept in a label-sorted vector, which
+// is considerably more compact than a node-based map for the small fan-outs
+// typical of string maps, and lets the entire tree be released at once.
 template <class Arc>
 class PrefixTree {
  public:
@@ -37,38 +43,37 @@ class PrefixTree {
   using StateId = typename Arc::StateId;
   using Weight = typename Arc::Weight;
 
-  struct INode;
-  struct ONode;
+  // Index of a node within one of the node pools.
+  using NodeId = int32;
+
+  static constexpr NodeId kNoNodeId = -1;
 
-  using ichild_map = std::map<Label, INode *>;
-  using ochild_map = std::map<Label, ONode *>;
+  using child_vector = std::vector<std::pair<Label, NodeId>>;
 
   // Prefix tree node for the input labels of the FST.
   struct INode {
-    ichild_map children;
-    ONode *output;
+    child_vector children;
+    NodeId output;
     StateId state;
 
-    INode() : output(nullptr), state(kNoStateId) {}
+    explicit INode(StateId state) : output(kNoNodeId), state(state) {}
   };
 
   // Prefix tree node for the output labels of the FST.
   struct ONode {
-    ochild_map children;
+    child_vector children;
     Weight weight;
     StateId state;
 
-    ONode() : weight(Weight::Zero()), state(kNoStateId) {}
+    explicit ONode(StateId state) : weight(Weight::Zero()), state(state) {}
   };
 
-  PrefixTree() : num_states_(0), root_(nullptr) {}
+  PrefixTree() : num_states_(0) {}
 
   PrefixTree(const PrefixTree &) = delete;
 
   PrefixTree &operator=(const PrefixTree &) = delete;
 
-  ~PrefixTree() { Clear(); }
-
   StateId NumStates() const { return num_states_; }
 
   // Add an entry to the prefix tree, consisting of two label sequences and a
@@ -77,118 +82,165 @@ class PrefixTree {
   void Add(Iterator1 iter1, Iterator1 end1,
            Iterator2 iter2, Iterator2 end2,
            const Weight &weight = Weight::One()) {
-    if (!root_) {
+    if (inodes_.empty()) {
       CHECK_EQ(0, num_states_);
-      root_ = new INode();
-      root_->state = num_states_++;
+      inodes_.emplace_back(num_states_++);
     }
-    INode *n = root_;
+    NodeId n = 0;
     for (/* empty */; iter1 != end1; ++iter1) {
       if (!*iter1) continue;  // Skips over epsilons.
-      n = LookupOrInsertNew(&n->children, *iter1);
-      if (kNoStateId == n->state) n->state = num_states_++;
+      n = FindOrInsertChild(n, *iter1, &inodes_);
     }
-    if (!n->output) {
-      n->output = new ONode();
-      n->output->state = num_states_++;
+    if (inodes_[n].output == kNoNodeId) {
+      inodes_[n].output = onodes_.size();
+      onodes_.emplace_back(num_states_++);
     }
-    ONode *o = n->output;
+    NodeId o = inodes_[n].output;
     for (/* empty */; iter2 != end2; ++iter2) {
       if (!*iter2) continue;  // Skips over epsilons.
-      o = LookupOrInsertNew(&o->children, *iter2);
-      if (kNoStateId == o->state)
-        o->state = num_states_++;
+      o = FindOrInsertChild(o, *iter2, &onodes_);
     }
-    o->weight = Plus(o->weight, weight);
+    onodes_[o].weight = Plus(onodes_[o].weight, weight);
   }
 
-  // Removes all elements from this prefix tree.
-  void Clear() {
-    if (!root_) {
+  // Adds all entries of another prefix tree, with the same result (including
+  // state numbering) as if they had been added to this tree, in the order they
+  // were added to the other tree, after all of this tree's own entries.
+  void Merge(const PrefixTree &other) {
+    if (other.inodes_.empty()) return;
+    if (inodes_.empty()) {
       CHECK_EQ(0, num_states_);
-      return;
+      inodes_.emplace_back(num_states_++);
+    }
+    // Parent and label of each node of the other tree; the roots of output
+    // tries, whose parents are input nodes, are given the epsilon label.
+    const NodeId num_inodes = other.inodes_.size();
+    const NodeId num_onodes = other.onodes_.size();
+    std::vector<std::pair<NodeId, Label>> iparent(num_inodes);
+    std::vector<std::pair<NodeId, Label>> oparent(num_onodes);
+    // Nodes of the other tree in creation order, as (is_input, index) pairs.
+    std::vector<std::pair<bool, NodeId>> order(other.num_states_);
+    for (NodeId n = 0; n < num_inodes; ++n) {
+      const auto &node = other.inodes_[n];
+      order[node.state] = std::make_pair(true, n);
+      for (const auto &child : node.children) {
+        iparent[child.second] = std::make_pair(n, child.first);
+      }
+      if (node.output != kNoNodeId) {
+        oparent[node.output] = std::make_pair(n, 0);
+      }
     }
-    std::stack<INode *> iq;
-    std::stack<ONode *> oq;
-    // First, performs a simple depth-first traversal over the input trie,
-    // starting at the root node. Node coloring is not needed, since we're
-    // dealing with a tree.
-    iq.push(root_);
-    while (!iq.empty()) {
-      INode *n = iq.top();
-      iq.pop();
-      if (n->output)
-        oq.push(n->output);  // Found a root node of an output trie.
-      for (auto iter = n->children.begin(); iter != n->children.end(); ++iter) {
-        iq.push(iter->second);
+    for (NodeId o = 0; o < num_onodes; ++o) {
+      const auto &node = other.onodes_[o];
+      order[node.state] = std::make_pair(false, o);
+      for (const auto &child : node.children) {
+        oparent[child.second] = std::make_pair(o, child.first);
       }
-      delete n;
     }
-    // Second, perform simple depth-first traversals over the output tries,
-    // starting at their root nodes.
-    while (!oq.empty()) {
-      ONode *o = oq.top();
-      oq.pop();
-      for (auto oter = o->children.begin(); oter != o->children.end(); ++oter) {
-        oq.push(oter->second);
+    // Maps nodes of the other tree onto nodes of this one. As parents are
+    // always created before their children, visiting the other tree's nodes
+    // in creation order creates any missing nodes in the same order that
+    // re-adding its entries would.
+    std::vector<NodeId> imap(num_inodes, kNoNodeId);
+    std::vector<NodeId> omap(num_onodes, kNoNodeId);
+    imap[0] = 0;
+    for (const auto &node : order) {
+      const auto n = node.second;
+      if (node.first) {
+        if (n == 0) continue;  // The roots always correspond.
+        imap[n] = FindOrInsertChild(imap[iparent[n].first], iparent[n].second,
+                                    &inodes_);
+      } else if (oparent[n].second == 0) {
+        auto &parent = inodes_[imap[oparent[n].first]];
+        if (parent.output == kNoNodeId) {
+          parent.output = onodes_.size();
+          onodes_.emplace_back(num_states_++);
+        }
+        omap[n] = parent.output;
+      } else {
+        omap[n] = FindOrInsertChild(omap[oparent[n].first], oparent[n].second,
+                                    &onodes_);
       }
-      delete o;
     }
+    for (NodeId o = 0; o < num_onodes; ++o) {
+      onodes_[omap[o]].weight =
+          Plus(onodes_[omap[o]].weight, other.onodes_[o].weight);
+    }
+  }
+
+  // Removes all elements from this prefix tree.
+  void Clear() {
+    inodes_.clear();
+    onodes_.clear();
     num_states_ = 0;
-    root_ = nullptr;
   }
 
   // Write the current prefix tree transducer to a mutable FST.
   void ToFst(MutableFst<Arc> *fst) const {
     fst->DeleteStates();
     if (num_states_ == 0) {
-      CHECK(!root_);
+      CHECK(inodes_.empty());
       return;
     }
     // For the creation of the FST to be efficient, we reserve enough space
     // for the states and arcs to avoid reallocation and internal copying.
     fst->ReserveStates(num_states_);
     for (StateId i = 0; i < num_states_; ++i) fst->AddState();
-    fst->SetStart(root_->state);
-    std::stack<INode *> iq;
-    std::stack<ONode *> oq;
-    iq.push(root_);
-    while (!iq.empty()) {
-      INode *n = iq.top();
-      iq.pop();
-      const auto q = n->state;
-      CHECK_NE(kNoStateId, q);
-      ONode *o = n->output;
-      fst->ReserveArcs(q, (o ? 1 : 0) + n->children.size());
-      if (o) {
-        fst->AddArc(q, Arc(0, 0, Arc::Weight::One(), o->state));
-        oq.push(o);
+    fst->SetStart(inodes_[0].state);
+    // As nodes refer to each other by index, the pools are simply visited in
+    // order; this produces the same arcs per state as a traversal of the tree.
+    for (const auto &n : inodes_) {
+      const auto q = n.state;
+      fst->ReserveArcs(q, (n.output != kNoNodeId ? 1 : 0) + n.children.size());
+      if (n.output != kNoNodeId) {
+        fst->AddArc(q, Arc(0, 0, Arc::Weight::One(),
+                           onodes_[n.output].state));
       }
-      for (auto iter = n->children.begin(); iter != n->children.end(); ++iter) {
-        fst->AddArc(q, Arc(iter->first, 0, Arc::Weight::One(),
-                           iter->second->state));
-        iq.push(iter->second);
+      for (const auto &child : n.children) {
+        fst->AddArc(q, Arc(child.first, 0, Arc::Weight::One(),
+                           inodes_[child.second].state));
       }
     }
-    while (!oq.empty()) {
-      ONode *o = oq.top();
-      oq.pop();
-      StateId q = o->state;
-      CHECK_NE(kNoStateId, q);
-      for (auto oter = o->children.begin(); oter != o->children.end(); ++oter) {
-        fst->AddArc(q, Arc(0, oter->first, Arc::Weight::One(),
-                           oter->second->state));
-        oq.push(oter->second);
+    for (const auto &o : onodes_) {
+      const auto q = o.state;
+      fst->ReserveArcs(q, o.children.size());
+      for (const auto &child : o.children) {
+        fst->AddArc(q, Arc(0, child.first, Arc::Weight::One(),
+                           onodes_[child.second].state));
       }
-      fst->SetFinal(q, o->weight);
+      fst->SetFinal(q, o.weight);
     }
   }
 
  private:
+  // Returns the index of the child of node `parent` with label `label`,
+  // creating it (and assigning it the next state ID) if necessary.
+  template <class Node>
+  NodeId FindOrInsertChild(NodeId parent, Label label,
+                           std::vector<Node> *pool) {
+    auto &children = (*pool)[parent].children;
+    const auto it = std::lower_bound(
+        children.begin(), children.end(), label,
+        [](const std::pair<Label, NodeId> &child, Label label) {
+          return child.first < label;
+        });
+    if (it != children.end() && it->first == label) return it->second;
+    const NodeId child = pool->size();
+    // The insertion must precede the emplacement, which may invalidate
+    // `children`.
+    children.emplace(it, label, child);
+    pool->emplace_back(num_states_++);
+    return child;
+  }
+
   StateId num_states_;
-  INode *root_;
+  std::vector<INode> inodes_;
+  std::vector<ONode> onodes_;
 };
 
+template <class Arc>
+constexpr typename PrefixTree<Arc>::NodeId PrefixTree<Arc>::kNoNodeId;
+
 }  // namespace fst
 
 #endif  // PYNINI_PREFIX_TREE_H_
@@ -57,6 +57,7 @@ from fst cimport Closure
 from fst cimport Compose
 from fst cimport ComposeOptions
 from fst cimport Equal
+from fst cimport FarWriterClass
 from fst cimport FstClass
 from fst cimport LabelFstClassPair
 from fst cimport MutableFstClass
@@ -67,6 +68,8 @@ from fst cimport WeightClass
 
 from fst cimport kAcceptor
 from fst cimport kDelta
+from fst cimport kEncodeLabels
+from fst cimport kEncodeWeights
 from fst cimport kIDeterministic
 from fst cimport kError
 from fst cimport kNoEpsilons
@@ -95,7 +98,10 @@ from pywrapfst cimport tostring
 
 # C++ code from fst_util.
 
+from fst_util cimport CompileCompactString
 from fst_util cimport CompileString
+from fst_util cimport CompileStrings
+from fst_util cimport CompileStringsToFar
 from fst_util cimport CrossProduct
 from fst_util cimport GetByteSymbolTable
 from fst_util cimport GetStringTokenType
@@ -103,8 +109,13 @@ from fst_util cimport LenientlyCompose
 from fst_util cimport MergeSymbols
 from fst_util cimport Optimize
 from fst_util cimport OptimizeDifferenceRhs
+from fst_util cimport OptimizeOptions
+from fst_util cimport OptimizePhaseStats
+from fst_util cimport OptimizeStats as _OptimizeStats
 from fst_util cimport PrintString
 from fst_util cimport Repeat
+from fst_util cimport RuleApplierClass
+from fst_util cimport SequentialTransducerClass
 from fst_util cimport StringFile
 from fst_util cimport StringMap
 from fst_util cimport StringPathsClass
@@ -115,9 +126,12 @@ from fst_util cimport MERGE_LEFT_OUTPUT_AND_RIGHT_INPUT_SYMBOLS
 
 from fst_util cimport StringTokenType
 from fst_util cimport SYMBOL
+from fst_util cimport kSequentialTransducerMaxTableSize
 
 # C++ code for Pynini not from fst_util.
 
+from pynini_includes cimport CDRewriteCompilerClass
+from pynini_includes cimport CDRewriteStageStats
 from pynini_includes cimport StringFstClassPair
 
 from pynini_includes cimport MPdtCompose
@@ -133,6 +147,8 @@ from pynini_includes cimport PdtReverse
 from pynini_includes cimport PdtShortestPath
 from pynini_includes cimport PdtShortestPathOptions
 from pynini_includes cimport PyniniCDRewrite
+from pynini_includes cimport PyniniCDRewriteDelayed
+from pynini_includes cimport PyniniCDRewriteMany
 from pynini_includes cimport PyniniPdtReplace
 from pynini_includes cimport PyniniReplace
 from pynini_includes cimport ReadLabelPairs
@@ -210,6 +226,7 @@ cpdef _MutableFst wildcard_compose(_Fst ifst1,
 # Python imports needed for implementation.
 
 
+import collections
 import functools
 
 from pywrapfst import FstArgError
@@ -427,6 +444,93 @@ cdef void _maybe_arcsort(MutableFstClass *ifst1, MutableFstClass *ifst2):
     ArcSort(ifst2, ILABEL_SORT)
 
 
+OptimizePhaseInfo = collections.namedtuple("OptimizePhaseInfo",
+                                           ["name", "seconds", "states_before",
+                                            "arcs_before", "props_before",
+                                            "states_after", "arcs_after",
+                                            "props_after"])
+
+
+cdef class OptimizeStats(object):
+
+  """
+  OptimizeStats()
+
+  Records what a call to optimize did.
+
+  When passed to optimize as the stats argument, this object is filled in with
+  the branch taken by the optimization algorithm and with one record per phase
+  of optimization (epsilon-removal, arc-sum mapping, encoding, determinization,
+  minimization, and decoding), in the order they were performed. Phases which
+  are not needed are skipped, and are not recorded.
+  """
+
+  cdef _OptimizeStats _stats
+
+  def __repr__(self):
+    return "<OptimizeStats at 0x{:x}>".format(id(self))
+
+  cpdef bool acceptor(self):
+    """
+    acceptor(self)
+
+    Returns whether the FST was optimized as an acceptor.
+    """
+    return self._stats.acceptor
+
+  cpdef bool idempotent(self):
+    """
+    idempotent(self)
+
+    Returns whether the FST's weights are idempotent.
+    """
+    return self._stats.idempotent
+
+  cpdef bool encoded_labels(self):
+    """
+    encoded_labels(self)
+
+    Returns whether labels were encoded before determinization.
+    """
+    return self._stats.encode_flags & kEncodeLabels == kEncodeLabels
+
+  cpdef bool encoded_weights(self):
+    """
+    encoded_weights(self)
+
+    Returns whether weights were encoded before determinization.
+    """
+    return self._stats.encode_flags & kEncodeWeights == kEncodeWeights
+
+  cpdef bool abandoned(self):
+    """
+    abandoned(self)
+
+    Returns whether determinization was abandoned for exceeding its budget.
+    """
+    return self._stats.abandoned
+
+  def phases(self):
+    """
+    phases(self)
+
+    Returns the phases of the last optimization.
+
+    Returns:
+      A list of OptimizePhaseInfo, one per phase, each with the name of the
+      phase, the time spent on it in seconds, and the number of states, number
+      of arcs, and known property bits of the FST before and after it.
+    """
+    cdef list result = []
+    cdef OptimizePhaseStats phase
+    for phase in self._stats.phases:
+      result.append(OptimizePhaseInfo(phase.name, phase.seconds,
+                                      phase.states_before, phase.arcs_before,
+                                      phase.props_before, phase.states_after,
+                                      phase.arcs_after, phase.props_after))
+    return result
+
+
 # Class for FSTs created from within Pynini. It overrides instance methods of
 # the superclass which take an FST argument so that it can string-compile said
 # argument if it is not yet an FST. It also overloads binary == (equals),
@@ -591,19 +695,7 @@ cdef class Fst(_MutableFst):
       FstArgError: FST is not a string.
       FstArgError: Unknown token type.
     """
-    cdef StringTokenType ttype
-    cdef SymbolTable_ptr syms = NULL
-    if isinstance(token_type, pywrapfst._SymbolTable):
-      ttype = SYMBOL
-      syms = (<SymbolTable_ptr> (<_SymbolTable> token_type)._table)
-    else:
-      ttype = _get_token_type(tostring(token_type))
-      if ttype == SYMBOL:
-        raise FstArgError("Invalid token type")
-    cdef string result
-    if not PrintString(deref(self._fst), ttype, addr(result), syms, rm_epsilon):
-      raise FstArgError("FST is not a string")
-    return result
+    return _stringify(self, token_type, rm_epsilon)
 
   # The following all override their definition in _MutableFst.
 
@@ -744,13 +836,23 @@ cdef class Fst(_MutableFst):
     self._concat(rhs)
     return self
 
-  cdef void _optimize(self, bool compute_props=False) except *:
-    Optimize(self._mfst.get(), compute_props)
+  cdef void _optimize(self, bool compute_props=False, int64 max_states=-1,
+                      int64 max_arcs=-1, float timeout=0,
+                      OptimizeStats stats=None, int minimize_threads=1,
+                      int determinize_threads=1) except *:
+    cdef unique_ptr[OptimizeOptions] opts
+    opts.reset(new OptimizeOptions(max_states, max_arcs, timeout,
+                                   minimize_threads, determinize_threads))
+    Optimize(self._mfst.get(), compute_props, deref(opts),
+             NULL if stats is None else addr(stats._stats))
     self._check_mutating_imethod()
 
-  def optimize(self, bool compute_props=False):
+  def optimize(self, bool compute_props=False, int64 max_states=-1,
+               int64 max_arcs=-1, float timeout=0, OptimizeStats stats=None,
+               int minimize_threads=1, int determinize_threads=1):
     """
-    optimize(self, compute_props=False)
+    optimize(self, compute_props=False, max_states=-1, max_arcs=-1, timeout=0,
+             stats=None, minimize_threads=1, determinize_threads=1)
 
     Performs a generic optimization of the FST.
 
@@ -780,14 +882,40 @@ cdef class Fst(_MutableFst):
     exponential blowup in size in the worst case. Judicious use of optimization
     is a bit of a black art.
 
+    To guard against such a blowup, determinization can be given a budget. If
+    the determinized FST would exceed max_states states or max_arcs arcs, or
+    determinization takes more than timeout seconds, it is abandoned, a
+    warning is logged, and the FST is left epsilon-free and arc-summed but
+    otherwise unoptimized.
+
+    Determinization and minimization of large FSTs can be sped up by using
+    several threads. If determinize_threads is greater than one, epsilon-free
+    unweighted acceptors (including those encoded for determinization) with
+    idempotent weights are determinized by a parallel subset construction on
+    that many threads. If minimize_threads is greater than one, deterministic
+    unweighted acceptors which are not acyclic are minimized by parallel
+    partition refinement on that many threads. The result is the same for any
+    number of threads.
+
     Args:
       compute_props: Should unknown FST properties be computed to help choose
           appropriate optimizations?
+      max_states: Maximum number of states in the determinized FST; if
+          negative, there is no limit.
+      max_arcs: Maximum number of arcs in the determinized FST; if negative,
+          there is no limit.
+      timeout: Maximum number of seconds to spend on determinization; if not
+          positive, there is no limit.
+      stats: An optional OptimizeStats, which is filled in with a record of
+          the optimization.
+      minimize_threads: The number of threads to use for minimization.
+      determinize_threads: The number of threads to use for determinization.
 
     Returns:
       self.
     """
-    self._optimize(compute_props)
+    self._optimize(compute_props, max_states, max_arcs, timeout, stats,
+                   minimize_threads, determinize_threads)
     return self
 
   def union(self, ifst):
@@ -858,15 +986,179 @@ cdef class Fst(_MutableFst):
     return lhs
 
 
+cdef string _stringify(_Fst ifst, token_type, bool rm_epsilon) except *:
+  cdef StringTokenType ttype
+  cdef SymbolTable_ptr syms = NULL
+  if isinstance(token_type, pywrapfst._SymbolTable):
+    ttype = SYMBOL
+    syms = (<SymbolTable_ptr> (<_SymbolTable> token_type)._table)
+  else:
+    ttype = _get_token_type(tostring(token_type))
+    if ttype == SYMBOL:
+      raise FstArgError("Invalid token type")
+  cdef string result
+  if not PrintString(deref(ifst._fst), ttype, addr(result), syms, rm_epsilon):
+    raise FstArgError("FST is not a string")
+  return result
+
+
+cdef class CompactStringFst(_Fst):
+
+  """
+  CompactStringFst()
+
+  This class wraps an immutable string FST stored in compact form.
+
+  Rather than a state with a vector of arcs per label, a compact string FST
+  stores just an array of labels (or, if weighted, of label/weight pairs),
+  making it several times smaller than the equivalent mutable FST. It may be
+  used anywhere an FST argument is expected, in which case a mutable copy is
+  made if necessary, but it cannot itself be mutated. Instances are created by
+  the `compact_acceptor` function.
+
+  Only the immutable FST interface, `paths`, `stringify`, `copy`, equality,
+  and the `+`, `-`, `*`, and `|` operators are provided; the latter return a
+  mutable Fst. For any other operation, pass the compact FST to the
+  corresponding function (e.g., `optimize`), which works on a mutable copy.
+  """
+
+  cpdef StringPaths paths(self, input_token_type=b"byte",
+                          output_token_type=b"byte", bool rm_epsilon=True):
+    """
+    paths(self, input_token_type="byte", output_token_type="byte",
+          rm_epsilon=True)
+
+    Creates iterator over the single string path in the FST.
+
+    See also: `Fst.paths`.
+    """
+    return StringPaths(self, input_token_type, output_token_type, rm_epsilon)
+
+  cpdef string stringify(self, token_type=b"byte",
+                         bool rm_epsilon=True) except *:
+    """
+    stringify(self, token_type="byte")
+
+    Creates a string from the FST.
+
+    See also: `Fst.stringify`.
+    """
+    return _stringify(self, token_type, rm_epsilon)
+
+  cpdef CompactStringFst copy(self):
+    """
+    copy(self)
+
+    Makes a copy of the FST.
+    """
+    cdef CompactStringFst result = CompactStringFst.__new__(CompactStringFst)
+    result._fst.reset(new FstClass(deref(self._fst)))
+    return result
+
+  def __eq__(self, other):
+    cdef Fst lhs
+    cdef Fst rhs
+    (lhs, rhs) = _compile_or_copy_two_Fsts(self, other)
+    return Equal(deref(lhs._fst), deref(rhs._fst), kDelta)
+
+  def __ne__(self, other):
+    return not self == other
+
+  # x + y
+
+  def __add__(self, other):
+    cdef string arc_type = (self.arc_type() if hasattr(self, "arc_type") else
+                            other.arc_type())
+    cdef Fst lhs = _compile_or_copy_Fst(self, arc_type=arc_type)
+    lhs.concat(other)
+    return lhs
+
+  # x - y
+
+  def __sub__(self, other):
+    return difference(self, other)
+
+  # x * y
+
+  def __mul__(self, other):
+    return compose(self, other)
+
+  # x | y
+
+  def __or__(self, other):
+    cdef string arc_type = (self.arc_type() if hasattr(self, "arc_type") else
+                            other.arc_type())
+    cdef Fst lhs = _compile_or_copy_Fst(self, arc_type=arc_type)
+    lhs.union(other)
+    return lhs
+
+
+cdef class DelayedFst(_Fst):
+
+  """
+  DelayedFst()
+
+  This class wraps an immutable FST whose states are computed only on demand.
+
+  The states and arcs of a delayed FST are computed (and then cached) as they
+  are visited. When it is composed with another FST using the `*` operator,
+  only the states reachable in the composition are ever computed, so applying,
+  e.g., a rewrite rule to a short string need not compute most of the rule. It
+  may be used anywhere an FST argument is expected, in which case a mutable
+  copy is made, but this computes every state. Instances are created by the
+  `cdrewrite_delayed` function.
+  """
+
+  # x * y
+
+  def __mul__(self, other):
+    return _compose_delayed(self, other)
+
+
+# Composes a delayed FST with another FST without copying the former, so that
+# only the states reachable in the composition are computed. The other argument
+# is compiled or copied, relabeled to use the delayed FST's symbol table (which
+# cannot be merged into, as the delayed FST is immutable), and arc-sorted, as
+# otherwise testing the delayed FST's sort properties would compute all of it.
+
+
+cdef Fst _compose_delayed(arg1, arg2):
+  cdef _Fst lhs
+  cdef _Fst rhs
+  cdef Fst tfst
+  if isinstance(arg1, DelayedFst) and isinstance(arg2, DelayedFst):
+    (lhs, rhs) = (arg1, arg2)
+  elif isinstance(arg1, DelayedFst):
+    lhs = arg1
+    tfst = _compile_or_copy_Fst(arg2, arc_type=lhs.arc_type())
+    if (lhs.output_symbols() is not None and
+        tfst.input_symbols() is not None):
+      tfst.relabel_tables(new_isymbols=lhs.output_symbols())
+    tfst.arcsort(sort_type=b"ilabel")
+    rhs = tfst
+  else:
+    rhs = arg2
+    tfst = _compile_or_copy_Fst(arg1, arc_type=rhs.arc_type())
+    if (rhs.input_symbols() is not None and
+        tfst.output_symbols() is not None):
+      tfst.relabel_tables(new_osymbols=rhs.input_symbols())
+    tfst.arcsort(sort_type=b"olabel")
+    lhs = tfst
+  return _init_Fst_from_MutableFst(pywrapfst.compose(lhs, rhs))
+
+
 # Makes a reference-counted copy, if it's already an FST; otherwise, compiles
-# it into an acceptor.
+# it into an acceptor. Compact string and delayed FSTs are copied into mutable
+# FSTs.
 
 
 cdef Fst _compile_or_copy_Fst(arg, arc_type=b"standard"):
-  if not isinstance(arg, Fst):
-    return acceptor(arg, arc_type=arc_type)
-  else:
+  if isinstance(arg, Fst):
     return arg.copy()
+  elif isinstance(arg, (CompactStringFst, DelayedFst)):
+    return _from_pywrapfst(arg)
+  else:
+    return acceptor(arg, arc_type=arc_type)
 
 
 # Makes copies or compiles, using the arc type of the first if specified,
@@ -876,11 +1168,11 @@ cdef Fst _compile_or_copy_Fst(arg, arc_type=b"standard"):
 cdef object _compile_or_copy_two_Fsts(arg1, arg2):
   cdef Fst lhs
   cdef Fst rhs
-  if isinstance(arg1, Fst):
-    lhs = arg1.copy()
+  if isinstance(arg1, (Fst, CompactStringFst, DelayedFst)):
+    lhs = _compile_or_copy_Fst(arg1)
     rhs = _compile_or_copy_Fst(arg2, arc_type=arg1.arc_type())
-  elif isinstance(arg2, Fst):
-    rhs = arg2.copy()
+  elif isinstance(arg2, (Fst, CompactStringFst, DelayedFst)):
+    rhs = _compile_or_copy_Fst(arg2)
     lhs = acceptor(arg1, arc_type=arg2.arc_type())
   else:
     lhs = acceptor(arg1)
@@ -917,6 +1209,76 @@ cpdef Fst _read_from_string(state):
 
 
 
+# Process-wide LRU cache of compiled string acceptors.
+#
+# This is disabled (i.e., has a maximum size of zero) by default. When enabled,
+# acceptors compiled from strings---including those compiled implicitly when a
+# string is passed to an FST operation or operator---are cached, keyed by
+# string, weight, arc type, token type, and whether symbols are attached, and
+# cheap reference-counted copies are returned. Acceptors compiled with a
+# SymbolTable token type are never cached, as symbol tables are mutable.
+
+
+AcceptorCacheInfo = collections.namedtuple("AcceptorCacheInfo",
+                                           ["hits", "misses", "max_size",
+                                            "size"])
+
+
+cdef object _acceptor_cache = collections.OrderedDict()
+cdef size_t _acceptor_cache_max_size = 0
+cdef size_t _acceptor_cache_hits = 0
+cdef size_t _acceptor_cache_misses = 0
+
+
+cdef void _trim_acceptor_cache():
+  while len(_acceptor_cache) > _acceptor_cache_max_size:
+    _acceptor_cache.popitem(last=False)
+
+
+def set_acceptor_cache_size(size_t max_size):
+  """
+  set_acceptor_cache_size(max_size)
+
+  Sets the maximum number of acceptors in the acceptor cache.
+
+  When the cache is full, the least recently used acceptor is evicted. Setting
+  the size to zero disables the cache, which is the default.
+
+  Args:
+    max_size: The maximum number of cached acceptors.
+  """
+  global _acceptor_cache_max_size
+  _acceptor_cache_max_size = max_size
+  _trim_acceptor_cache()
+
+
+def acceptor_cache_info():
+  """
+  acceptor_cache_info()
+
+  Returns statistics for the acceptor cache.
+
+  Returns:
+    An AcceptorCacheInfo with the number of cache hits and misses since the
+    cache was last cleared, its maximum size, and its current size.
+  """
+  return AcceptorCacheInfo(_acceptor_cache_hits, _acceptor_cache_misses,
+                           _acceptor_cache_max_size, len(_acceptor_cache))
+
+
+def clear_acceptor_cache():
+  """
+  clear_acceptor_cache()
+
+  Empties the acceptor cache and resets its statistics.
+  """
+  global _acceptor_cache_hits
+  global _acceptor_cache_misses
+  _acceptor_cache.clear()
+  _acceptor_cache_hits = 0
+  _acceptor_cache_misses = 0
+
+
 # Functions for FST compilation.
 
 
@@ -956,7 +1318,24 @@ cpdef Fst acceptor(astring,
       FstArgError: Unknown token type.
       FstOpError: Operation failed.
       FstStringCompilationError: String compilation failed.
+
+  See also: `set_acceptor_cache_size`.
   """
+  global _acceptor_cache_hits
+  global _acceptor_cache_misses
+  cdef object key = None
+  cdef Fst cached
+  if (_acceptor_cache_max_size and
+      not isinstance(token_type, pywrapfst._SymbolTable)):
+    key = (tostring(astring), None if weight is None else str(weight),
+           tostring(arc_type), tostring(token_type), attach_symbols)
+    cached = _acceptor_cache.pop(key, None)
+    if cached is not None:
+      # Reinserting the acceptor marks it as the most recently used.
+      _acceptor_cache[key] = cached
+      _acceptor_cache_hits += 1
+      return cached.copy()
+    _acceptor_cache_misses += 1
   cdef Fst result = Fst(tostring(arc_type))
   cdef WeightClass wc = _get_WeightClass_or_One(result.weight_type(), weight)
   cdef StringTokenType ttype
@@ -973,6 +1352,162 @@ cpdef Fst acceptor(astring,
   result._check_mutating_imethod()
   if not success:
     raise FstStringCompilationError("String compilation failed")
+  if key is not None:
+    _acceptor_cache[key] = result.copy()
+    _trim_acceptor_cache()
+  return result
+
+
+def acceptors(astrings,
+              weight=None,
+              arc_type=b"standard",
+              token_type=b"byte",
+              bool attach_symbols=True,
+              Far far=None,
+              keys=None):
+  """
+  acceptors(astrings, weight=None, arc_type="standard", token_type="byte",
+            attach_symbols=True, far=None, keys=None)
+
+  Creates acceptors from an iterable of strings.
+
+  This function behaves like calling `acceptor` on each string, but all of the
+  strings are compiled in a single call, without holding the GIL. They are also
+  compiled using a single symbol table, so that a generated symbol receives the
+  same label in each of the acceptors; this table is shared by all of the
+  acceptors when attached.
+
+  Args:
+    astrings: An iterable of input strings.
+    weight: A Weight or weight string indicating the desired path weight. If
+        omitted or null, the path weight is set to semiring One.
+    arc_type: An optional string indicating the arc type for the compiled FSTs.
+        This argument is ignored if a FAR is given.
+    token_type: Either a string indicating how the input strings are to be
+        encoded as arc labels---one of: "utf8" (encodes the strings as UTF-8
+        encoded Unicode string), "byte" (encodes the string as raw bytes)---or
+        a SymbolTable to be used to encode the strings.
+    attach_symbols: Should the symbol table used to compile the acceptors be
+        attached to the FSTs?
+    far: An optional FAR, open for writing, to which the acceptors are written
+        rather than returned.
+    keys: An optional iterable of string keys for the acceptors written to the
+        FAR; if omitted, the keys are the (1-based, zero-padded) positions of
+        the strings.
+
+  Returns:
+    A list of FST acceptors, or None if a FAR is given.
+
+  Raises:
+    FstArgError: Unknown arc type.
+    FstArgError: Unknown token type.
+    FstArgError: Number of keys does not match number of strings.
+    FstOpError: Cannot invoke method in current mode.
+    FstStringCompilationError: String compilation failed.
+  """
+  cdef vector[string] strings
+  for astring in astrings:
+    strings.push_back(tostring(astring))
+  if far is not None:
+    far._check_mode(b"w")
+    arc_type = far.arc_type()
+  cdef Fst prototype = Fst(tostring(arc_type))
+  cdef WeightClass wc = _get_WeightClass_or_One(prototype.weight_type(), weight)
+  cdef StringTokenType ttype
+  cdef SymbolTable_ptr syms = NULL
+  if isinstance(token_type, pywrapfst._SymbolTable):
+    ttype = SYMBOL
+    syms = (<SymbolTable_ptr> (<_SymbolTable> token_type)._table)
+  else:
+    ttype = _get_token_type(tostring(token_type))
+  cdef bool success
+  cdef vector[string] string_keys
+  cdef FarWriterClass *writer
+  cdef size_t width
+  if far is not None:
+    if keys is None:
+      width = len(str(strings.size()))
+      for i in range(strings.size()):
+        string_keys.push_back(tostring("{:0{}d}".format(i + 1, width)))
+    else:
+      for key in keys:
+        string_keys.push_back(tostring(key))
+      if string_keys.size() != strings.size():
+        raise FstArgError("Number of keys does not match number of strings")
+    writer = far._writer._writer.get()
+    with nogil:
+      success = CompileStringsToFar(strings, string_keys, wc, ttype, writer,
+                                    syms, attach_symbols)
+    if not success:
+      raise FstStringCompilationError("String compilation failed")
+    return None
+  cdef list results = [Fst(arc_type) for _ in range(strings.size())]
+  cdef vector[MutableFstClass *] fsts
+  cdef Fst result
+  for result in results:
+    fsts.push_back(result._mfst.get())
+  with nogil:
+    success = CompileStrings(strings, wc, ttype, fsts, syms, attach_symbols)
+  for result in results:
+    result._check_mutating_imethod()
+  if not success:
+    raise FstStringCompilationError("String compilation failed")
+  return results
+
+
+cpdef CompactStringFst compact_acceptor(astring,
+                                        weight=None,
+                                        arc_type=b"standard",
+                                        token_type=b"byte",
+                                        bool attach_symbols=True):
+  """
+  compact_acceptor(astring, weight=None, arc_type="standard",
+                   token_type="byte", attach_symbols=True)
+
+  Creates a compact, immutable acceptor from a string.
+
+  This function behaves like `acceptor`, but returns a CompactStringFst, which
+  requires far less memory than the equivalent mutable FST; this is useful
+  when many compiled strings must be kept, for instance, in a cache.
+
+  Args:
+    astring: The input string.
+    weight: A Weight or weight string indicating the desired path weight. If
+        omitted or null, the path weight is set to semiring One.
+    arc_type: An optional string indicating the arc type for the compiled FST.
+    token_type: Either a string indicating how the input string is to be
+        encoded as arc labels---one of: "utf8" (encodes the strings as UTF-8
+        encoded Unicode string), "byte" (encodes the string as raw bytes)---or
+        a SymbolTable to be used to encode the string.
+    attach_symbols: Should the symbol table used to compile the acceptor be
+        attached to the FST?
+
+  Returns:
+    A compact string FST acceptor.
+
+  Raises:
+    FstArgError: Unknown arc type.
+    FstArgError: Unknown token type.
+    FstStringCompilationError: String compilation failed.
+  """
+  # The prototype is used only to validate the arc type and get its weight
+  # type.
+  cdef Fst prototype = Fst(tostring(arc_type))
+  cdef WeightClass wc = _get_WeightClass_or_One(prototype.weight_type(), weight)
+  cdef StringTokenType ttype
+  cdef SymbolTable_ptr syms = NULL
+  if isinstance(token_type, pywrapfst._SymbolTable):
+    ttype = SYMBOL
+    syms = (<SymbolTable_ptr> (<_SymbolTable> token_type)._table)
+  else:
+    ttype = _get_token_type(tostring(token_type))
+  cdef FstClass *tfst = CompileCompactString(tostring(astring), wc,
+                                             tostring(arc_type), ttype, syms,
+                                             attach_symbols)
+  if tfst == NULL:
+    raise FstStringCompilationError("String compilation failed")
+  cdef CompactStringFst result = CompactStringFst.__new__(CompactStringFst)
+  result._fst.reset(tfst)
   return result
 
 
@@ -1062,9 +1597,11 @@ cpdef Fst cdrewrite(tau,
                     rho,
                     sigma_star,
                     direction=b"ltr",
-                    mode=b"obl"):
+                    mode=b"obl",
+                    bool compact_sigma=False):
   """
-  cdrewrite(tau, lambda, rho, sigma_star, direction="ltr", mode="obl")
+  cdrewrite(tau, lambda, rho, sigma_star, direction="ltr", mode="obl",
+            compact_sigma=False)
 
   Generates a transducer expressing a context-dependent rewrite rule.
 
@@ -1087,6 +1624,11 @@ cpdef Fst cdrewrite(tau,
         or "sim" (simultaneous application).
     mode: A string specifying the mode of rule application; one of: "obl"
         (obligatory application), "opt" (optional application).
+    compact_sigma: Should the rule be compiled over a compact alphabet, in
+        which the symbols of sigma_star not mentioned by tau, lambda, or rho
+        (and which sigma_star treats alike) are collapsed into a single symbol,
+        and then expanded? This greatly speeds up compilation over large
+        alphabets (e.g., all of Unicode).
 
   Returns:
     A rewrite rule FST.
@@ -1095,6 +1637,8 @@ cpdef Fst cdrewrite(tau,
     FstArgError: Unknown cdrewrite direction type.
     FstArgError: Unknown cdrewrite mode type.
     FstOpError: Operation failed.
+
+  See also: `CDRewriteCompiler`, `cdrewrite_delayed`, `cdrewrite_many`.
   """
   cdef CDRewriteDirection cd = _get_cdrewrite_direction(tostring(direction))
   cdef CDRewriteMode cm = _get_cdrewrite_mode(tostring(mode))
@@ -1106,11 +1650,555 @@ cpdef Fst cdrewrite(tau,
   cdef Fst result = Fst(arc_type)
   PyniniCDRewrite(deref(tau_compiled._fst), deref(lambda_compiled._fst),
                   deref(rho_compiled._fst), deref(sigma_star_compiled._fst),
-                  result._mfst.get(), cd, cm)
+                  result._mfst.get(), cd, cm, compact_sigma)
   result._check_mutating_imethod()
   return result
 
 
+def cdrewrite_many(rules,
+                   sigma_star,
+                   direction=b"ltr",
+                   mode=b"obl",
+                   int threads=1):
+  """
+  cdrewrite_many(rules, sigma_star, direction="ltr", mode="obl", threads=1)
+
+  Generates transducers expressing many context-dependent rewrite rules.
+
+  This function behaves like calling `cdrewrite` on each rule, but all of the
+  rules are compiled in a single call, without holding the GIL, on up to the
+  given number of threads. The preparation of the alphabet and of the boundary
+  symbol filters, which all of the rules share, is done just once.
+
+  Args:
+    rules: An iterable of (tau, lambda, rho) triples, as described in
+        `cdrewrite`.
+    sigma_star: A cyclic, unweighted acceptor representing the closure over the
+        alphabet; string arguments are compiled using its arc type.
+    direction: A string specifying the direction of rule application; one of:
+        "ltr" (left-to-right application), "rtl" (right-to-left application),
+        or "sim" (simultaneous application).
+    mode: A string specifying the mode of rule application; one of: "obl"
+        (obligatory application), "opt" (optional application).
+    threads: The maximum number of threads used to compile the rules.
+
+  Returns:
+    A list of rewrite rule FSTs, in the order of the rules.
+
+  Raises:
+    FstArgError: Unknown cdrewrite direction type.
+    FstArgError: Unknown cdrewrite mode type.
+    FstOpError: Operation failed (for the rules listed in the message).
+
+  See also: `cdrewrite`.
+  """
+  cdef CDRewriteDirection cd = _get_cdrewrite_direction(tostring(direction))
+  cdef CDRewriteMode cm = _get_cdrewrite_mode(tostring(mode))
+  cdef Fst sigma_star_compiled = _compile_or_copy_Fst(sigma_star)
+  cdef string arc_type = sigma_star_compiled.arc_type()
+  # The compiled arguments are kept in these lists so that they outlive the
+  # call.
+  cdef list args = []
+  cdef list results = []
+  cdef vector[const FstClass *] taus
+  cdef vector[const FstClass *] lambdas
+  cdef vector[const FstClass *] rhos
+  cdef vector[MutableFstClass *] ofsts
+  cdef Fst tau_compiled
+  cdef Fst lambda_compiled
+  cdef Fst rho_compiled
+  cdef Fst result
+  for (tau, lambda_, rho) in rules:
+    tau_compiled = _compile_or_copy_Fst(tau, arc_type)
+    lambda_compiled = _compile_or_copy_Fst(lambda_, arc_type)
+    rho_compiled = _compile_or_copy_Fst(rho, arc_type)
+    args.append((tau_compiled, lambda_compiled, rho_compiled))
+    taus.push_back(tau_compiled._fst.get())
+    lambdas.push_back(lambda_compiled._fst.get())
+    rhos.push_back(rho_compiled._fst.get())
+    result = Fst(arc_type)
+    results.append(result)
+    ofsts.push_back(result._mfst.get())
+  cdef bool success
+  with nogil:
+    success = PyniniCDRewriteMany(taus, lambdas, rhos,
+                                  deref(sigma_star_compiled._fst), ofsts, cd,
+                                  cm, threads)
+  cdef list failed = []
+  if not success:
+    for (i, result) in enumerate(results):
+      if result._mfst.get().Properties(kError, True) == kError:
+        failed.append(str(i))
+    raise FstOpError("Operation failed for rules: {}".format(
+        ", ".join(failed)))
+  return results
+
+
+cpdef DelayedFst cdrewrite_delayed(tau,
+                                   lambda_,
+                                   rho,
+                                   sigma_star,
+                                   direction=b"ltr",
+                                   mode=b"obl"):
+  """
+  cdrewrite_delayed(tau, lambda, rho, sigma_star, direction="ltr", mode="obl")
+
+  Generates a delayed transducer expressing a context-dependent rewrite rule.
+
+  This operation is like `cdrewrite`, except that the rule's filters are not
+  composed (nor is the result optimized); rather, the rule is a delayed
+  composition of them, whose states are computed only as they are visited.
+  Composing a string with the resulting transducer using the `*` operator
+  computes only the states of the rule reachable on that string, which, for
+  rules over large alphabets applied to few short strings, is much faster
+  than compiling the rule. For a rule applied to many strings, `cdrewrite` is
+  faster.
+
+  Args:
+    tau: A (weighted) transducer representing phi -> psi.
+    lambda: An unweighted acceptor representing the left context.
+    rho: An unweighted acceptor representing the right context.
+    sigma_star: A cyclic, unweighted acceptor representing the closure over the
+        alphabet.
+    direction: A string specifying the direction of rule application; one of:
+        "ltr" (left-to-right application), "rtl" (right-to-left application),
+        or "sim" (simultaneous application).
+    mode: A string specifying the mode of rule application; one of: "obl"
+        (obligatory application), "opt" (optional application).
+
+  Returns:
+    A delayed rewrite rule FST.
+
+  Raises:
+    FstArgError: Unknown cdrewrite direction type.
+    FstArgError: Unknown cdrewrite mode type.
+    FstOpError: Operation failed.
+
+  See also: `cdrewrite`.
+  """
+  cdef CDRewriteDirection cd = _get_cdrewrite_direction(tostring(direction))
+  cdef CDRewriteMode cm = _get_cdrewrite_mode(tostring(mode))
+  cdef Fst tau_compiled = _compile_or_copy_Fst(tau)
+  cdef string arc_type = tau_compiled.arc_type()
+  cdef Fst lambda_compiled = _compile_or_copy_Fst(lambda_, arc_type)
+  cdef Fst rho_compiled = _compile_or_copy_Fst(rho, arc_type)
+  cdef Fst sigma_star_compiled = _compile_or_copy_Fst(sigma_star, arc_type)
+  cdef FstClass *tfst = PyniniCDRewriteDelayed(deref(tau_compiled._fst),
+                                               deref(lambda_compiled._fst),
+                                               deref(rho_compiled._fst),
+                                               deref(sigma_star_compiled._fst),
+                                               cd, cm)
+  if tfst == NULL:
+    raise FstOpError("Operation failed")
+  cdef DelayedFst result = DelayedFst.__new__(DelayedFst)
+  result._fst.reset(tfst)
+  return result
+
+
+CDRewriteCacheInfo = collections.namedtuple("CDRewriteCacheInfo",
+                                            ["hits", "misses", "size"])
+
+
+CDRewriteStageInfo = collections.namedtuple("CDRewriteStageInfo",
+                                            ["name", "states", "arcs",
+                                             "shrunk_states", "shrunk_arcs"])
+
+
+cdef class CDRewriteCompiler(object):
+
+  """
+  CDRewriteCompiler(arc_type="standard", threads=1, bounded=False)
+
+  Compiler for context-dependent rewrite rules which reuses filters.
+
+  Compiling a rewrite rule involves building several filter transducers from
+  the alphabet and the left and right contexts, each of which requires
+  determinization and minimization. This class compiles rules as does the
+  `cdrewrite` function, but caches these filters, keyed by FST fingerprint and
+  marker labels, so that later rules which share an alphabet and contexts with
+  an earlier one reuse them. It can also be used as a context manager, in
+  which case the cache is cleared on exit.
+
+  The filters needed for each rule are independent of one another, and may be
+  built concurrently; the result is the same regardless of the number of
+  threads used. The time spent building each filter of the most recently
+  compiled rule is available from `filter_times`.
+
+  The filters are then composed, one at a time. Intermediate results of this
+  cascade may be many times larger than the rule itself; in bounded mode, each
+  filter is freed once it has been composed, and each intermediate result is
+  optimized before the next composition, reducing peak memory use at some cost
+  in time. The size of each stage of the cascade for the most recently
+  compiled rule is available from `stage_info`.
+
+  Args:
+    arc_type: An optional string indicating the arc type for compiled rules.
+        String arguments are compiled using this arc type.
+    threads: The maximum number of threads used to build the filters for a
+        rule.
+    bounded: Should intermediate results be optimized to bound peak memory
+        use?
+
+  Raises:
+    FstArgError: Unknown arc type.
+  """
+
+  cdef unique_ptr[CDRewriteCompilerClass] _compiler
+
+  def __repr__(self):
+    return "<CDRewriteCompiler at 0x{:x}>".format(id(self))
+
+  def __init__(self, arc_type=b"standard", int threads=1,
+               bool bounded=False):
+    self._compiler.reset(new CDRewriteCompilerClass(tostring(arc_type),
+                                                    threads, bounded))
+    if self._compiler.get().Error():
+      raise FstArgError("Unknown arc type: {!r}".format(arc_type))
+
+  cpdef string arc_type(self):
+    """
+    arc_type(self)
+
+    Returns the arc type of compiled rules.
+    """
+    return self._compiler.get().ArcType()
+
+  cpdef Fst cdrewrite(self,
+                      tau,
+                      lambda_,
+                      rho,
+                      sigma_star,
+                      direction=b"ltr",
+                      mode=b"obl"):
+    """
+    cdrewrite(self, tau, lambda, rho, sigma_star, direction="ltr", mode="obl")
+
+    Generates a transducer expressing a context-dependent rewrite rule.
+
+    See also: `cdrewrite`.
+
+    Raises:
+      FstArgError: Unknown cdrewrite direction type.
+      FstArgError: Unknown cdrewrite mode type.
+      FstOpError: Operation failed.
+    """
+    cdef CDRewriteDirection cd = _get_cdrewrite_direction(tostring(direction))
+    cdef CDRewriteMode cm = _get_cdrewrite_mode(tostring(mode))
+    cdef string arc_type = self.arc_type()
+    cdef Fst tau_compiled = _compile_or_copy_Fst(tau, arc_type)
+    cdef Fst lambda_compiled = _compile_or_copy_Fst(lambda_, arc_type)
+    cdef Fst rho_compiled = _compile_or_copy_Fst(rho, arc_type)
+    cdef Fst sigma_star_compiled = _compile_or_copy_Fst(sigma_star, arc_type)
+    cdef Fst result = Fst(arc_type)
+    self._compiler.get().Compile(deref(tau_compiled._fst),
+                                 deref(lambda_compiled._fst),
+                                 deref(rho_compiled._fst),
+                                 deref(sigma_star_compiled._fst),
+                                 result._mfst.get(), cd, cm)
+    result._check_mutating_imethod()
+    return result
+
+  def cache_info(self):
+    """
+    cache_info(self)
+
+    Returns statistics for the filter cache.
+
+    Returns:
+      A CDRewriteCacheInfo with the number of filter lookups satisfied and not
+      satisfied by the cache, and the number of cached filters.
+    """
+    return CDRewriteCacheInfo(self._compiler.get().Hits(),
+                              self._compiler.get().Misses(),
+                              self._compiler.get().Size())
+
+  def filter_times(self):
+    """
+    filter_times(self)
+
+    Returns the time spent building each filter for the last compiled rule.
+
+    Returns:
+      A list of pairs of filter name and the time, in seconds, spent building
+      (or retrieving from the cache) that filter.
+    """
+    return self._compiler.get().FilterTimes()
+
+  def stage_info(self):
+    """
+    stage_info(self)
+
+    Returns the size of each stage of the cascade for the last compiled rule.
+
+    Returns:
+      A list of CDRewriteStageInfo, one per composition, each with the name of
+      the filter composed at that stage, the number of states and arcs in the
+      result as composed, and the number after optimization (which is the
+      same, except in bounded mode).
+    """
+    cdef list result = []
+    cdef CDRewriteStageStats stage
+    for stage in self._compiler.get().StageStats():
+      result.append(CDRewriteStageInfo(stage.name, stage.states, stage.arcs,
+                                       stage.shrunk_states, stage.shrunk_arcs))
+    return result
+
+  cpdef void clear(self):
+    """
+    clear(self)
+
+    Empties the filter cache and resets its statistics.
+    """
+    self._compiler.get().Clear()
+
+  def __enter__(self):
+    return self
+
+  def __exit__(self, exc, value, tb):
+    self.clear()
+
+
+cdef class RuleApplier(object):
+
+  """
+  RuleApplier(rule)
+
+  Applies a compiled rewrite rule to strings without general composition.
+
+  Applying a rule by composing a string with it goes through the general
+  composition machinery, which sorts arcs, merges symbol tables, and copies
+  FSTs. This class instead flattens the rule once into a compact arc table,
+  then walks it directly over the labels of each input string, visiting only
+  the states reachable on that string. The rule may be mutated or deleted
+  afterwards without affecting the applier.
+
+  Args:
+    rule: The rule FST.
+  """
+
+  cdef unique_ptr[RuleApplierClass] _applier
+
+  def __repr__(self):
+    return "<RuleApplier at 0x{:x}>".format(id(self))
+
+  def __init__(self, rule):
+    cdef Fst rule_compiled = _compile_or_copy_Fst(rule)
+    self._applier.reset(new RuleApplierClass(deref(rule_compiled._fst)))
+    if self._applier.get().Error():
+      raise FstArgError("Unknown arc type: {!r}".format(
+          rule_compiled.arc_type()))
+
+  cpdef string arc_type(self):
+    """
+    arc_type(self)
+
+    Returns the arc type of the rule.
+    """
+    return self._applier.get().ArcType()
+
+  cpdef Fst lattice(self, istring, token_type=b"byte"):
+    """
+    lattice(self, istring, token_type="byte")
+
+    Computes the lattice of rewrites of a string.
+
+    This is equivalent to the epsilon-free output projection of the
+    composition of the string with the rule.
+
+    Args:
+      istring: The input string.
+      token_type: Either a string indicating how the input string is to be
+          encoded as arc labels---one of: "utf8" (encodes the strings as UTF-8
+          encoded Unicode string), "byte" (encodes the string as raw bytes)---
+          or a SymbolTable to be used to encode the string.
+
+    Returns:
+      An acceptor over the rule's output labels.
+
+    Raises:
+      FstArgError: Unknown token type.
+      FstOpError: Operation failed.
+    """
+    cdef StringTokenType ttype
+    cdef SymbolTable_ptr syms = NULL
+    if isinstance(token_type, pywrapfst._SymbolTable):
+      ttype = SYMBOL
+      syms = (<SymbolTable_ptr> (<_SymbolTable> token_type)._table)
+    else:
+      ttype = _get_token_type(tostring(token_type))
+    cdef Fst result = Fst(self.arc_type())
+    if not self._applier.get().Lattice(tostring(istring), ttype, syms,
+                                       result._mfst.get()):
+      raise FstOpError("Rule does not accept the input string")
+    return result
+
+  cpdef list top_rewrites(self, istring, int32 nshortest=1,
+                          token_type=b"byte"):
+    """
+    top_rewrites(self, istring, nshortest=1, token_type="byte")
+
+    Computes the best rewrites of a string.
+
+    Args:
+      istring: The input string.
+      nshortest: The maximum number of unique rewrites to return.
+      token_type: Either a string indicating how the input string is to be
+          encoded as arc labels, and the rewrites decoded from them---one of:
+          "utf8" (encodes the strings as UTF-8 encoded Unicode string), "byte"
+          (encodes the string as raw bytes)---or a SymbolTable to be used to
+          encode the string.
+
+    Returns:
+      A list of up to `nshortest` output strings, best first.
+
+    Raises:
+      FstArgError: Unknown token type.
+      FstOpError: Operation failed.
+    """
+    cdef StringTokenType ttype
+    cdef SymbolTable_ptr syms = NULL
+    if isinstance(token_type, pywrapfst._SymbolTable):
+      ttype = SYMBOL
+      syms = (<SymbolTable_ptr> (<_SymbolTable> token_type)._table)
+    else:
+      ttype = _get_token_type(tostring(token_type))
+    cdef vector[string] rewrites
+    if not self._applier.get().TopRewrites(tostring(istring), ttype, syms,
+                                           nshortest, addr(rewrites)):
+      raise FstOpError("Rule does not accept the input string")
+    return list(rewrites)
+
+
+cdef class SequentialTransducer(object):
+
+  """
+  SequentialTransducer(rule, max_table_size=134217728)
+
+  Applies an input-deterministic rule to strings using a transition table.
+
+  Many rules are input-deterministic, and free of input epsilons, once
+  optimized. This class compiles such a rule into a flat table holding the
+  destination state, output label, and weight of the transition from each
+  state on each input label, so that applying it to a string takes a single
+  table lookup per input character. Tables may be written to, and read from,
+  files.
+
+  Args:
+    rule: An input-deterministic rule FST without input epsilons.
+    max_table_size: The maximum number of cells (states times distinct input
+        labels) in the table.
+
+  Raises:
+    FstArgError: Rule cannot be compiled.
+  """
+
+  cdef unique_ptr[SequentialTransducerClass] _transducer
+
+  def __repr__(self):
+    return "<SequentialTransducer at 0x{:x}>".format(id(self))
+
+  def __init__(self, rule,
+               int64 max_table_size=kSequentialTransducerMaxTableSize):
+    cdef Fst rule_compiled = _compile_or_copy_Fst(rule)
+    self._transducer.reset(
+        new SequentialTransducerClass(deref(rule_compiled._fst),
+                                      max_table_size))
+    if self._transducer.get().Error():
+      raise FstArgError("Rule is not input-deterministic, has input "
+                        "epsilons, or has too large a table")
+
+  @classmethod
+  def read(cls, filename):
+    """
+    SequentialTransducer.read(filename)
+
+    Reads a sequential transducer from a file.
+
+    Args:
+      filename: The string location of the input file.
+
+    Returns:
+      A new SequentialTransducer instance.
+
+    Raises:
+      FstIOError: Read failed.
+    """
+    cdef SequentialTransducer result = (
+        SequentialTransducer.__new__(SequentialTransducer))
+    result._transducer.reset(
+        SequentialTransducerClass.Read(tostring(filename)))
+    if result._transducer.get() == NULL:
+      raise FstIOError("Read failed: {!r}".format(filename))
+    return result
+
+  cpdef void write(self, filename) except *:
+    """
+    write(self, filename)
+
+    Writes the sequential transducer to a file.
+
+    Args:
+      filename: The string location of the output file.
+
+    Raises:
+      FstIOError: Write failed.
+    """
+    if not self._transducer.get().Write(tostring(filename)):
+      raise FstIOError("Write failed: {!r}".format(filename))
+
+  cpdef string arc_type(self):
+    """
+    arc_type(self)
+
+    Returns the arc type of the rule.
+    """
+    return self._transducer.get().ArcType()
+
+  cpdef int64 num_states(self):
+    """
+    num_states(self)
+
+    Returns the number of states (rows) in the table.
+    """
+    return self._transducer.get().NumStates()
+
+  cpdef size_t num_columns(self):
+    """
+    num_columns(self)
+
+    Returns the number of distinct input labels (columns) in the table.
+    """
+    return self._transducer.get().NumColumns()
+
+  cpdef string apply(self, istring, token_type=b"byte") except *:
+    """
+    apply(self, istring, token_type="byte")
+
+    Rewrites a string.
+
+    Args:
+      istring: The input string.
+      token_type: A string indicating how the input string is to be encoded as
+          arc labels, and the output decoded from them---one of: "utf8"
+          (encodes the strings as UTF-8 encoded Unicode string), "byte"
+          (encodes the string as raw bytes). Bracketed spans are not
+          interpreted as generated symbols.
+
+    Returns:
+      The output string.
+
+    Raises:
+      FstArgError: Unknown token type.
+      FstOpError: Operation failed.
+    """
+    cdef StringTokenType ttype = _get_token_type(tostring(token_type))
+    cdef string result
+    if not self._transducer.get().Apply(tostring(istring), ttype,
+                                        addr(result)):
+      raise FstOpError("Rule does not accept the input string")
+    return result
+
+
 cpdef Fst epsilon_machine(arc_type=b"standard", weight=None):
   """
   epsilon_machine(arc_type="standard")
@@ -1213,10 +2301,12 @@ cpdef Fst string_file(filename,
                       input_token_type=b"byte",
                       output_token_type=b"byte",
                       bool attach_input_symbols=True,
-                      bool attach_output_symbols=True):
+                      bool attach_output_symbols=True,
+                      int threads=1,
+                      bool presorted=False):
   """
   string_file(filename, arc_type="standard", input_token_type="byte",
-              output_token_type="byte")
+              output_token_type="byte", threads=1, presorted=False)
 
   Creates a transducer that maps between elements of mappings read from
   a tab-delimited file.
@@ -1252,6 +2342,14 @@ cpdef Fst string_file(filename,
         input-side acceptor be attached to the FST?
     attach_output_symbols: should the symbol table used to compile the
         output-side acceptor be attached to the FST?
+    threads: The number of threads used to tokenize the lines and build the
+        prefix tree; the result does not depend on this value.
+    presorted: Are the entries sorted by input string and then by output
+        string, in label order (i.e., bytewise for "byte" and "utf8" token
+        types)? If so, the minimal transducer is built directly, without first
+        building the prefix tree; if the entries turn out not to be sorted, a
+        warning is logged and the prefix tree is used instead. The threads
+        argument is ignored in this mode.
 
   Returns:
     An FST.
@@ -1275,7 +2373,8 @@ cpdef Fst string_file(filename,
     otype = _get_token_type(tostring(output_token_type))
   cdef Fst result = Fst(arc_type)
   if not StringFile(tostring(filename), itype, otype, result._mfst.get(),
-                    isyms, osyms, attach_input_symbols, attach_output_symbols):
+                    isyms, osyms, attach_input_symbols, attach_output_symbols,
+                    threads, presorted):
     raise FstIOError("Read failed")
   return result
 
@@ -1285,12 +2384,14 @@ cpdef Fst string_map(lines,
                      input_token_type=b"byte",
                      output_token_type=b"byte",
                      bool attach_input_symbols=True,
-                     bool attach_output_symbols=True):
+                     bool attach_output_symbols=True,
+                     int threads=1,
+                     bool presorted=False):
   """
   string_map(lines, arc_type="standard",
              input_token_type="byte", output_token_type="byte",
              attach_input_symbols=True,
-             attach_output_symbols=True)
+             attach_output_symbols=True, threads=1, presorted=False)
 
   Creates a transducer that maps between elements of mappings read from
   an iterable.
@@ -1323,6 +2424,14 @@ cpdef Fst string_map(lines,
         input-side acceptor be attached to the FST?
     attach_output_symbols: should the symbol table used to compile the
         output-side acceptor be attached to the FST?
+    threads: The number of threads used to tokenize the lines and build the
+        prefix tree; the result does not depend on this value.
+    presorted: Are the entries sorted by input string and then by output
+        string, in label order (i.e., bytewise for "byte" and "utf8" token
+        types)? If so, the minimal transducer is built directly, without first
+        building the prefix tree; if the entries turn out not to be sorted, a
+        warning is logged and the prefix tree is used instead. The threads
+        argument is ignored in this mode.
 
   Returns:
     An FST.
@@ -1359,7 +2468,8 @@ cpdef Fst string_map(lines,
       string_lines.push_back([tostring(line)])
   cdef bool success = StringMap(string_lines, itype, otype,
                                 result._mfst.get(), isyms, osyms,
-                                attach_input_symbols, attach_output_symbols)
+                                attach_input_symbols, attach_output_symbols,
+                                threads, presorted)
   if not success:
     raise FstArgError("String map compilation failed")
   return result
@@ -1648,7 +2758,7 @@ cdef class PdtParentheses(object):
     Returns:
       A deep copy of the PdtParentheses object.
     """
-    cpdef PdtParentheses result = PdtParentheses.__new__(PdtParentheses)
+    cdef PdtParentheses result = PdtParentheses.__new__(PdtParentheses)
     result._parens = self._parens
     return result
 
@@ -1973,7 +3083,7 @@ cdef class MPdtParentheses(object):
     Returns:
       A deep copy of the MPdtParentheses object.
     """
-    cpdef MPdtParentheses result = MPdtParentheses.__new__(MPdtParentheses)
+    cdef MPdtParentheses result = MPdtParentheses.__new__(MPdtParentheses)
     result._parens = self._parens
     result._assign = self._assign
     return result
@@ -2217,7 +3327,9 @@ cdef class StringPaths(object):
       osyms = (<SymbolTable_ptr> (<_SymbolTable> output_token_type)._table)
     else:
       otype = _get_token_type(tostring(output_token_type))
-    cdef Fst ifst_compiled = _compile_or_copy_Fst(ifst)
+    # Compact string FSTs are immutable, so they need not be copied.
+    cdef _Fst ifst_compiled = (ifst if isinstance(ifst, CompactStringFst) else
+                               _compile_or_copy_Fst(ifst))
     self._paths.reset(new StringPathsClass(deref(ifst_compiled._fst), itype,
                                            otype, isyms, osyms, rm_epsilon))
     if self._paths.get().Error():
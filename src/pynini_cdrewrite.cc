@@ -17,6 +17,8 @@
 
 #include "pynini_cdrewrite.h"
 
+#include <vector>
+
 DEFINE_int32(left_boundary_index, 0x10fffc,
              "Index for the beginning-of-string symbol");
 DEFINE_string(left_boundary_symbol, "BOS", "Beginning-of-string symbol");
@@ -33,12 +35,13 @@ namespace script {
 void PyniniCDRewrite(const FstClass &tau, const FstClass &lambda,
                      const FstClass &rho, const FstClass &sigma_star,
                      MutableFstClass *fst, CDRewriteDirection cd,
-                     CDRewriteMode cm) {
+                     CDRewriteMode cm, bool compact) {
   if (!internal::ArcTypesMatch(tau, lambda, "PyniniCDRewrite") ||
       !internal::ArcTypesMatch(lambda, rho, "PyniniCDRewrite") ||
       !internal::ArcTypesMatch(rho, sigma_star, "PyniniCDRewrite"))
     return;
-  PyniniCDRewriteArgs args(tau, lambda, rho, sigma_star, fst, cd, cm);
+  PyniniCDRewriteArgs args(tau, lambda, rho, sigma_star, fst, cd, cm,
+                           compact);
   Apply<Operation<PyniniCDRewriteArgs>>("PyniniCDRewrite", fst->ArcType(),
                                         &args);
 }
@@ -47,6 +50,107 @@ REGISTER_FST_OPERATION(PyniniCDRewrite, StdArc, PyniniCDRewriteArgs);
 REGISTER_FST_OPERATION(PyniniCDRewrite, LogArc, PyniniCDRewriteArgs);
 REGISTER_FST_OPERATION(PyniniCDRewrite, Log64Arc, PyniniCDRewriteArgs);
 
+FstClass *PyniniCDRewriteDelayed(const FstClass &tau, const FstClass &lambda,
+                                 const FstClass &rho,
+                                 const FstClass &sigma_star,
+                                 CDRewriteDirection cd, CDRewriteMode cm) {
+  if (!internal::ArcTypesMatch(tau, lambda, "PyniniCDRewriteDelayed") ||
+      !internal::ArcTypesMatch(lambda, rho, "PyniniCDRewriteDelayed") ||
+      !internal::ArcTypesMatch(rho, sigma_star, "PyniniCDRewriteDelayed")) {
+    return nullptr;
+  }
+  PyniniCDRewriteDelayedInnerArgs iargs(tau, lambda, rho, sigma_star, cd, cm);
+  PyniniCDRewriteDelayedArgs args(iargs);
+  args.retval = nullptr;
+  Apply<Operation<PyniniCDRewriteDelayedArgs>>("PyniniCDRewriteDelayed",
+                                               tau.ArcType(), &args);
+  return args.retval;
+}
+
+REGISTER_FST_OPERATION(PyniniCDRewriteDelayed, StdArc,
+                       PyniniCDRewriteDelayedArgs);
+REGISTER_FST_OPERATION(PyniniCDRewriteDelayed, LogArc,
+                       PyniniCDRewriteDelayedArgs);
+REGISTER_FST_OPERATION(PyniniCDRewriteDelayed, Log64Arc,
+                       PyniniCDRewriteDelayedArgs);
+
+bool PyniniCDRewriteMany(const std::vector<const FstClass *> &taus,
+                         const std::vector<const FstClass *> &lambdas,
+                         const std::vector<const FstClass *> &rhos,
+                         const FstClass &sigma_star,
+                         const std::vector<MutableFstClass *> &ofsts,
+                         CDRewriteDirection cd, CDRewriteMode cm,
+                         int threads) {
+  if (taus.size() != ofsts.size() || lambdas.size() != ofsts.size() ||
+      rhos.size() != ofsts.size()) {
+    FSTERROR() << "PyniniCDRewriteMany: Numbers of rule arguments do not match";
+    for (auto *ofst : ofsts) ofst->SetProperties(kError, kError);
+    return false;
+  }
+  if (ofsts.empty()) return true;
+  std::vector<const FstClass *> fsts(taus);
+  fsts.insert(fsts.end(), lambdas.begin(), lambdas.end());
+  fsts.insert(fsts.end(), rhos.begin(), rhos.end());
+  fsts.insert(fsts.end(), ofsts.begin(), ofsts.end());
+  for (const auto *fst : fsts) {
+    if (!internal::ArcTypesMatch(sigma_star, *fst, "PyniniCDRewriteMany")) {
+      for (auto *ofst : ofsts) ofst->SetProperties(kError, kError);
+      return false;
+    }
+  }
+  PyniniCDRewriteManyInnerArgs iargs(taus, lambdas, rhos, sigma_star, ofsts,
+                                     cd, cm, threads);
+  PyniniCDRewriteManyArgs args(iargs);
+  args.retval = false;
+  Apply<Operation<PyniniCDRewriteManyArgs>>("PyniniCDRewriteMany",
+                                            sigma_star.ArcType(), &args);
+  return args.retval;
+}
+
+REGISTER_FST_OPERATION(PyniniCDRewriteMany, StdArc, PyniniCDRewriteManyArgs);
+REGISTER_FST_OPERATION(PyniniCDRewriteMany, LogArc, PyniniCDRewriteManyArgs);
+REGISTER_FST_OPERATION(PyniniCDRewriteMany, Log64Arc,
+                       PyniniCDRewriteManyArgs);
+
+CDRewriteCompilerClass::CDRewriteCompilerClass(const string &arc_type,
+                                               int threads, bool bounded)
+    : arc_type_(arc_type) {
+  InitCDRewriteCompilerClassArgs args(threads, bounded, this);
+  Apply<Operation<InitCDRewriteCompilerClassArgs>>(
+      "InitCDRewriteCompilerClass", arc_type, &args);
+}
+
+void CDRewriteCompilerClass::Compile(const FstClass &tau,
+                                     const FstClass &lambda,
+                                     const FstClass &rho,
+                                     const FstClass &sigma_star,
+                                     MutableFstClass *ofst,
+                                     CDRewriteDirection cd, CDRewriteMode cm) {
+  const std::vector<const FstClass *> fsts = {&tau, &lambda, &rho,
+                                              &sigma_star, ofst};
+  for (const auto *fst : fsts) {
+    if (fst->ArcType() != arc_type_) {
+      FSTERROR() << "CDRewriteCompilerClass::Compile: Arc type "
+                 << fst->ArcType() << " does not match compiler arc type "
+                 << arc_type_;
+      ofst->SetProperties(kError, kError);
+      return;
+    }
+  }
+  if (!impl_) {
+    ofst->SetProperties(kError, kError);
+    return;
+  }
+  impl_->Compile(tau, lambda, rho, sigma_star, ofst, cd, cm);
+}
+
+REGISTER_FST_OPERATION(InitCDRewriteCompilerClass, StdArc,
+                       InitCDRewriteCompilerClassArgs);
+REGISTER_FST_OPERATION(InitCDRewriteCompilerClass, LogArc,
+                       InitCDRewriteCompilerClassArgs);
+REGISTER_FST_OPERATION(InitCDRewriteCompilerClass, Log64Arc,
+                       InitCDRewriteCompilerClassArgs);
+
 }  // namespace script
 }  // namespace fst
 
@@ -23,6 +23,15 @@
 // markers, in the style of Thrax. There are both arc-templated and
 // template-free functions.
 
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
 #include <fst/fstlib.h>
 #include <fst/script/arg-packs.h>
 #include <fst/script/fstscript.h>
@@ -103,81 +112,375 @@ bool IsUnconditionedInsertion(const Fst<Arc> &tau, const Fst<Arc> &lambda,
           AllInputEpsilons(rho));
 }
 
-// The input FSTs are mutated during preparation. Outside of the internal
-// namespace, the four input arguments are all immutable const references,
-// and this is called after making mutable copies.
-
+// Prepares sigma_star for compilation of any number of rules sharing it: builds
+// the boundary inserter, moves sigma_star's symbols into a single "global"
+// table (which is returned via the syms argument), and adds boundary symbol
+// arcs to sigma_star.
 template <class Arc>
-void PyniniCDRewrite(MutableFst<Arc> *tau, MutableFst<Arc> *lambda,
-                     MutableFst<Arc> *rho, MutableFst<Arc> *sigma_star,
-                     MutableFst<Arc> *ofst, CDRewriteDirection cd,
-                     CDRewriteMode cm) {
-  // Unconditioned insertion is not obviously well-defined, and breaks the
-  // boundary symbol logic, so we forbid it explicitly here.
-  if (IsUnconditionedInsertion(*tau, *lambda, *rho)) {
-    FSTERROR() << "PyniniCDRewrite: Unconditioned insertion is undefined; "
-               << "specify a non-null lambda or rho for any insertion rule";
-    ofst->SetProperties(kError, kError);
-    return;
-  }
-  VectorFst<Arc> inserter;
-  MakeBoundaryInserter(*sigma_star, &inserter);
+void PrepareSigmaStar(MutableFst<Arc> *sigma_star, MutableFst<Arc> *inserter,
+                      std::unique_ptr<SymbolTable> *syms) {
+  MakeBoundaryInserter(*sigma_star, inserter);
   // During compilation, all symbols are stored in a single "global" table,
   // while FST symbol tables are nulled out. The global table is initialized
   // from sigma_star's symbol table, as it is likely to be closer to the
   // "complete" table than other arguments. It does not contain the boundary
   // symbols, as these are deleted as a post-processing step. After compilation,
   // the global table is assigned to the output FST's input and output table.
-  std::unique_ptr<SymbolTable> syms(sigma_star->InputSymbols()
-                                        ? sigma_star->InputSymbols()->Copy()
-                                        : nullptr);
-  syms.reset(PrepareOutputSymbols(syms.get(), sigma_star));
+  syms->reset(sigma_star->InputSymbols() ? sigma_star->InputSymbols()->Copy()
+                                         : nullptr);
+  syms->reset(PrepareOutputSymbols(syms->get(), sigma_star));
   DeleteSymbols(sigma_star);
   // Gives a consistent labeling to boundary symbols in lambda and/or rho.
-  if (syms) {
-    syms->AddSymbol(FLAGS_left_boundary_symbol, FLAGS_left_boundary_index);
-    syms->AddSymbol(FLAGS_right_boundary_symbol, FLAGS_right_boundary_index);
-  }
-  // Prepares remaining output.
-  syms.reset(PrepareInputSymbols(syms.get(), tau));
-  syms.reset(PrepareOutputSymbols(syms.get(), tau));
-  DeleteSymbols(tau);
-  syms.reset(PrepareInputSymbols(syms.get(), lambda));
-  syms.reset(PrepareOutputSymbols(syms.get(), lambda));
-  DeleteSymbols(lambda);
-  syms.reset(PrepareInputSymbols(syms.get(), rho));
-  syms.reset(PrepareOutputSymbols(syms.get(), rho));
-  DeleteSymbols(rho);
+  if (*syms) {
+    (*syms)->AddSymbol(FLAGS_left_boundary_symbol, FLAGS_left_boundary_index);
+    (*syms)->AddSymbol(FLAGS_right_boundary_symbol,
+                       FLAGS_right_boundary_index);
+  }
   AddBoundarySymbolArcsToSigmaStar(sigma_star);
+}
+
+// Checks the rule, then merges the symbols of tau, lambda, and rho into the
+// global table initialized by PrepareSigmaStar, returning views of them without
+// symbol tables (and relabeled as needed) via the last three arguments, so that
+// they need not be copied. Returns false if the rule is an unconditioned
+// insertion.
+template <class Arc>
+bool PrepareRule(const Fst<Arc> &tau, const Fst<Arc> &lambda,
+                 const Fst<Arc> &rho, std::unique_ptr<SymbolTable> *syms,
+                 std::unique_ptr<const Fst<Arc>> *tau_view,
+                 std::unique_ptr<const Fst<Arc>> *lambda_view,
+                 std::unique_ptr<const Fst<Arc>> *rho_view) {
+  // Unconditioned insertion is not obviously well-defined, and breaks the
+  // boundary symbol logic, so we forbid it explicitly here.
+  if (IsUnconditionedInsertion(tau, lambda, rho)) {
+    FSTERROR() << "PyniniCDRewrite: Unconditioned insertion is undefined; "
+               << "specify a non-null lambda or rho for any insertion rule";
+    return false;
+  }
+  tau_view->reset(PrepareSymbolsView(tau, syms));
+  lambda_view->reset(PrepareSymbolsView(lambda, syms));
+  rho_view->reset(PrepareSymbolsView(rho, syms));
+  return true;
+}
+
+// Returns true if sigma_star (with boundary symbol arcs added) is the closure
+// of an alphabet: an unweighted one-state acceptor whose start state is final
+// and whose arcs are all self-loops. If so, the alphabet, without the boundary
+// symbols, is returned via the labels argument.
+template <class Arc>
+bool IsSigmaStarClosure(const Fst<Arc> &sigma_star,
+                        std::unordered_set<typename Arc::Label> *labels) {
+  labels->clear();
+  const auto start = sigma_star.Start();
+  if (start == kNoStateId || sigma_star.Final(start) != Arc::Weight::One()) {
+    return false;
+  }
+  for (StateIterator<Fst<Arc>> siter(sigma_star); !siter.Done();
+       siter.Next()) {
+    if (siter.Value() != start) return false;
+  }
+  for (ArcIterator<Fst<Arc>> aiter(sigma_star, start); !aiter.Done();
+       aiter.Next()) {
+    const auto &arc = aiter.Value();
+    if (arc.nextstate != start || arc.ilabel != arc.olabel ||
+        arc.weight != Arc::Weight::One()) {
+      return false;
+    }
+    if (arc.ilabel != FLAGS_left_boundary_index &&
+        arc.ilabel != FLAGS_right_boundary_index) {
+      labels->insert(arc.ilabel);
+    }
+  }
+  return true;
+}
+
+// The phases of one side of a path through a compiled rule, with respect to
+// the boundary symbols.
+enum BoundaryPhase { BEFORE_BOS = 0, BETWEEN_BOUNDARIES = 1, AFTER_EOS = 2 };
+
+// Advances the phase of one side of a path over a label, as the boundary
+// inserter (or deleter) would: BOS must come first, then labels in the
+// alphabet, then EOS. Boundary labels are replaced by epsilon. Returns false
+// if the label is not allowed in the current phase.
+template <class Label>
+bool AdvanceBoundaryPhase(const std::unordered_set<Label> &labels,
+                          Label *label, BoundaryPhase *phase) {
+  if (*label == 0) return true;
+  if (*label == FLAGS_left_boundary_index) {
+    if (*phase != BEFORE_BOS) return false;
+    *phase = BETWEEN_BOUNDARIES;
+    *label = 0;
+    return true;
+  }
+  if (*label == FLAGS_right_boundary_index) {
+    if (*phase != BETWEEN_BOUNDARIES) return false;
+    *phase = AFTER_EOS;
+    *label = 0;
+    return true;
+  }
+  return *phase == BETWEEN_BOUNDARIES && labels.count(*label);
+}
+
+// Computes, in a single pass over the compiled rule, the same relation as
+// composing it with the boundary inserter and deleter for the closure of the
+// given alphabet. Each state of the result pairs a state of the rule with the
+// boundary phases of the input and output sides of the paths reaching it.
+// Though the relation is the same, the machine need not be: states are
+// numbered in the depth-first order in which they are discovered, and no
+// composition filter is involved, so the result is generally not identical to
+// the composed one, and should be compared with it only up to equivalence.
+template <class Arc>
+void StripBoundaries(const std::unordered_set<typename Arc::Label> &labels,
+                     MutableFst<Arc> *fst) {
+  using StateId = typename Arc::StateId;
+  const auto start = fst->Start();
+  if (start == kNoStateId) return;
+  VectorFst<Arc> result;
+  std::unordered_map<int64, StateId> ids;
+  // Each entry holds the state of the result, and the rule state and phases it
+  // pairs.
+  std::vector<std::tuple<StateId, StateId, BoundaryPhase, BoundaryPhase>>
+      queue;
+  const auto find_or_add = [&](StateId s, BoundaryPhase iphase,
+                               BoundaryPhase ophase) {
+    const auto key = static_cast<int64>(s) * 9 + iphase * 3 + ophase;
+    const auto it = ids.emplace(key, kNoStateId);
+    if (it.second) {
+      it.first->second = result.AddState();
+      queue.emplace_back(it.first->second, s, iphase, ophase);
+    }
+    return it.first->second;
+  };
+  result.SetStart(find_or_add(start, BEFORE_BOS, BEFORE_BOS));
+  while (!queue.empty()) {
+    StateId state;
+    StateId s;
+    BoundaryPhase iphase;
+    BoundaryPhase ophase;
+    std::tie(state, s, iphase, ophase) = queue.back();
+    queue.pop_back();
+    if (iphase == AFTER_EOS && ophase == AFTER_EOS) {
+      result.SetFinal(state, fst->Final(s));
+    }
+    for (ArcIterator<MutableFst<Arc>> aiter(*fst, s); !aiter.Done();
+         aiter.Next()) {
+      auto arc = aiter.Value();
+      auto next_iphase = iphase;
+      auto next_ophase = ophase;
+      if (!AdvanceBoundaryPhase(labels, &arc.ilabel, &next_iphase) ||
+          !AdvanceBoundaryPhase(labels, &arc.olabel, &next_ophase)) {
+        continue;
+      }
+      arc.nextstate = find_or_add(arc.nextstate, next_iphase, next_ophase);
+      result.AddArc(state, arc);
+    }
+  }
+  Connect(&result);
+  *fst = result;
+}
+
+// Applies the boundary inserter and deleter to the compiled rule, then assigns
+// the global table to the rule. If sigma_star is the closure of an alphabet,
+// which is given, this is done in a single pass by StripBoundaries; otherwise,
+// the rule is composed with the inserter and deleter.
+template <class Arc>
+void ApplyBoundaryFilters(
+    const std::unordered_set<typename Arc::Label> *labels,
+    const Fst<Arc> &inserter, const SymbolTable *syms, MutableFst<Arc> *ofst) {
+  if (labels) {
+    StripBoundaries(*labels, ofst);
+  } else {
+    VectorFst<Arc> filter(inserter);
+    VectorFst<Arc> tfst;
+    ArcSort(&filter, OLabelCompare<Arc>());
+    Compose(filter, *ofst, &tfst);
+    Invert(&filter);  // `filter` is now a deleter.
+    ArcSort(&filter, ILabelCompare<Arc>());
+    Compose(tfst, filter, ofst);
+  }
+  // Reassigns symbol table to output.
+  ofst->SetInputSymbols(syms);
+  ofst->SetOutputSymbols(syms);
+}
+
+// Only sigma_star is mutated during preparation, as boundary arcs are added to
+// it; tau, lambda, and rho are read through views which remove (and if need be
+// relabel for) their symbol tables. Outside of the internal namespace, all
+// four input arguments are immutable const references, and this is called
+// after making a mutable copy of sigma_star.
+//
+// If compact is true, labels of sigma_star which the rule does not mention and
+// which label the same transitions of sigma_star are collapsed into a single
+// label before compilation, and the compiled rule (with boundary filters
+// applied) is then expanded back to the full alphabet; see LabelClasses.
+//
+// If a compiler is provided, it is used to compile the rule, so that filters
+// are reused across calls.
+
+template <class Arc>
+void PyniniCDRewrite(const Fst<Arc> &tau, const Fst<Arc> &lambda,
+                     const Fst<Arc> &rho, MutableFst<Arc> *sigma_star,
+                     MutableFst<Arc> *ofst, CDRewriteDirection cd,
+                     CDRewriteMode cm, bool compact = false,
+                     CDRewriteCompiler<Arc> *compiler = nullptr) {
+  VectorFst<Arc> inserter;
+  std::unique_ptr<SymbolTable> syms;
+  std::unique_ptr<const Fst<Arc>> tau_view;
+  std::unique_ptr<const Fst<Arc>> lambda_view;
+  std::unique_ptr<const Fst<Arc>> rho_view;
+  PrepareSigmaStar(sigma_star, &inserter, &syms);
+  if (!PrepareRule(tau, lambda, rho, &syms, &tau_view, &lambda_view,
+                   &rho_view)) {
+    ofst->SetProperties(kError, kError);
+    return;
+  }
+  // The boundary symbols are kept out of the classes, as the inserter bears
+  // them without a paired arc bearing the representative.
+  std::unique_ptr<LabelClasses<Arc>> classes;
+  if (compact) {
+    classes.reset(new LabelClasses<Arc>(
+        *sigma_star, {tau_view.get(), lambda_view.get(), rho_view.get()},
+        {FLAGS_left_boundary_index, FLAGS_right_boundary_index}));
+    classes->Collapse(sigma_star);
+    classes->Collapse(&inserter);
+  }
   // Actually compiles the rewrite rule.
-  CDRewriteCompile(*tau, *lambda, *rho, *sigma_star, ofst, cd, cm);
-  // Applies boundary filters.
-  VectorFst<Arc> tfst;
+  if (compiler) {
+    compiler->Compile(*tau_view, *lambda_view, *rho_view, *sigma_star, ofst,
+                      cd, cm);
+  } else {
+    CDRewriteCompile(*tau_view, *lambda_view, *rho_view, *sigma_star, ofst, cd,
+                     cm);
+  }
+  std::unordered_set<typename Arc::Label> labels;
+  const bool closure = IsSigmaStarClosure(*sigma_star, &labels);
+  ApplyBoundaryFilters(closure ? &labels : nullptr, inserter, syms.get(),
+                       ofst);
+  if (classes && ofst->Properties(kError, false) != kError) {
+    classes->Expand(ofst);
+  }
+}
+
+// As above, but returns a delayed rule: the compositions of the filter cascade
+// and of the boundary inserter and deleter are all lazy, so only the states
+// reachable on a given input are ever expanded. As the result cannot be
+// mutated, the global table is attached to the input side of the inserter and
+// the output side of the deleter instead. Returns null on failure.
+template <class Arc>
+Fst<Arc> *PyniniCDRewriteDelayed(const Fst<Arc> &tau, const Fst<Arc> &lambda,
+                                 const Fst<Arc> &rho,
+                                 MutableFst<Arc> *sigma_star,
+                                 CDRewriteDirection cd, CDRewriteMode cm) {
+  VectorFst<Arc> inserter;
+  std::unique_ptr<SymbolTable> syms;
+  std::unique_ptr<const Fst<Arc>> tau_view;
+  std::unique_ptr<const Fst<Arc>> lambda_view;
+  std::unique_ptr<const Fst<Arc>> rho_view;
+  PrepareSigmaStar(sigma_star, &inserter, &syms);
+  if (!PrepareRule(tau, lambda, rho, &syms, &tau_view, &lambda_view,
+                   &rho_view)) {
+    return nullptr;
+  }
+  std::unique_ptr<Fst<Arc>> rule(CDRewriteCompileDelayed(
+      *tau_view, *lambda_view, *rho_view, *sigma_star, cd, cm));
+  if (!rule) return nullptr;
+  VectorFst<Arc> deleter(inserter);
+  Invert(&deleter);
   ArcSort(&inserter, OLabelCompare<Arc>());
-  Compose(inserter, *ofst, &tfst);
-  Invert(&inserter);  // `inserter` is now a deleter.
-  ArcSort(&inserter, ILabelCompare<Arc>());
-  Compose(tfst, inserter, ofst);
-  // Reassigns symbol table to output.
-  ofst->SetInputSymbols(syms.get());
-  ofst->SetOutputSymbols(syms.get());
+  ArcSort(&deleter, ILabelCompare<Arc>());
+  inserter.SetInputSymbols(syms.get());
+  deleter.SetOutputSymbols(syms.get());
+  const ComposeFst<Arc> inserted(inserter, *rule);
+  return new ComposeFst<Arc>(inserted, deleter);
 }
 
 }  // namespace internal
 
-// Makes copies of the input arguments then calls interval variant, which
-// requires mutable input arguments.
+// Copies sigma_star, which is mutated, then calls the internal variant.
 template <class Arc>
 void PyniniCDRewrite(const Fst<Arc> &tau, const Fst<Arc> &lambda,
                      const Fst<Arc> &rho, const Fst<Arc> &sigma_star,
                      MutableFst<Arc> *ofst, CDRewriteDirection cd,
-                     CDRewriteMode cm) {
-  VectorFst<Arc> tau_copy(tau);
-  VectorFst<Arc> lambda_copy(lambda);
-  VectorFst<Arc> rho_copy(rho);
+                     CDRewriteMode cm, bool compact = false,
+                     CDRewriteCompiler<Arc> *compiler = nullptr) {
+  VectorFst<Arc> sigma_star_copy(sigma_star);
+  internal::PyniniCDRewrite(tau, lambda, rho, &sigma_star_copy, ofst, cd, cm,
+                            compact, compiler);
+}
+
+template <class Arc>
+Fst<Arc> *PyniniCDRewriteDelayed(const Fst<Arc> &tau, const Fst<Arc> &lambda,
+                                 const Fst<Arc> &rho,
+                                 const Fst<Arc> &sigma_star,
+                                 CDRewriteDirection cd, CDRewriteMode cm) {
   VectorFst<Arc> sigma_star_copy(sigma_star);
-  internal::PyniniCDRewrite(&tau_copy, &lambda_copy, &rho_copy,
-                            &sigma_star_copy, ofst, cd, cm);
+  return internal::PyniniCDRewriteDelayed(tau, lambda, rho, &sigma_star_copy,
+                                          cd, cm);
+}
+
+// Compiles many rules sharing sigma_star, direction, and mode, as if by calling
+// PyniniCDRewrite on each, into the corresponding output FSTs. The preparation
+// of sigma_star and the boundary inserter is done once, and the rules are then
+// compiled on up to the given number of threads (including the calling
+// thread), each taking the next uncompiled rule until none remain. Each worker
+// reads the rule arguments through views of its own, and makes deep copies of
+// the shared sigma_star and inserter, as even reading an FST may update its
+// cached properties. The error bit is set on the output FST of any rule
+// which fails to compile; returns true iff all rules compiled.
+template <class Arc>
+bool PyniniCDRewriteMany(const std::vector<const Fst<Arc> *> &taus,
+                         const std::vector<const Fst<Arc> *> &lambdas,
+                         const std::vector<const Fst<Arc> *> &rhos,
+                         const Fst<Arc> &sigma_star,
+                         const std::vector<MutableFst<Arc> *> &ofsts,
+                         CDRewriteDirection cd, CDRewriteMode cm,
+                         int threads = 1) {
+  VectorFst<Arc> prepared_sigma_star(sigma_star);
+  VectorFst<Arc> prepared_inserter;
+  std::unique_ptr<SymbolTable> syms;
+  internal::PrepareSigmaStar(&prepared_sigma_star, &prepared_inserter, &syms);
+  const Fst<Arc> &shared_sigma_star = prepared_sigma_star;
+  const Fst<Arc> &shared_inserter = prepared_inserter;
+  std::unordered_set<typename Arc::Label> labels;
+  const bool closure = internal::IsSigmaStarClosure(shared_sigma_star, &labels);
+  // Each rule merges its symbols into its own copy of the global table; these
+  // are made up front, as symbol tables share their implementations.
+  std::vector<std::unique_ptr<SymbolTable>> rule_syms(ofsts.size());
+  for (auto &rsyms : rule_syms) rsyms.reset(syms ? syms->Copy() : nullptr);
+  std::atomic<size_t> next(0);
+  const auto work = [&] {
+    for (size_t i = next++; i < ofsts.size(); i = next++) {
+      std::unique_ptr<const Fst<Arc>> tau;
+      std::unique_ptr<const Fst<Arc>> lambda;
+      std::unique_ptr<const Fst<Arc>> rho;
+      if (!internal::PrepareRule(*taus[i], *lambdas[i], *rhos[i],
+                                 &rule_syms[i], &tau, &lambda, &rho)) {
+        ofsts[i]->SetProperties(kError, kError);
+        continue;
+      }
+      VectorFst<Arc> sigma(shared_sigma_star);
+      CDRewriteCompile(*tau, *lambda, *rho, sigma, ofsts[i], cd, cm);
+      if (closure) {
+        internal::ApplyBoundaryFilters(&labels, shared_inserter,
+                                       rule_syms[i].get(), ofsts[i]);
+      } else {
+        const VectorFst<Arc> inserter(shared_inserter);
+        internal::ApplyBoundaryFilters<Arc>(nullptr, inserter,
+                                            rule_syms[i].get(), ofsts[i]);
+      }
+      rule_syms[i].reset();
+    }
+  };
+  const auto nthreads = std::min<size_t>(std::max(threads, 1), ofsts.size());
+  std::vector<std::thread> workers;
+  for (size_t i = 1; i < nthreads; ++i) workers.emplace_back(work);
+  work();
+  for (auto &worker : workers) worker.join();
+  bool success = true;
+  for (const auto *ofst : ofsts) {
+    if (ofst->Properties(kError, false) == kError) success = false;
+  }
+  return success;
 }
 
 // Scripting API wrapper of the above.
@@ -187,7 +490,7 @@ namespace script {
 using PyniniCDRewriteArgs =
     std::tuple<const FstClass &, const FstClass &, const FstClass &,
                const FstClass &, MutableFstClass *, CDRewriteDirection,
-               CDRewriteMode>;
+               CDRewriteMode, bool>;
 
 template <class Arc>
 void PyniniCDRewrite(PyniniCDRewriteArgs *args) {
@@ -197,13 +500,195 @@ void PyniniCDRewrite(PyniniCDRewriteArgs *args) {
   const Fst<Arc> &sigma_star_star = *(std::get<3>(*args).GetFst<Arc>());
   MutableFst<Arc> *ofst = std::get<4>(*args)->GetMutableFst<Arc>();
   PyniniCDRewrite(tau, lambda, rho, sigma_star_star, ofst, std::get<5>(*args),
-                  std::get<6>(*args));
+                  std::get<6>(*args), std::get<7>(*args));
 }
 
 void PyniniCDRewrite(const FstClass &tau, const FstClass &lambda,
                      const FstClass &rho, const FstClass &sigma_star,
                      MutableFstClass *ofst, CDRewriteDirection cd,
-                     CDRewriteMode cm);
+                     CDRewriteMode cm, bool compact = false);
+
+using PyniniCDRewriteDelayedInnerArgs =
+    std::tuple<const FstClass &, const FstClass &, const FstClass &,
+               const FstClass &, CDRewriteDirection, CDRewriteMode>;
+
+using PyniniCDRewriteDelayedArgs =
+    WithReturnValue<FstClass *, PyniniCDRewriteDelayedInnerArgs>;
+
+template <class Arc>
+void PyniniCDRewriteDelayed(PyniniCDRewriteDelayedArgs *args) {
+  const Fst<Arc> &tau = *(std::get<0>(args->args).GetFst<Arc>());
+  const Fst<Arc> &lambda = *(std::get<1>(args->args).GetFst<Arc>());
+  const Fst<Arc> &rho = *(std::get<2>(args->args).GetFst<Arc>());
+  const Fst<Arc> &sigma_star = *(std::get<3>(args->args).GetFst<Arc>());
+  std::unique_ptr<Fst<Arc>> fst(PyniniCDRewriteDelayed(
+      tau, lambda, rho, sigma_star, std::get<4>(args->args),
+      std::get<5>(args->args)));
+  args->retval = fst ? new FstClass(*fst) : nullptr;
+}
+
+// Returns null on failure.
+FstClass *PyniniCDRewriteDelayed(const FstClass &tau, const FstClass &lambda,
+                                 const FstClass &rho,
+                                 const FstClass &sigma_star,
+                                 CDRewriteDirection cd, CDRewriteMode cm);
+
+using PyniniCDRewriteManyInnerArgs =
+    std::tuple<const std::vector<const FstClass *> &,
+               const std::vector<const FstClass *> &,
+               const std::vector<const FstClass *> &, const FstClass &,
+               const std::vector<MutableFstClass *> &, CDRewriteDirection,
+               CDRewriteMode, int>;
+
+using PyniniCDRewriteManyArgs =
+    WithReturnValue<bool, PyniniCDRewriteManyInnerArgs>;
+
+template <class Arc>
+void PyniniCDRewriteMany(PyniniCDRewriteManyArgs *args) {
+  std::vector<const Fst<Arc> *> taus;
+  std::vector<const Fst<Arc> *> lambdas;
+  std::vector<const Fst<Arc> *> rhos;
+  std::vector<MutableFst<Arc> *> ofsts;
+  for (const auto *fst : std::get<0>(args->args)) {
+    taus.push_back(fst->GetFst<Arc>());
+  }
+  for (const auto *fst : std::get<1>(args->args)) {
+    lambdas.push_back(fst->GetFst<Arc>());
+  }
+  for (const auto *fst : std::get<2>(args->args)) {
+    rhos.push_back(fst->GetFst<Arc>());
+  }
+  for (auto *fst : std::get<4>(args->args)) {
+    ofsts.push_back(fst->GetMutableFst<Arc>());
+  }
+  args->retval = PyniniCDRewriteMany(
+      taus, lambdas, rhos, *(std::get<3>(args->args).GetFst<Arc>()), ofsts,
+      std::get<5>(args->args), std::get<6>(args->args),
+      std::get<7>(args->args));
+}
+
+// All FSTs must have the same arc type, and there must be as many of each of
+// taus, lambdas, rhos, and ofsts.
+bool PyniniCDRewriteMany(const std::vector<const FstClass *> &taus,
+                         const std::vector<const FstClass *> &lambdas,
+                         const std::vector<const FstClass *> &rhos,
+                         const FstClass &sigma_star,
+                         const std::vector<MutableFstClass *> &ofsts,
+                         CDRewriteDirection cd, CDRewriteMode cm,
+                         int threads = 1);
+
+// Virtual interface implemented by each concrete CDRewriteCompilerImpl<Arc>.
+class CDRewriteCompilerImplBase {
+ public:
+  virtual void Compile(const FstClass &tau, const FstClass &lambda,
+                       const FstClass &rho, const FstClass &sigma_star,
+                       MutableFstClass *ofst, CDRewriteDirection cd,
+                       CDRewriteMode cm) = 0;
+  virtual size_t Hits() const = 0;
+  virtual size_t Misses() const = 0;
+  virtual size_t Size() const = 0;
+  virtual void Clear() = 0;
+  virtual const std::vector<std::pair<string, double>> &FilterTimes()
+      const = 0;
+  virtual const std::vector<CDRewriteStageStats> &StageStats() const = 0;
+  virtual ~CDRewriteCompilerImplBase() {}
+};
+
+// Templated implementation.
+template <class Arc>
+class CDRewriteCompilerImpl : public CDRewriteCompilerImplBase {
+ public:
+  CDRewriteCompilerImpl(int threads, bool bounded) : impl_(threads, bounded) {}
+
+  void Compile(const FstClass &tau, const FstClass &lambda,
+               const FstClass &rho, const FstClass &sigma_star,
+               MutableFstClass *ofst, CDRewriteDirection cd,
+               CDRewriteMode cm) override {
+    PyniniCDRewrite(*tau.GetFst<Arc>(), *lambda.GetFst<Arc>(),
+                    *rho.GetFst<Arc>(), *sigma_star.GetFst<Arc>(),
+                    ofst->GetMutableFst<Arc>(), cd, cm, false, &impl_);
+  }
+
+  size_t Hits() const override { return impl_.Hits(); }
+
+  size_t Misses() const override { return impl_.Misses(); }
+
+  size_t Size() const override { return impl_.Size(); }
+
+  void Clear() override { impl_.Clear(); }
+
+  const std::vector<std::pair<string, double>> &FilterTimes() const override {
+    return impl_.FilterTimes();
+  }
+
+  const std::vector<CDRewriteStageStats> &StageStats() const override {
+    return impl_.StageStats();
+  }
+
+ private:
+  CDRewriteCompiler<Arc> impl_;
+};
+
+class CDRewriteCompilerClass;
+
+using InitCDRewriteCompilerClassArgs =
+    std::tuple<int, bool, CDRewriteCompilerClass *>;
+
+// Untemplated user-facing class holding templated pimpl. All FSTs passed to
+// Compile must have the compiler's arc type.
+class CDRewriteCompilerClass {
+ public:
+  // Filters are built on up to the given number of threads; if bounded is
+  // true, rules are compiled so as to bound peak memory use.
+  explicit CDRewriteCompilerClass(const string &arc_type, int threads = 1,
+                                  bool bounded = false);
+
+  const string &ArcType() const { return arc_type_; }
+
+  // Indicates whether the arc type is unknown.
+  bool Error() const { return !impl_; }
+
+  void Compile(const FstClass &tau, const FstClass &lambda,
+               const FstClass &rho, const FstClass &sigma_star,
+               MutableFstClass *ofst, CDRewriteDirection cd,
+               CDRewriteMode cm);
+
+  size_t Hits() const { return impl_ ? impl_->Hits() : 0; }
+
+  size_t Misses() const { return impl_ ? impl_->Misses() : 0; }
+
+  size_t Size() const { return impl_ ? impl_->Size() : 0; }
+
+  void Clear() {
+    if (impl_) impl_->Clear();
+  }
+
+  std::vector<std::pair<string, double>> FilterTimes() const {
+    return impl_ ? impl_->FilterTimes()
+                 : std::vector<std::pair<string, double>>();
+  }
+
+  std::vector<CDRewriteStageStats> StageStats() const {
+    return impl_ ? impl_->StageStats() : std::vector<CDRewriteStageStats>();
+  }
+
+  template <class Arc>
+  friend void InitCDRewriteCompilerClass(
+      InitCDRewriteCompilerClassArgs *args);
+
+ private:
+  const string arc_type_;
+  std::unique_ptr<CDRewriteCompilerImplBase> impl_;
+
+  CDRewriteCompilerClass(const CDRewriteCompilerClass &) = delete;
+  CDRewriteCompilerClass &operator=(const CDRewriteCompilerClass &) = delete;
+};
+
+template <class Arc>
+void InitCDRewriteCompilerClass(InitCDRewriteCompilerClassArgs *args) {
+  std::get<2>(*args)->impl_.reset(
+      new CDRewriteCompilerImpl<Arc>(std::get<0>(*args), std::get<1>(*args)));
+}
 
 }  // namespace script
 }  // namespace fst
@@ -20,6 +20,10 @@
 
 // This header defines internal namespace utility functions.
 
+#include <memory>
+#include <unordered_map>
+#include <utility>
+
 #include <fst/fstlib.h>
 #include "merge.h"
 
@@ -62,6 +66,90 @@ void DeleteSymbols(MutableFst<Arc> *fst) {
   fst->SetOutputSymbols(nullptr);
 }
 
+// Arc mapper which removes both symbol tables and relabels according to (the
+// possibly empty) input and output label maps, for use in an ArcMapFst. This
+// does the work of PrepareInputSymbols, PrepareOutputSymbols, and
+// DeleteSymbols without copying or mutating the FST.
+template <class Arc>
+class SymbolsMapper {
+ public:
+  using FromArc = Arc;
+  using ToArc = Arc;
+  using Label = typename Arc::Label;
+  using LabelMap = std::unordered_map<Label, Label>;
+
+  SymbolsMapper(std::shared_ptr<const LabelMap> imap,
+                std::shared_ptr<const LabelMap> omap)
+      : imap_(std::move(imap)), omap_(std::move(omap)) {}
+
+  Arc operator()(const Arc &arc) const {
+    // Superfinal arcs must retain their epsilon labels.
+    if (arc.nextstate == kNoStateId) return arc;
+    return Arc(Find(*imap_, arc.ilabel), Find(*omap_, arc.olabel), arc.weight,
+               arc.nextstate);
+  }
+
+  constexpr MapFinalAction FinalAction() const { return MAP_NO_SUPERFINAL; }
+
+  constexpr MapSymbolsAction InputSymbolsAction() const {
+    return MAP_CLEAR_SYMBOLS;
+  }
+
+  constexpr MapSymbolsAction OutputSymbolsAction() const {
+    return MAP_CLEAR_SYMBOLS;
+  }
+
+  uint64 Properties(uint64 props) const {
+    return imap_->empty() && omap_->empty() ? props : RelabelProperties(props);
+  }
+
+ private:
+  static Label Find(const LabelMap &map, Label label) {
+    const auto it = map.find(label);
+    return it == map.end() ? label : it->second;
+  }
+
+  std::shared_ptr<const LabelMap> imap_;
+  std::shared_ptr<const LabelMap> omap_;
+};
+
+// As PrepareInputSymbols and PrepareOutputSymbols, but rather than relabeling
+// an FST, adds the labels which would be changed to the map.
+template <class Label>
+SymbolTable *PrepareSymbolsMap(SymbolTable *syms, const SymbolTable *fst_syms,
+                               std::unordered_map<Label, Label> *map) {
+  bool relabel = false;
+  std::unique_ptr<SymbolTable> new_syms(
+      MergeSymbols(syms, fst_syms, &relabel));
+  if (!new_syms) {
+    return syms ? syms->Copy() : nullptr;
+  }
+  if (relabel) {
+    for (SymbolTableIterator siter(*fst_syms); !siter.Done(); siter.Next()) {
+      const Label label = new_syms->Find(siter.Symbol());
+      if (label != siter.Value()) (*map)[siter.Value()] = label;
+    }
+  }
+  return new_syms.release();
+}
+
+// Merges the FST's input and output symbols into the table, then returns a
+// delayed view of the FST without symbol tables, relabeled where merging
+// reassigned its symbols. The caller owns the returned FST. As the view has its
+// own properties, it may be read on one thread while other views of the same
+// FST are read on others.
+template <class Arc>
+Fst<Arc> *PrepareSymbolsView(const Fst<Arc> &fst,
+                             std::unique_ptr<SymbolTable> *syms) {
+  using LabelMap = typename SymbolsMapper<Arc>::LabelMap;
+  std::shared_ptr<LabelMap> imap(new LabelMap);
+  std::shared_ptr<LabelMap> omap(new LabelMap);
+  syms->reset(PrepareSymbolsMap(syms->get(), fst.InputSymbols(), imap.get()));
+  syms->reset(PrepareSymbolsMap(syms->get(), fst.OutputSymbols(), omap.get()));
+  return new ArcMapFst<Arc, Arc, SymbolsMapper<Arc>>(
+      fst, SymbolsMapper<Arc>(imap, omap));
+}
+
 }  // namespace internal
 }  // namespace fst
 
@@ -143,6 +143,18 @@ cdef extern from "cdrewrite.h" \
     OBLIGATORY
     OPTIONAL
 
+  cdef cppclass CDRewriteStageStats:
+
+    string name
+
+    size_t states
+
+    size_t arcs
+
+    size_t shrunk_states
+
+    size_t shrunk_arcs
+
 
 cdef extern from "getters.h" \
     namespace "fst::script" nogil:
@@ -157,7 +169,42 @@ cdef extern from "pynini_cdrewrite.h" \
 
   void PyniniCDRewrite(const FstClass &, const FstClass &,
                        const FstClass &, const FstClass &,
-                       MutableFstClass *, CDRewriteDirection, CDRewriteMode)
+                       MutableFstClass *, CDRewriteDirection, CDRewriteMode,
+                       bool)
+
+  FstClass *PyniniCDRewriteDelayed(const FstClass &, const FstClass &,
+                                   const FstClass &, const FstClass &,
+                                   CDRewriteDirection, CDRewriteMode)
+
+  bool PyniniCDRewriteMany(const vector[const FstClass *] &,
+                           const vector[const FstClass *] &,
+                           const vector[const FstClass *] &, const FstClass &,
+                           const vector[MutableFstClass *] &,
+                           CDRewriteDirection, CDRewriteMode, int)
+
+  cdef cppclass CDRewriteCompilerClass:
+
+    CDRewriteCompilerClass(const string &, int, bool)
+
+    const string &ArcType()
+
+    bool Error()
+
+    void Compile(const FstClass &, const FstClass &, const FstClass &,
+                 const FstClass &, MutableFstClass *, CDRewriteDirection,
+                 CDRewriteMode)
+
+    size_t Hits()
+
+    size_t Misses()
+
+    size_t Size()
+
+    void Clear()
+
+    vector[pair[string, double]] FilterTimes()
+
+    vector[CDRewriteStageStats] StageStats()
 
 
 cdef extern from "pynini_replace.h" \
@@ -0,0 +1,203 @@
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Copyright 2017 and onwards Google, Inc.
+//
+// For general information on the Pynini grammar compilation library, see
+// pynini.opengrm.org.
+
+#ifndef PYNINI_RULEAPPLIER_H_
+#define PYNINI_RULEAPPLIER_H_
+
+// Applies a compiled rewrite rule to strings without general composition.
+//
+// Applying a rule by composing a string FST with it and optimizing the result
+// sorts arcs, merges symbol tables, and makes several copies of FSTs, all for
+// what is usually a (nearly) deterministic string transduction. RuleApplier
+// instead flattens the rule, once, into a compressed sparse row layout with
+// each state's arcs sorted by input label, and then walks it directly over
+// the label sequence of each input string, visiting only the pairs of string
+// positions and rule states reachable on that string.
+
+#include <algorithm>
+#include <memory>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <fst/fstlib.h>
+#include "paths.h"
+
+namespace fst {
+
+template <class Arc>
+class RuleApplier {
+ public:
+  using Label = typename Arc::Label;
+  using StateId = typename Arc::StateId;
+  using Weight = typename Arc::Weight;
+
+  explicit RuleApplier(const Fst<Arc> &rule);
+
+  // Builds the lattice of rewrites of the input: an epsilon-free acceptor over
+  // the rule's output labels, equivalent to the output projection of the
+  // composition of the input string with the rule. Returns false if the rule
+  // does not accept the input.
+  bool Lattice(const std::vector<Label> &input,
+               MutableFst<Arc> *lattice) const;
+
+  // Computes up to nshortest unique rewrites of the input, best first, and
+  // (if weights is non-null) their weights. This requires a path semiring.
+  // Returns false if the rule does not accept the input or if the shortest
+  // paths cannot be computed.
+  bool TopRewrites(const std::vector<Label> &input, int32 nshortest,
+                   std::vector<std::vector<Label>> *rewrites,
+                   std::vector<Weight> *weights = nullptr) const;
+
+  const SymbolTable *InputSymbols() const { return isyms_.get(); }
+
+  const SymbolTable *OutputSymbols() const { return osyms_.get(); }
+
+ private:
+  StateId start_;
+  // The arcs leaving state s are arcs_[offsets_[s]] through
+  // arcs_[offsets_[s + 1] - 1], sorted by input label.
+  std::vector<size_t> offsets_;
+  std::vector<Arc> arcs_;
+  std::vector<Weight> finals_;
+  std::unique_ptr<SymbolTable> isyms_;
+  std::unique_ptr<SymbolTable> osyms_;
+};
+
+template <class Arc>
+RuleApplier<Arc>::RuleApplier(const Fst<Arc> &rule)
+    : start_(rule.Start()),
+      isyms_(rule.InputSymbols() ? rule.InputSymbols()->Copy() : nullptr),
+      osyms_(rule.OutputSymbols() ? rule.OutputSymbols()->Copy() : nullptr) {
+  std::vector<std::vector<Arc>> state_arcs;
+  for (StateIterator<Fst<Arc>> siter(rule); !siter.Done(); siter.Next()) {
+    const auto s = siter.Value();
+    if (static_cast<size_t>(s) >= state_arcs.size()) {
+      state_arcs.resize(s + 1);
+      finals_.resize(s + 1, Weight::Zero());
+    }
+    finals_[s] = rule.Final(s);
+    for (ArcIterator<Fst<Arc>> aiter(rule, s); !aiter.Done(); aiter.Next()) {
+      state_arcs[s].push_back(aiter.Value());
+    }
+  }
+  offsets_.reserve(state_arcs.size() + 1);
+  offsets_.push_back(0);
+  for (auto &arcs : state_arcs) {
+    std::stable_sort(arcs.begin(), arcs.end(), ILabelCompare<Arc>());
+    arcs_.insert(arcs_.end(), arcs.begin(), arcs.end());
+    offsets_.push_back(arcs_.size());
+  }
+}
+
+template <class Arc>
+bool RuleApplier<Arc>::Lattice(const std::vector<Label> &input,
+                               MutableFst<Arc> *lattice) const {
+  lattice->DeleteStates();
+  lattice->SetInputSymbols(osyms_.get());
+  lattice->SetOutputSymbols(osyms_.get());
+  if (start_ == kNoStateId) return false;
+  // Each state of the lattice is a pair of a position in the input and a rule
+  // state. Since arcs only ever lead to the same or the next position, only
+  // the states of those two positions need be looked up at once.
+  std::unordered_map<StateId, StateId> ids;
+  std::unordered_map<StateId, StateId> next_ids;
+  std::vector<StateId> agenda;
+  std::vector<StateId> next_agenda;
+  const auto find_or_add = [lattice](
+      StateId q, std::unordered_map<StateId, StateId> *position_ids,
+      std::vector<StateId> *position_agenda) {
+    const auto it = position_ids->emplace(q, kNoStateId);
+    if (it.second) {
+      it.first->second = lattice->AddState();
+      position_agenda->push_back(q);
+    }
+    return it.first->second;
+  };
+  const auto arc_less = [](const Arc &arc, Label label) {
+    return arc.ilabel < label;
+  };
+  const auto label_less = [](Label label, const Arc &arc) {
+    return label < arc.ilabel;
+  };
+  lattice->SetStart(find_or_add(start_, &ids, &agenda));
+  for (size_t i = 0; i <= input.size(); ++i) {
+    while (!agenda.empty()) {
+      const auto q = agenda.back();
+      agenda.pop_back();
+      const auto s = ids[q];
+      auto it = arcs_.begin() + offsets_[q];
+      const auto end = arcs_.begin() + offsets_[q + 1];
+      // Epsilon arcs, which sort first, stay at the current position.
+      for (; it != end && it->ilabel == 0; ++it) {
+        lattice->AddArc(s, Arc(it->olabel, it->olabel, it->weight,
+                               find_or_add(it->nextstate, &ids, &agenda)));
+      }
+      if (i == input.size()) {
+        lattice->SetFinal(s, finals_[q]);
+        continue;
+      }
+      for (it = std::lower_bound(it, end, input[i], arc_less);
+           it != end && !label_less(input[i], *it); ++it) {
+        lattice->AddArc(s,
+                        Arc(it->olabel, it->olabel, it->weight,
+                            find_or_add(it->nextstate, &next_ids,
+                                        &next_agenda)));
+      }
+    }
+    ids.swap(next_ids);
+    next_ids.clear();
+    agenda.swap(next_agenda);
+  }
+  Connect(lattice);
+  RmEpsilon(lattice);
+  return lattice->Start() != kNoStateId;
+}
+
+template <class Arc>
+bool RuleApplier<Arc>::TopRewrites(const std::vector<Label> &input,
+                                   int32 nshortest,
+                                   std::vector<std::vector<Label>> *rewrites,
+                                   std::vector<Weight> *weights) const {
+  rewrites->clear();
+  if (weights) weights->clear();
+  VectorFst<Arc> lattice;
+  if (!Lattice(input, &lattice)) return false;
+  VectorFst<Arc> best;
+  ShortestPath(lattice, &best, nshortest, true);
+  if (best.Properties(kError, false) == kError) return false;
+  std::vector<std::pair<Weight, std::vector<Label>>> paths;
+  for (PathIterator<Arc> piter(best); !piter.Done(); piter.Next()) {
+    paths.emplace_back(piter.Weight(), piter.OLabels());
+  }
+  // Orders the paths by the natural order of their weights.
+  std::stable_sort(paths.begin(), paths.end(),
+                   [](const std::pair<Weight, std::vector<Label>> &x,
+                      const std::pair<Weight, std::vector<Label>> &y) {
+                     return x.first != y.first &&
+                            Plus(x.first, y.first) == x.first;
+                   });
+  for (auto &path : paths) {
+    rewrites->push_back(std::move(path.second));
+    if (weights) weights->push_back(path.first);
+  }
+  return true;
+}
+
+}  // namespace fst
+
+#endif  // PYNINI_RULEAPPLIER_H_
@@ -0,0 +1,52 @@
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Copyright 2017 and onwards Google, Inc.
+//
+// For general information on the Pynini grammar compilation library, see
+// pynini.opengrm.org.
+
+
+#include "ruleapplierscript.h"
+#include <fst/script/fst-class.h>
+#include <fst/script/script-impl.h>
+
+namespace fst {
+namespace script {
+
+RuleApplierClass::RuleApplierClass(const FstClass &rule)
+    : arc_type_(rule.ArcType()) {
+  InitRuleApplierClassArgs args(rule, this);
+  Apply<Operation<InitRuleApplierClassArgs>>("InitRuleApplierClass",
+                                             rule.ArcType(), &args);
+}
+
+bool RuleApplierClass::Lattice(const string &istring, StringTokenType ttype,
+                               const SymbolTable *syms,
+                               MutableFstClass *lattice) const {
+  if (!impl_) return false;
+  if (lattice->ArcType() != arc_type_) {
+    FSTERROR() << "RuleApplierClass::Lattice: Arc type " << lattice->ArcType()
+               << " does not match rule arc type " << arc_type_;
+    lattice->SetProperties(kError, kError);
+    return false;
+  }
+  return impl_->Lattice(istring, ttype, syms, lattice);
+}
+
+REGISTER_FST_OPERATION(InitRuleApplierClass, StdArc, InitRuleApplierClassArgs);
+REGISTER_FST_OPERATION(InitRuleApplierClass, LogArc, InitRuleApplierClassArgs);
+REGISTER_FST_OPERATION(InitRuleApplierClass, Log64Arc,
+                       InitRuleApplierClassArgs);
+
+}  // namespace script
+}  // namespace fst
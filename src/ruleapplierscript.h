@@ -0,0 +1,156 @@
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Copyright 2017 and onwards Google, Inc.
+//
+// For general information on the Pynini grammar compilation library, see
+// pynini.opengrm.org.
+
+#ifndef PYNINI_RULEAPPLIERSCRIPT_H_
+#define PYNINI_RULEAPPLIERSCRIPT_H_
+
+#include <memory>
+#include <vector>
+
+#include <fst/string.h>
+#include <fst/script/arg-packs.h>
+#include <fst/script/fstscript.h>
+#include "ruleapplier.h"
+#include "stringcompile.h"
+#include "stringprint.h"
+
+namespace fst {
+namespace script {
+
+// Virtual interface implemented by each concrete RuleApplierImpl<Arc>.
+class RuleApplierImplBase {
+ public:
+  virtual bool Lattice(const string &istring, StringTokenType ttype,
+                       const SymbolTable *syms,
+                       MutableFstClass *lattice) const = 0;
+  virtual bool TopRewrites(const string &istring, StringTokenType ttype,
+                           const SymbolTable *syms, int32 nshortest,
+                           std::vector<string> *rewrites) const = 0;
+  virtual ~RuleApplierImplBase() {}
+};
+
+// Templated implementation. Input strings are converted to labels as they are
+// by string compilation, and rewrites are printed using the same token type.
+template <class Arc>
+class RuleApplierImpl : public RuleApplierImplBase {
+ public:
+  using Label = typename Arc::Label;
+
+  explicit RuleApplierImpl(const Fst<Arc> &rule) : impl_(rule) {}
+
+  bool Lattice(const string &istring, StringTokenType ttype,
+               const SymbolTable *syms,
+               MutableFstClass *lattice) const override {
+    std::vector<Label> labels;
+    if (!ToLabels(istring, ttype, syms, &labels)) return false;
+    return impl_.Lattice(labels, lattice->GetMutableFst<Arc>());
+  }
+
+  bool TopRewrites(const string &istring, StringTokenType ttype,
+                   const SymbolTable *syms, int32 nshortest,
+                   std::vector<string> *rewrites) const override {
+    rewrites->clear();
+    std::vector<Label> labels;
+    if (!ToLabels(istring, ttype, syms, &labels)) return false;
+    std::vector<std::vector<Label>> typed_rewrites;
+    if (!impl_.TopRewrites(labels, nshortest, &typed_rewrites)) return false;
+    for (auto &rewrite : typed_rewrites) {
+      internal::RemoveEpsilonLabels(&rewrite);
+      string ostring;
+      if (!internal::LabelsToString(rewrite, ttype, &ostring, syms)) {
+        return false;
+      }
+      rewrites->push_back(ostring);
+    }
+    return true;
+  }
+
+ private:
+  // Generated symbols in bracketed spans are looked up in a copy of the rule's
+  // input symbol table, so that they receive the same labels as when the
+  // string is composed with the rule. Symbols the rule lacks are given new
+  // labels, which it then rejects.
+  bool ToLabels(const string &istring, StringTokenType ttype,
+                const SymbolTable *syms, std::vector<Label> *labels) const {
+    if (ttype == SYMBOL) {
+      if (!syms) {
+        LOG(ERROR) << "RuleApplier: Symbol table requested but not provided";
+        return false;
+      }
+      return internal::SymbolStringToLabels(istring, *syms, labels);
+    }
+    std::unique_ptr<SymbolTable> isyms(
+        impl_.InputSymbols() ? impl_.InputSymbols()->Copy()
+                             : internal::GetSymbolTable(ttype, nullptr));
+    return StringToLabels(istring, ttype, labels, isyms.get());
+  }
+
+  const RuleApplier<Arc> impl_;
+};
+
+class RuleApplierClass;
+
+using InitRuleApplierClassArgs =
+    std::tuple<const FstClass &, RuleApplierClass *>;
+
+// Untemplated user-facing class holding templated pimpl. Once constructed, it
+// no longer refers to the rule, and as its methods are const, it may be
+// shared by many threads.
+class RuleApplierClass {
+ public:
+  explicit RuleApplierClass(const FstClass &rule);
+
+  const string &ArcType() const { return arc_type_; }
+
+  // Indicates whether the arc type is unknown.
+  bool Error() const { return !impl_; }
+
+  // Builds the lattice of rewrites of the input string, which must have the
+  // rule's arc type. Returns false if the rule does not accept the input.
+  bool Lattice(const string &istring, StringTokenType ttype,
+               const SymbolTable *syms, MutableFstClass *lattice) const;
+
+  // Computes up to nshortest unique rewrites of the input string, best first.
+  // Returns false if the rule does not accept the input.
+  bool TopRewrites(const string &istring, StringTokenType ttype,
+                   const SymbolTable *syms, int32 nshortest,
+                   std::vector<string> *rewrites) const {
+    return impl_ &&
+           impl_->TopRewrites(istring, ttype, syms, nshortest, rewrites);
+  }
+
+  template <class Arc>
+  friend void InitRuleApplierClass(InitRuleApplierClassArgs *args);
+
+ private:
+  const string arc_type_;
+  std::unique_ptr<RuleApplierImplBase> impl_;
+
+  RuleApplierClass(const RuleApplierClass &) = delete;
+  RuleApplierClass &operator=(const RuleApplierClass &) = delete;
+};
+
+template <class Arc>
+void InitRuleApplierClass(InitRuleApplierClassArgs *args) {
+  const Fst<Arc> &rule = *(std::get<0>(*args).GetFst<Arc>());
+  std::get<1>(*args)->impl_.reset(new RuleApplierImpl<Arc>(rule));
+}
+
+}  // namespace script
+}  // namespace fst
+
+#endif  // PYNINI_RULEAPPLIERSCRIPT_H_
@@ -0,0 +1,338 @@
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Copyright 2017 and onwards Google, Inc.
+//
+// For general information on the Pynini grammar compilation library, see
+// pynini.opengrm.org.
+
+#ifndef PYNINI_SEQUENTIALTRANSDUCER_H_
+#define PYNINI_SEQUENTIALTRANSDUCER_H_
+
+// Executes input-deterministic transducers from dense transition tables.
+//
+// Many compiled rules are input-deterministic, and free of input epsilons,
+// once optimized; applying such a rule to a string is then a simple walk of
+// one transition per input label. SequentialTransducer compiles such an FST
+// into a flat table, with one row per state and one column per distinct input
+// label, holding the destination state, output label, and (if the FST is
+// weighted) weight of each transition. Input labels are mapped to columns by
+// a direct-indexed array for labels in the Basic Multilingual Plane, and by a
+// hash table for any others. Application then takes time linear in the length
+// of the input, with no virtual calls or matchers.
+
+#include <fstream>
+#include <istream>
+#include <memory>
+#include <ostream>
+#include <string>
+using std::string;
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <fst/types.h>
+#include <fst/log.h>
+#include <fst/fstlib.h>
+
+namespace fst {
+
+constexpr int32 kSequentialTransducerMagicNumber = 0x5e9fa11d;
+
+// The default maximum number of cells in a transition table.
+constexpr int64 kSequentialTransducerMaxTableSize = 1LL << 27;
+
+template <class Arc>
+class SequentialTransducer {
+ public:
+  using Label = typename Arc::Label;
+  using StateId = typename Arc::StateId;
+  using Weight = typename Arc::Weight;
+
+  // Compiles the FST, which must be input-deterministic and have no input
+  // epsilons, into a transition table; the table may have at most
+  // max_table_size cells. The error bit is set if the FST cannot be compiled.
+  explicit SequentialTransducer(
+      const Fst<Arc> &fst,
+      int64 max_table_size = kSequentialTransducerMaxTableSize);
+
+  bool Error() const { return error_; }
+
+  StateId NumStates() const { return static_cast<StateId>(finals_.size()); }
+
+  size_t NumColumns() const { return ncolumns_; }
+
+  // Applies the transducer to the input labels in [begin, end), storing the
+  // output labels (without epsilons) and (if weight is non-null) the weight of
+  // the path. Returns false if the input is not accepted.
+  template <class Iterator>
+  bool Apply(Iterator begin, Iterator end, std::vector<Label> *output,
+             Weight *weight = nullptr) const;
+
+  bool Apply(const std::vector<Label> &input, std::vector<Label> *output,
+             Weight *weight = nullptr) const {
+    return Apply(input.begin(), input.end(), output, weight);
+  }
+
+  bool Write(std::ostream &strm, const string &source) const;
+
+  bool Write(const string &source) const;
+
+  // Returns null on failure.
+  static SequentialTransducer *Read(std::istream &strm, const string &source);
+
+  static SequentialTransducer *Read(const string &source);
+
+ private:
+  // Input labels below this are mapped to columns by direct indexing.
+  static constexpr Label kDenseLabels = 0x10000;
+
+  static constexpr int32 kNoColumn = -1;
+
+  SequentialTransducer()
+      : error_(false), start_(kNoStateId), ncolumns_(0), weighted_(false) {}
+
+  // Checks that the states and columns in a table which has been read are all
+  // within its bounds.
+  bool Valid() const;
+
+  int32 Column(Label label) const {
+    if (label >= 0 && static_cast<size_t>(label) < dense_columns_.size()) {
+      return dense_columns_[label];
+    }
+    const auto it = sparse_columns_.find(label);
+    return it == sparse_columns_.end() ? kNoColumn : it->second;
+  }
+
+  bool error_;
+  StateId start_;
+  size_t ncolumns_;
+  // Maps input labels to columns.
+  std::vector<int32> dense_columns_;
+  std::unordered_map<Label, int32> sparse_columns_;
+  // The transition from state s on the input label in column c is stored in
+  // cell s * ncolumns_ + c of each of the following; its destination state is
+  // kNoStateId if there is no such transition.
+  std::vector<StateId> nextstates_;
+  std::vector<Label> olabels_;
+  // Transition weights are only stored if some weight is not One.
+  bool weighted_;
+  std::vector<Weight> weights_;
+  std::vector<Weight> finals_;
+};
+
+template <class Arc>
+constexpr typename Arc::Label SequentialTransducer<Arc>::kDenseLabels;
+
+template <class Arc>
+constexpr int32 SequentialTransducer<Arc>::kNoColumn;
+
+template <class Arc>
+SequentialTransducer<Arc>::SequentialTransducer(const Fst<Arc> &fst,
+                                                int64 max_table_size)
+    : SequentialTransducer() {
+  static constexpr uint64 kProps = kIDeterministic | kNoIEpsilons;
+  if (fst.Properties(kProps, true) != kProps) {
+    FSTERROR() << "SequentialTransducer: FST must be input-deterministic and "
+               << "have no input epsilons";
+    error_ = true;
+    return;
+  }
+  start_ = fst.Start();
+  // Assigns columns to input labels, and collects final weights.
+  for (StateIterator<Fst<Arc>> siter(fst); !siter.Done(); siter.Next()) {
+    const auto s = siter.Value();
+    if (static_cast<size_t>(s) >= finals_.size()) {
+      finals_.resize(s + 1, Weight::Zero());
+    }
+    finals_[s] = fst.Final(s);
+    for (ArcIterator<Fst<Arc>> aiter(fst, s); !aiter.Done(); aiter.Next()) {
+      const auto &arc = aiter.Value();
+      if (arc.weight != Weight::One()) weighted_ = true;
+      if (Column(arc.ilabel) != kNoColumn) continue;
+      if (arc.ilabel < kDenseLabels) {
+        if (static_cast<size_t>(arc.ilabel) >= dense_columns_.size()) {
+          dense_columns_.resize(arc.ilabel + 1, kNoColumn);
+        }
+        dense_columns_[arc.ilabel] = ncolumns_++;
+      } else {
+        sparse_columns_[arc.ilabel] = ncolumns_++;
+      }
+    }
+  }
+  const auto size = static_cast<int64>(finals_.size() * ncolumns_);
+  if (size > max_table_size) {
+    FSTERROR() << "SequentialTransducer: Transition table would have " << size
+               << " cells; at most " << max_table_size << " are allowed";
+    error_ = true;
+    return;
+  }
+  nextstates_.resize(size, kNoStateId);
+  olabels_.resize(size, 0);
+  if (weighted_) weights_.resize(size, Weight::Zero());
+  for (StateIterator<Fst<Arc>> siter(fst); !siter.Done(); siter.Next()) {
+    const auto s = siter.Value();
+    for (ArcIterator<Fst<Arc>> aiter(fst, s); !aiter.Done(); aiter.Next()) {
+      const auto &arc = aiter.Value();
+      const auto cell = s * ncolumns_ + Column(arc.ilabel);
+      nextstates_[cell] = arc.nextstate;
+      olabels_[cell] = arc.olabel;
+      if (weighted_) weights_[cell] = arc.weight;
+    }
+  }
+}
+
+template <class Arc>
+template <class Iterator>
+bool SequentialTransducer<Arc>::Apply(Iterator begin, Iterator end,
+                                      std::vector<Label> *output,
+                                      Weight *weight) const {
+  output->clear();
+  if (error_ || start_ == kNoStateId) return false;
+  auto state = start_;
+  auto path_weight = Weight::One();
+  for (; begin != end; ++begin) {
+    const auto column = Column(*begin);
+    if (column == kNoColumn) return false;
+    const auto cell = state * ncolumns_ + column;
+    state = nextstates_[cell];
+    if (state == kNoStateId) return false;
+    if (olabels_[cell]) output->push_back(olabels_[cell]);
+    if (weighted_) path_weight = Times(path_weight, weights_[cell]);
+  }
+  if (finals_[state] == Weight::Zero()) return false;
+  if (weight) *weight = Times(path_weight, finals_[state]);
+  return true;
+}
+
+template <class Arc>
+bool SequentialTransducer<Arc>::Write(std::ostream &strm,
+                                      const string &source) const {
+  if (error_) {
+    LOG(ERROR) << "SequentialTransducer::Write: Transducer is in an error "
+               << "state: " << source;
+    return false;
+  }
+  WriteType(strm, kSequentialTransducerMagicNumber);
+  WriteType(strm, Arc::Type());
+  WriteType(strm, start_);
+  WriteType(strm, static_cast<uint64>(ncolumns_));
+  WriteType(strm, dense_columns_);
+  const std::vector<std::pair<Label, int32>> sparse_columns(
+      sparse_columns_.begin(), sparse_columns_.end());
+  WriteType(strm, sparse_columns);
+  WriteType(strm, nextstates_);
+  WriteType(strm, olabels_);
+  WriteType(strm, weighted_);
+  if (weighted_) WriteType(strm, weights_);
+  WriteType(strm, finals_);
+  strm.flush();
+  if (!strm) {
+    LOG(ERROR) << "SequentialTransducer::Write: Write failed: " << source;
+    return false;
+  }
+  return true;
+}
+
+template <class Arc>
+bool SequentialTransducer<Arc>::Write(const string &source) const {
+  std::ofstream strm(source, std::ios_base::out | std::ios_base::binary);
+  if (!strm) {
+    LOG(ERROR) << "SequentialTransducer::Write: Can't open file: " << source;
+    return false;
+  }
+  return Write(strm, source);
+}
+
+template <class Arc>
+SequentialTransducer<Arc> *SequentialTransducer<Arc>::Read(
+    std::istream &strm, const string &source) {
+  int32 magic_number = 0;
+  ReadType(strm, &magic_number);
+  if (magic_number != kSequentialTransducerMagicNumber) {
+    LOG(ERROR) << "SequentialTransducer::Read: Bad magic number: " << source;
+    return nullptr;
+  }
+  string arc_type;
+  ReadType(strm, &arc_type);
+  if (arc_type != Arc::Type()) {
+    LOG(ERROR) << "SequentialTransducer::Read: Arc type " << arc_type
+               << " does not match " << Arc::Type() << ": " << source;
+    return nullptr;
+  }
+  std::unique_ptr<SequentialTransducer> transducer(new SequentialTransducer());
+  ReadType(strm, &transducer->start_);
+  uint64 ncolumns = 0;
+  ReadType(strm, &ncolumns);
+  transducer->ncolumns_ = ncolumns;
+  ReadType(strm, &transducer->dense_columns_);
+  std::vector<std::pair<Label, int32>> sparse_columns;
+  ReadType(strm, &sparse_columns);
+  transducer->sparse_columns_.insert(sparse_columns.begin(),
+                                     sparse_columns.end());
+  ReadType(strm, &transducer->nextstates_);
+  ReadType(strm, &transducer->olabels_);
+  ReadType(strm, &transducer->weighted_);
+  if (transducer->weighted_) ReadType(strm, &transducer->weights_);
+  ReadType(strm, &transducer->finals_);
+  const auto size = transducer->finals_.size() * transducer->ncolumns_;
+  if (!strm || (!transducer->finals_.empty() &&
+                size / transducer->finals_.size() != transducer->ncolumns_) ||
+      transducer->nextstates_.size() != size ||
+      transducer->olabels_.size() != size ||
+      (transducer->weighted_ && transducer->weights_.size() != size)) {
+    LOG(ERROR) << "SequentialTransducer::Read: Read failed: " << source;
+    return nullptr;
+  }
+  if (!transducer->Valid()) {
+    LOG(ERROR) << "SequentialTransducer::Read: Table refers to states or "
+               << "columns out of range: " << source;
+    return nullptr;
+  }
+  return transducer.release();
+}
+
+template <class Arc>
+bool SequentialTransducer<Arc>::Valid() const {
+  const auto nstates = NumStates();
+  if (start_ != kNoStateId && (start_ < 0 || start_ >= nstates)) return false;
+  for (const auto nextstate : nextstates_) {
+    if (nextstate != kNoStateId && (nextstate < 0 || nextstate >= nstates)) {
+      return false;
+    }
+  }
+  const auto valid_column = [this](int32 column) {
+    return column >= 0 && static_cast<size_t>(column) < ncolumns_;
+  };
+  for (const auto column : dense_columns_) {
+    if (column != kNoColumn && !valid_column(column)) return false;
+  }
+  for (const auto &pair : sparse_columns_) {
+    if (!valid_column(pair.second)) return false;
+  }
+  return true;
+}
+
+template <class Arc>
+SequentialTransducer<Arc> *SequentialTransducer<Arc>::Read(
+    const string &source) {
+  std::ifstream strm(source, std::ios_base::in | std::ios_base::binary);
+  if (!strm) {
+    LOG(ERROR) << "SequentialTransducer::Read: Can't open file: " << source;
+    return nullptr;
+  }
+  return Read(strm, source);
+}
+
+}  // namespace fst
+
+#endif  // PYNINI_SEQUENTIALTRANSDUCER_H_
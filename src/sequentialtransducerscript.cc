@@ -0,0 +1,79 @@
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Copyright 2017 and onwards Google, Inc.
+//
+// For general information on the Pynini grammar compilation library, see
+// pynini.opengrm.org.
+
+
+#include "sequentialtransducerscript.h"
+
+#include <fstream>
+
+#include <fst/script/fst-class.h>
+#include <fst/script/script-impl.h>
+
+namespace fst {
+namespace script {
+
+SequentialTransducerClass::SequentialTransducerClass(const FstClass &fst,
+                                                     int64 max_table_size)
+    : arc_type_(fst.ArcType()) {
+  InitSequentialTransducerClassArgs args(fst, max_table_size, this);
+  Apply<Operation<InitSequentialTransducerClassArgs>>(
+      "InitSequentialTransducerClass", fst.ArcType(), &args);
+}
+
+// Reads the arc type from the header, then rewinds and dispatches on it.
+SequentialTransducerClass *SequentialTransducerClass::Read(
+    const string &source) {
+  std::ifstream strm(source, std::ios_base::in | std::ios_base::binary);
+  if (!strm) {
+    LOG(ERROR) << "SequentialTransducerClass::Read: Can't open file: "
+               << source;
+    return nullptr;
+  }
+  int32 magic_number = 0;
+  ReadType(strm, &magic_number);
+  if (magic_number != kSequentialTransducerMagicNumber) {
+    LOG(ERROR) << "SequentialTransducerClass::Read: Bad magic number: "
+               << source;
+    return nullptr;
+  }
+  string arc_type;
+  ReadType(strm, &arc_type);
+  strm.seekg(0);
+  std::unique_ptr<SequentialTransducerClass> transducer(
+      new SequentialTransducerClass(arc_type));
+  ReadSequentialTransducerClassArgs args(strm, source, transducer.get());
+  Apply<Operation<ReadSequentialTransducerClassArgs>>(
+      "ReadSequentialTransducerClass", arc_type, &args);
+  return transducer->impl_ ? transducer.release() : nullptr;
+}
+
+REGISTER_FST_OPERATION(InitSequentialTransducerClass, StdArc,
+                       InitSequentialTransducerClassArgs);
+REGISTER_FST_OPERATION(InitSequentialTransducerClass, LogArc,
+                       InitSequentialTransducerClassArgs);
+REGISTER_FST_OPERATION(InitSequentialTransducerClass, Log64Arc,
+                       InitSequentialTransducerClassArgs);
+
+REGISTER_FST_OPERATION(ReadSequentialTransducerClass, StdArc,
+                       ReadSequentialTransducerClassArgs);
+REGISTER_FST_OPERATION(ReadSequentialTransducerClass, LogArc,
+                       ReadSequentialTransducerClassArgs);
+REGISTER_FST_OPERATION(ReadSequentialTransducerClass, Log64Arc,
+                       ReadSequentialTransducerClassArgs);
+
+}  // namespace script
+}  // namespace fst
@@ -0,0 +1,181 @@
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Copyright 2017 and onwards Google, Inc.
+//
+// For general information on the Pynini grammar compilation library, see
+// pynini.opengrm.org.
+
+#ifndef PYNINI_SEQUENTIALTRANSDUCERSCRIPT_H_
+#define PYNINI_SEQUENTIALTRANSDUCERSCRIPT_H_
+
+#include <istream>
+#include <memory>
+#include <vector>
+
+#include <fst/string.h>
+#include <fst/script/arg-packs.h>
+#include <fst/script/fstscript.h>
+#include "sequentialtransducer.h"
+#include "stringprint.h"
+#include "utf8.h"
+
+namespace fst {
+namespace script {
+
+// Virtual interface implemented by each concrete SequentialTransducerImpl<Arc>.
+class SequentialTransducerImplBase {
+ public:
+  virtual bool Error() const = 0;
+  virtual int64 NumStates() const = 0;
+  virtual size_t NumColumns() const = 0;
+  virtual bool Apply(const string &istring, StringTokenType ttype,
+                     string *ostring) const = 0;
+  virtual bool Write(const string &source) const = 0;
+  virtual ~SequentialTransducerImplBase() {}
+};
+
+// Templated implementation. Input strings are read as raw bytes or UTF-8
+// code points (without the bracketed-span syntax of string compilation), and
+// output strings are printed using the same token type.
+template <class Arc>
+class SequentialTransducerImpl : public SequentialTransducerImplBase {
+ public:
+  using Label = typename Arc::Label;
+
+  // Takes ownership of the transducer.
+  explicit SequentialTransducerImpl(SequentialTransducer<Arc> *impl)
+      : impl_(impl) {}
+
+  bool Error() const override { return impl_->Error(); }
+
+  int64 NumStates() const override { return impl_->NumStates(); }
+
+  size_t NumColumns() const override { return impl_->NumColumns(); }
+
+  bool Apply(const string &istring, StringTokenType ttype,
+             string *ostring) const override {
+    std::vector<Label> output;
+    switch (ttype) {
+      case BYTE: {
+        const auto *begin =
+            reinterpret_cast<const unsigned char *>(istring.data());
+        if (!impl_->Apply(begin, begin + istring.size(), &output)) {
+          return false;
+        }
+        break;
+      }
+      case UTF8: {
+        std::vector<Label> input;
+        if (!internal::UTF8ToLabels(istring, &input) ||
+            !impl_->Apply(input, &output)) {
+          return false;
+        }
+        break;
+      }
+      case SYMBOL: {
+        LOG(ERROR) << "SequentialTransducer::Apply: Symbol token type is not "
+                   << "supported";
+        return false;
+      }
+    }
+    return internal::LabelsToString(output, ttype, ostring);
+  }
+
+  bool Write(const string &source) const override {
+    return impl_->Write(source);
+  }
+
+ private:
+  std::unique_ptr<const SequentialTransducer<Arc>> impl_;
+};
+
+class SequentialTransducerClass;
+
+using InitSequentialTransducerClassArgs =
+    std::tuple<const FstClass &, int64, SequentialTransducerClass *>;
+
+using ReadSequentialTransducerClassArgs =
+    std::tuple<std::istream &, const string &, SequentialTransducerClass *>;
+
+// Untemplated user-facing class holding templated pimpl.
+class SequentialTransducerClass {
+ public:
+  // Compiles an input-deterministic FST without input epsilons; see
+  // SequentialTransducer.
+  explicit SequentialTransducerClass(
+      const FstClass &fst,
+      int64 max_table_size = kSequentialTransducerMaxTableSize);
+
+  // Returns null on failure.
+  static SequentialTransducerClass *Read(const string &source);
+
+  const string &ArcType() const { return arc_type_; }
+
+  bool Error() const { return !impl_ || impl_->Error(); }
+
+  int64 NumStates() const { return impl_ ? impl_->NumStates() : 0; }
+
+  size_t NumColumns() const { return impl_ ? impl_->NumColumns() : 0; }
+
+  // Applies the transducer to the input string, whose token type must be BYTE
+  // or UTF8. Returns false if the input is not accepted.
+  bool Apply(const string &istring, StringTokenType ttype,
+             string *ostring) const {
+    return !Error() && impl_->Apply(istring, ttype, ostring);
+  }
+
+  bool Write(const string &source) const {
+    return !Error() && impl_->Write(source);
+  }
+
+  template <class Arc>
+  friend void InitSequentialTransducerClass(
+      InitSequentialTransducerClassArgs *args);
+
+  template <class Arc>
+  friend void ReadSequentialTransducerClass(
+      ReadSequentialTransducerClassArgs *args);
+
+ private:
+  explicit SequentialTransducerClass(const string &arc_type)
+      : arc_type_(arc_type) {}
+
+  const string arc_type_;
+  std::unique_ptr<SequentialTransducerImplBase> impl_;
+
+  SequentialTransducerClass(const SequentialTransducerClass &) = delete;
+  SequentialTransducerClass &operator=(const SequentialTransducerClass &) =
+      delete;
+};
+
+template <class Arc>
+void InitSequentialTransducerClass(InitSequentialTransducerClassArgs *args) {
+  const Fst<Arc> &fst = *(std::get<0>(*args).GetFst<Arc>());
+  std::get<2>(*args)->impl_.reset(new SequentialTransducerImpl<Arc>(
+      new SequentialTransducer<Arc>(fst, std::get<1>(*args))));
+}
+
+// Leaves the implementation unset on failure.
+template <class Arc>
+void ReadSequentialTransducerClass(ReadSequentialTransducerClassArgs *args) {
+  auto *impl = SequentialTransducer<Arc>::Read(std::get<0>(*args),
+                                               std::get<1>(*args));
+  if (impl) {
+    std::get<2>(*args)->impl_.reset(new SequentialTransducerImpl<Arc>(impl));
+  }
+}
+
+}  // namespace script
+}  // namespace fst
+
+#endif  // PYNINI_SEQUENTIALTRANSDUCERSCRIPT_H_
@@ -17,6 +17,8 @@
 
 #include "stringcompile.h"
 
+#include <algorithm>
+
 // This file contains implementations of untemplated internal functions for
 // string compilation. Not all are declared in the corresponding header.
 
@@ -222,7 +224,11 @@ int32 AddUnicodeCodepointToSymbolTable(int32 label, SymbolTable *syms) {
   string label_string;
   // Creates a vector with just this label.
   std::vector<int32> labels = {label};
-  if (LabelsToUTF8String(labels, &label_string)) {
+  if (LabelsToUTF8(labels, &label_string)) {
+    // Adding a symbol forks a table whose p-impl is shared, even if the symbol
+    // is already present, so existing symbols are looked up instead.
+    const auto key = syms->Find(label_string);
+    if (key != kNoSymbol) return static_cast<int32>(key);
     return static_cast<int32>(syms->AddSymbol(label_string, label));
   } else {
     LOG(ERROR) << "Unable to parse Unicode codepoint";
@@ -230,12 +236,191 @@ int32 AddUnicodeCodepointToSymbolTable(int32 label, SymbolTable *syms) {
   }
 }
 
+namespace {
+
+// The table shared by all UnicodeSymbolTables, which is never mutated.
+const SymbolTable &SharedUTF8SymbolTable() {
+  static const auto *const kSyms = GetUTF8SymbolTable();
+  return *kSyms;
+}
+
+string CodepointSymbol(int32 label) {
+  string symbol;
+  LabelsToUTF8(std::vector<int32>{label}, &symbol);
+  return symbol;
+}
+
+// Returns the code point of which the symbol is the UTF-8 encoding, or
+// kNoSymbol if it is not the encoding of a single code point. Unlike
+// UTF8ToLabels, this does not log an error for invalid UTF-8.
+int64 CodepointOf(const string &symbol) {
+  if (symbol.empty()) return kNoSymbol;
+  const int c = symbol[0] & 0xff;
+  const int count = (c >= 0xc0) + (c >= 0xe0) + (c >= 0xf0) + (c >= 0xf8) +
+                    (c >= 0xfc);
+  if (symbol.size() != static_cast<size_t>(count) + 1) return kNoSymbol;
+  int32 code = count ? c & ((1 << (6 - count)) - 1) : c;
+  for (int i = 1; i <= count; ++i) code = (code << 6) | (symbol[i] & 0x3f);
+  // Round-tripping rejects malformed and overlong sequences.
+  return CodepointSymbol(code) == symbol ? code : kNoSymbol;
+}
+
+}  // namespace
+
+UnicodeSymbolTable::UnicodeSymbolTable()
+    : SymbolTable(SharedUTF8SymbolTable()),
+      codepoints_(std::make_shared<Codepoints>()) {}
+
+UnicodeSymbolTable::UnicodeSymbolTable(const UnicodeSymbolTable &syms)
+    : SymbolTable(syms), codepoints_(syms.codepoints_) {}
+
+SymbolTable *UnicodeSymbolTable::Copy() const {
+  if (table_) return table_->Copy();
+  return new UnicodeSymbolTable(*this);
+}
+
+int64 UnicodeSymbolTable::AddSymbol(const string &symbol, int64 key) {
+  if (table_) return table_->AddSymbol(symbol, key);
+  if (key == kNoSymbol) return key;
+  // As in an ordinary table, a symbol already present keeps its key.
+  const auto found = Find(symbol);
+  if (found != kNoSymbol) return found;
+  if (key != CodepointOf(symbol)) return MutableTable()->AddSymbol(symbol, key);
+  // The list is shared with copies, or has been rendered into a table.
+  if (codepoints_.use_count() > 1 || codepoints_->plain) {
+    std::shared_ptr<Codepoints> codepoints(std::make_shared<Codepoints>());
+    codepoints->labels = codepoints_->labels;
+    codepoints_ = codepoints;
+  }
+  codepoints_->labels.push_back(key);
+  return key;
+}
+
+int64 UnicodeSymbolTable::AddSymbol(const string &symbol) {
+  if (table_) return table_->AddSymbol(symbol);
+  const auto found = Find(symbol);
+  if (found != kNoSymbol) return found;
+  return MutableTable()->AddSymbol(symbol);
+}
+
+void UnicodeSymbolTable::AddTable(const SymbolTable &table) {
+  MutableTable()->AddTable(table);
+}
+
+void UnicodeSymbolTable::RemoveSymbol(int64 key) {
+  MutableTable()->RemoveSymbol(key);
+}
+
+const string &UnicodeSymbolTable::Name() const {
+  return table_ ? table_->Name() : SymbolTable::Name();
+}
+
+void UnicodeSymbolTable::SetName(const string &new_name) {
+  MutableTable()->SetName(new_name);
+}
+
+string UnicodeSymbolTable::CheckSum() const { return Plain().CheckSum(); }
+
+string UnicodeSymbolTable::LabeledCheckSum() const {
+  return Plain().LabeledCheckSum();
+}
+
+bool UnicodeSymbolTable::Write(std::ostream &strm) const {
+  return Plain().Write(strm);
+}
+
+bool UnicodeSymbolTable::WriteText(std::ostream &strm,
+                                   const SymbolTableTextOptions &opts) const {
+  return Plain().WriteText(strm, opts);
+}
+
+string UnicodeSymbolTable::Find(int64 key) const {
+  if (table_) return table_->Find(key);
+  const auto symbol = SymbolTable::Find(key);
+  if (symbol.empty() && HasCodepoint(key)) return CodepointSymbol(key);
+  return symbol;
+}
+
+int64 UnicodeSymbolTable::Find(const string &symbol) const {
+  if (table_) return table_->Find(symbol);
+  const auto key = SymbolTable::Find(symbol);
+  if (key != kNoSymbol) return key;
+  const auto label = CodepointOf(symbol);
+  return label != kNoSymbol && HasCodepoint(label) ? label : kNoSymbol;
+}
+
+int64 UnicodeSymbolTable::Find(const char *symbol) const {
+  return Find(string(symbol));
+}
+
+bool UnicodeSymbolTable::Member(int64 key) const {
+  if (table_) return table_->Member(key);
+  return SymbolTable::Member(key) || HasCodepoint(key);
+}
+
+bool UnicodeSymbolTable::Member(const string &symbol) const {
+  return Find(symbol) != kNoSymbol;
+}
+
+int64 UnicodeSymbolTable::AvailableKey() const {
+  if (table_) return table_->AvailableKey();
+  auto key = SymbolTable::AvailableKey();
+  for (const auto label : codepoints_->labels) {
+    key = std::max<int64>(key, label + 1);
+  }
+  return key;
+}
+
+size_t UnicodeSymbolTable::NumSymbols() const {
+  if (table_) return table_->NumSymbols();
+  return SymbolTable::NumSymbols() + codepoints_->labels.size();
+}
+
+int64 UnicodeSymbolTable::GetNthKey(ssize_t pos) const {
+  if (table_) return table_->GetNthKey(pos);
+  const ssize_t size = SymbolTable::NumSymbols();
+  if (pos < size) return SymbolTable::GetNthKey(pos);
+  const auto &labels = codepoints_->labels;
+  return pos - size < static_cast<ssize_t>(labels.size()) ? labels[pos - size]
+                                                         : kNoSymbol;
+}
+
+const SymbolTable &UnicodeSymbolTable::Plain() const {
+  if (table_) return *table_;
+  auto *codepoints = codepoints_.get();
+  std::call_once(codepoints->plain_once, [codepoints]() {
+    codepoints->plain.reset(SharedUTF8SymbolTable().Copy());
+    for (const auto label : codepoints->labels) {
+      codepoints->plain->AddSymbol(CodepointSymbol(label), label);
+    }
+  });
+  return *codepoints->plain;
+}
+
+// Code points are seldom many per string, so the list is searched linearly.
+bool UnicodeSymbolTable::HasCodepoint(int64 key) const {
+  const auto &labels = codepoints_->labels;
+  return std::find(labels.begin(), labels.end(), key) != labels.end();
+}
+
+SymbolTable *UnicodeSymbolTable::MutableTable() {
+  if (!table_) table_.reset(Plain().Copy());
+  return table_.get();
+}
+
+const SymbolTable &PlainSymbolTable(const SymbolTable &syms) {
+  const auto *unicode_syms = dynamic_cast<const UnicodeSymbolTable *>(&syms);
+  return unicode_syms ? unicode_syms->Plain() : syms;
+}
+
 // Removes backslashes acting as bracket escape characters (e.g. "\[").
-void RemoveBracketEscapes(string *str) {
-  static const RE2 left_bracket_escape(kEscapedLeftBracket);
-  RE2::GlobalReplace(str, left_bracket_escape, R"([)");
-  static const RE2 right_bracket_escape(kEscapedRightBracket);
-  RE2::GlobalReplace(str, right_bracket_escape, R"(])");
+void RemoveBracketEscapes(re2::StringPiece span, string *result) {
+  result->clear();
+  result->reserve(span.size());
+  ForEachUnescapedSubspan(span, [result](const char *begin, const char *end) {
+    result->append(begin, end - begin);
+    return true;
+  });
 }
 
 }  // namespace internal
@@ -18,18 +18,28 @@
 #ifndef PYNINI_STRINGCOMPILE_H_
 #define PYNINI_STRINGCOMPILE_H_
 
+#include <cstring>
 #include <limits>
 #include <memory>
+#include <mutex>
 #include <string>
 using std::string;
+#include <vector>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include <fst/types.h>
 #include <cstdlib>
 #include <fst/fst-decl.h>
+#include <fst/compact-fst.h>
 #include <fst/string.h>
+#include <fst/vector-fst.h>
+#include <fst/extensions/far/far.h>
 #include "gtl.h"
+#include "utf8.h"
 #include <re2/stringpiece.h>
-#include <re2/re2.h>
 
 // The user-facing functions in this class behave similar to the StringCompiler
 // class, but add several additional functionalities.
@@ -83,12 +93,6 @@ constexpr uint64 kCompiledStringProps = kAcceptor | kIDeterministic |
     kInitialAcyclic | kTopSorted | kAccessible | kCoAccessible | kString |
     kUnweightedCycles;
 
-constexpr char kPieces[] = R"(((?:(?:\\[\[\]])|(?:[^\[\]]))+)|)"
-                           R"((?:\[((?:(?:\\[\[\]])|(?:[^\[\]]))+)\])|)"
-                           R"((.+))";
-constexpr char kEscapedLeftBracket[] = R"(\\\[)";
-constexpr char kEscapedRightBracket[] = R"(\\\])";
-
 // Helpers for creating a symbol table.
 class SymbolTableFactory {
  public:
@@ -106,6 +110,90 @@ class SymbolTableFactory {
   SymbolTableFactory &operator=(const SymbolTableFactory &) = delete;
 };
 
+// UTF-8 symbol table used for compiled UTF-8 strings. It shares the immutable
+// table returned by GetUTF8SymbolTable and keeps the code points added to it in
+// a list, rendering their symbols only when they are looked up, so compiling a
+// string neither copies the shared table nor hashes the string's code points.
+// Adding any other symbol (e.g., one generated for a bracketed span) copies the
+// shared table, after which this acts as an ordinary table. Either way, it has
+// the same symbols, in the same order, as the table returned by
+// GetUTF8SymbolTable would after the same additions, so checksums and
+// serialized tables are unchanged. Copies share the list until one of them
+// adds to it; like any other symbol table, it may be read by many threads.
+class UnicodeSymbolTable : public SymbolTable {
+ public:
+  UnicodeSymbolTable();
+
+  SymbolTable *Copy() const override;
+
+  int64 AddSymbol(const string &symbol, int64 key) override;
+
+  int64 AddSymbol(const string &symbol) override;
+
+  void AddTable(const SymbolTable &table) override;
+
+  void RemoveSymbol(int64 key) override;
+
+  const string &Name() const override;
+
+  void SetName(const string &new_name) override;
+
+  string CheckSum() const override;
+
+  string LabeledCheckSum() const override;
+
+  bool Write(std::ostream &strm) const override;
+
+  bool WriteText(std::ostream &strm,
+                 const SymbolTableTextOptions &opts =
+                     SymbolTableTextOptions()) const override;
+
+  string Find(int64 key) const override;
+
+  int64 Find(const string &symbol) const override;
+
+  int64 Find(const char *symbol) const override;
+
+  bool Member(int64 key) const override;
+
+  bool Member(const string &symbol) const override;
+
+  int64 AvailableKey() const override;
+
+  size_t NumSymbols() const override;
+
+  int64 GetNthKey(ssize_t pos) const override;
+
+  // Returns an ordinary symbol table with the same symbols as this one.
+  const SymbolTable &Plain() const;
+
+ private:
+  // Code points added to the shared table, and, once it is first needed, the
+  // ordinary table holding the shared table's symbols and theirs.
+  struct Codepoints {
+    std::vector<int32> labels;
+    std::once_flag plain_once;
+    std::unique_ptr<SymbolTable> plain;
+  };
+
+  UnicodeSymbolTable(const UnicodeSymbolTable &syms);
+
+  bool HasCodepoint(int64 key) const;
+
+  // Returns the ordinary table this acts as from now on, copying it first.
+  SymbolTable *MutableTable();
+
+  std::shared_ptr<Codepoints> codepoints_;
+  // Null until a symbol other than a code point is added.
+  std::unique_ptr<SymbolTable> table_;
+
+  UnicodeSymbolTable &operator=(const UnicodeSymbolTable &) = delete;
+};
+
+// Returns an ordinary symbol table with the same symbols as syms: syms itself,
+// unless it is a UnicodeSymbolTable.
+const SymbolTable &PlainSymbolTable(const SymbolTable &syms);
+
 SymbolTable *GetSymbolTable(StringTokenType ttype, const SymbolTable *syms);
 
 // Adds an integer to the symbol table.
@@ -120,35 +208,153 @@ inline int64 AddGeneratedToSymbolTable(const string &str, SymbolTable *syms) {
   return syms->AddSymbol(str);
 }
 
-// Populates a string FST using a vector of labels.
-template <class Arc>
-void CompileStringFromLabels(const std::vector<typename Arc::Label> &labels,
+// Populates a string FST using a range of labels.
+template <class Arc, class Iterator>
+void CompileStringFromLabels(Iterator begin, Iterator end,
                              const typename Arc::Weight &weight,
                              MutableFst<Arc> *fst) {
   using StateId = typename Arc::StateId;
   using Weight = typename Arc::Weight;
   fst->DeleteStates();
-  const StateId size = labels.size();
-  fst->ReserveStates(size);
-  for (StateId i = 0; i < size; ++i) {
+  const StateId size = end - begin;
+  fst->ReserveStates(size + 1);
+  for (StateId i = 0; i < size; ++i, ++begin) {
     fst->AddState();
-    fst->AddArc(i, Arc(labels[i], labels[i], Weight::One(), i + 1));
+    fst->AddArc(i, Arc(*begin, *begin, Weight::One(), i + 1));
   }
   fst->SetStart(0);
   fst->SetFinal(fst->AddState(), weight);
   fst->SetProperties(kCompiledStringProps, kCompiledStringProps);
 }
 
-// Removes backslashes acting as bracket escape characters (e.g. "\[").
-void RemoveBracketEscapes(string *str);
+// Populates a string FST using a vector of labels.
+template <class Arc>
+void CompileStringFromLabels(const std::vector<typename Arc::Label> &labels,
+                             const typename Arc::Weight &weight,
+                             MutableFst<Arc> *fst) {
+  CompileStringFromLabels(labels.begin(), labels.end(), weight, fst);
+}
+
+// Returns a pointer to the first '[', ']', or '\' in [begin, end), or end if
+// there is none.
+inline const char *FindBracketOrEscape(const char *begin, const char *end) {
+#ifdef __SSE2__
+  const auto left = _mm_set1_epi8('[');
+  const auto right = _mm_set1_epi8(']');
+  const auto escape = _mm_set1_epi8('\\');
+  for (; end - begin >= 16; begin += 16) {
+    const auto chunk =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(begin));
+    const auto matches = _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(chunk, left),
+                     _mm_cmpeq_epi8(chunk, right)),
+        _mm_cmpeq_epi8(chunk, escape));
+    const int mask = _mm_movemask_epi8(matches);
+    if (mask) return begin + __builtin_ctz(mask);
+  }
+#endif
+  for (; begin < end; ++begin) {
+    if (*begin == '[' || *begin == ']' || *begin == '\\') return begin;
+  }
+  return end;
+}
+
+// Is the character at p, which must precede end, a backslash escaping a
+// bracket?
+inline bool IsBracketEscape(const char *p, const char *end) {
+  return *p == '\\' && p + 1 < end && (p[1] == '[' || p[1] == ']');
+}
+
+// Splits a (possibly) bracketed string into unbracketed spans and bracketed
+// spans, in a single pass and without copying. The pieces are exactly those
+// consumed, one at a time, by the regular expression
+//
+//   ((?:\\[\[\]]|[^\[\]])+)|\[((?:\\[\[\]]|[^\[\]])+)\]|(.+)
+//
+// with the first group giving an unbracketed span, the second the contents of
+// a bracketed span, and the third indicating unbalanced brackets. In
+// particular, a bracketed span which is not closed by an unescaped ']' is
+// closed by its last "\]", the backslash then being part of the span.
+class BracketedStringScanner {
+ public:
+  enum PieceType { UNBRACKETED, BRACKETED, UNBALANCED };
+
+  explicit BracketedStringScanner(re2::StringPiece str)
+      : pos_(str.data()), end_(str.data() + str.size()) {}
+
+  bool Done() const { return pos_ == end_; }
+
+  // Consumes the next piece, setting `piece` to the unbracketed span or the
+  // contents of the bracketed span, with bracket escapes still in place. Once
+  // UNBALANCED is returned, the scanner should no longer be used.
+  PieceType Next(re2::StringPiece *piece) {
+    const char *const begin = pos_;
+    if (*begin == ']') return UNBALANCED;
+    if (*begin != '[') {
+      auto *p = begin;
+      while ((p = FindBracketOrEscape(p, end_)) != end_ && *p == '\\') {
+        p += IsBracketEscape(p, end_) ? 2 : 1;
+      }
+      piece->set(begin, p - begin);
+      pos_ = p;
+      return UNBRACKETED;
+    }
+    // Position of the last escaped ']' in the span, if any.
+    const char *last = nullptr;
+    auto *p = begin + 1;
+    while ((p = FindBracketOrEscape(p, end_)) != end_ && *p == '\\') {
+      if (IsBracketEscape(p, end_)) {
+        if (p[1] == ']') last = p;
+        p += 2;
+      } else {
+        ++p;
+      }
+    }
+    if (p != end_ && *p == ']' && p > begin + 1) {
+      piece->set(begin + 1, p - begin - 1);
+      pos_ = p + 1;
+      return BRACKETED;
+    }
+    if (last) {
+      piece->set(begin + 1, last - begin);
+      pos_ = last + 2;
+      return BRACKETED;
+    }
+    return UNBALANCED;
+  }
+
+ private:
+  const char *pos_;
+  const char *const end_;
+};
+
+// Calls `fn` on each of the subspans of a span which lie between bracket
+// escapes, so that the escaping backslashes are skipped; e.g., "a\[b" yields
+// "a" and "[b". Stops, returning false, if `fn` does.
+template <class F>
+bool ForEachUnescapedSubspan(re2::StringPiece span, F fn) {
+  const char *begin = span.data();
+  const char *const end = begin + span.size();
+  for (auto *p = begin; (p = FindBracketOrEscape(p, end)) != end; ++p) {
+    if (!IsBracketEscape(p, end)) continue;
+    if (!fn(begin, p)) return false;
+    begin = ++p;
+  }
+  return fn(begin, end);
+}
+
+// Removes backslashes acting as bracket escape characters (e.g. "\["),
+// writing the result to `result`.
+void RemoveBracketEscapes(re2::StringPiece span, string *result);
 
 // Processes the labels within a bracketed span.
 template <class Label>
-bool ProcessBracketedSpan(string *str, std::vector<Label> *labels,
+bool ProcessBracketedSpan(re2::StringPiece span, std::vector<Label> *labels,
                           SymbolTable *syms) {
-  RemoveBracketEscapes(str);
+  string str;
+  RemoveBracketEscapes(span, &str);
   // Splits string on the token separator.
-  const std::vector<string> tokens = strings::Split(*str, kTokenSeparator);
+  const std::vector<string> tokens = strings::Split(str, kTokenSeparator);
   // The span may not be empty, so that is not considered here.
   if (tokens.size() == 1) {
     const auto cpptoken = tokens[0];
@@ -181,26 +387,31 @@ bool ProcessBracketedSpan(string *str, std::vector<Label> *labels,
 // Creates a vector of labels from a bracketed bytestring, updating the symbol
 // table as it goes.
 template <class Label>
-bool BracketedByteStringToLabels(const string &strp,
+bool BracketedByteStringToLabels(re2::StringPiece strp,
                                  std::vector<Label> *labels,
                                  SymbolTable *syms) {
-  static const RE2 pieces(kPieces);
-  re2::StringPiece view(strp);
-  string unbracketed;
-  string bracketed;
-  string error;
-  while (RE2::Consume(&view, pieces, &unbracketed, &bracketed, &error)) {
-    if (!error.empty()) {
-      LOG(ERROR) << "BracketedByteStringToLabels: Unbalanced brackets";
-      return false;
-    } else if (!unbracketed.empty()) {
-      RemoveBracketEscapes(&unbracketed);
-      for (const auto label : unbracketed) {
-        labels->push_back(static_cast<Label>(label));
+  BracketedStringScanner scanner(strp);
+  re2::StringPiece piece;
+  while (!scanner.Done()) {
+    switch (scanner.Next(&piece)) {
+      case BracketedStringScanner::UNBRACKETED: {
+        ForEachUnescapedSubspan(piece, [labels](const char *begin,
+                                                const char *end) {
+          for (; begin < end; ++begin) {
+            labels->push_back(static_cast<Label>(*begin));
+          }
+          return true;
+        });
+        break;
+      }
+      case BracketedStringScanner::BRACKETED: {
+        if (!ProcessBracketedSpan<Label>(piece, labels, syms)) return false;
+        break;
+      }
+      case BracketedStringScanner::UNBALANCED: {
+        LOG(ERROR) << "BracketedByteStringToLabels: Unbalanced brackets";
+        return false;
       }
-    } else if (!ProcessBracketedSpan<Label>(&bracketed, labels, syms)) {
-      // A non-empty bracketed span.
-      return false;
     }
   }
   return true;
@@ -209,30 +420,36 @@ bool BracketedByteStringToLabels(const string &strp,
 // Creates a vector of labels from a bracketed UTF-8 string, updating the
 // symbol table as it goes.
 template <class Label>
-bool BracketedUTF8StringToLabels(const string &strp,
+bool BracketedUTF8StringToLabels(re2::StringPiece strp,
                                  std::vector<Label> *labels,
                                  SymbolTable *syms) {
-  static const RE2 pieces(kPieces);
-  re2::StringPiece view(strp);
-  string unbracketed;
-  string bracketed;
-  string error;
-  while (RE2::Consume(&view, pieces, &unbracketed, &bracketed, &error)) {
-    if (!error.empty()) {
-      LOG(ERROR) << "BracketedUTF8StringToLabels: Unbalanced brackets";
-      return false;
-    } else if (!unbracketed.empty()) {
-      RemoveBracketEscapes(&unbracketed);
-      // Adds only the new unbracketed labels.
-      auto i = labels->size();
-      if (!UTF8StringToLabels(unbracketed, labels)) return false;
-      for (; i < labels->size(); ++i) {
-        AddUnicodeCodepointToSymbolTable(static_cast<Label>((*labels)[i]),
-                                         syms);
+  BracketedStringScanner scanner(strp);
+  re2::StringPiece piece;
+  while (!scanner.Done()) {
+    switch (scanner.Next(&piece)) {
+      case BracketedStringScanner::UNBRACKETED: {
+        // Adds only the new unbracketed labels.
+        auto i = labels->size();
+        if (!ForEachUnescapedSubspan(piece, [labels](const char *begin,
+                                                     const char *end) {
+              return UTF8ToLabels(begin, end, labels);
+            })) {
+          return false;
+        }
+        for (; i < labels->size(); ++i) {
+          AddUnicodeCodepointToSymbolTable(static_cast<Label>((*labels)[i]),
+                                           syms);
+        }
+        break;
+      }
+      case BracketedStringScanner::BRACKETED: {
+        if (!ProcessBracketedSpan<Label>(piece, labels, syms)) return false;
+        break;
+      }
+      case BracketedStringScanner::UNBALANCED: {
+        LOG(ERROR) << "BracketedUTF8StringToLabels: Unbalanced brackets";
+        return false;
       }
-    } else if (!ProcessBracketedSpan<Label>(&bracketed, labels, syms)) {
-      // A non-empty bracketed span.
-      return false;
     }
   }
   return true;
@@ -240,9 +457,9 @@ bool BracketedUTF8StringToLabels(const string &strp,
 
 // Creates a vector of labels from a bracketed string using a symbol table.
 template <class Label>
-bool SymbolStringToLabels(const string &strp, const SymbolTable &syms,
+bool SymbolStringToLabels(re2::StringPiece strp, const SymbolTable &syms,
                           std::vector<Label> *labels) {
-  for (const auto token : strings::Split(strp, kTokenSeparator)) {
+  for (const auto token : strings::Split(strp.ToString(), kTokenSeparator)) {
     const auto label = static_cast<Label>(syms.Find(string(token)));
     if (label == kNoSymbol) {
       LOG(ERROR) << "SymbolStringToLabels: Symbol \"" << token << "\" "
@@ -300,10 +517,11 @@ bool CompileUTF8String(const string &strp,
                        bool attach_symbols = true) {
   using Label = typename Arc::Label;
   std::vector<Label> labels;
-  if (!UTF8StringToLabels(strp, &labels)) return false;
+  labels.reserve(strp.size());
+  if (!internal::UTF8ToLabels(strp, &labels)) return false;
   internal::CompileStringFromLabels<Arc>(labels, weight, fst);
   if (attach_symbols) {
-    std::unique_ptr<SymbolTable> syms(GetUTF8SymbolTable());
+    std::unique_ptr<SymbolTable> syms(new internal::UnicodeSymbolTable());
     for (const auto label : labels) {
       internal::AddUnicodeCodepointToSymbolTable(label, syms.get());
     }
@@ -352,7 +570,7 @@ bool CompileBracketedUTF8String(const string &strp,
                                 bool attach_symbols = true) {
   using Label = typename Arc::Label;
   std::vector<Label> labels;
-  std::unique_ptr<SymbolTable> syms(GetUTF8SymbolTable());
+  std::unique_ptr<SymbolTable> syms(new internal::UnicodeSymbolTable());
   if (!internal::BracketedUTF8StringToLabels<Label>(strp, &labels,
                                                     syms.get())) {
     return false;
@@ -363,7 +581,7 @@ bool CompileBracketedUTF8String(const string &strp,
 }
 
 template <class Label>
-bool StringToLabels(const string &strp, StringTokenType ttype,
+bool StringToLabels(re2::StringPiece strp, StringTokenType ttype,
                     std::vector<Label> *labels, SymbolTable *syms = nullptr) {
   labels->clear();
   switch (ttype) {
@@ -393,6 +611,123 @@ bool CompileString(const string &strp, const typename Arc::Weight &weight,
   return true;
 }
 
+// Compiles string into a compact string FST, returning null on failure. The
+// result is a CompactStringFst, which stores only the labels, unless the weight
+// is other than semiring One, in which case it is a CompactWeightedStringFst,
+// which stores label/weight pairs (both are declared in fst-decl.h). Either
+// way, the result has the properties of a compiled string FST.
+template <class Arc>
+Fst<Arc> *CompileCompactString(const string &strp,
+                               const typename Arc::Weight &weight,
+                               StringTokenType ttype,
+                               const SymbolTable *syms = nullptr,
+                               bool attach_symbols = true) {
+  using Weight = typename Arc::Weight;
+  VectorFst<Arc> fst;
+  if (!CompileString(strp, weight, ttype, &fst, syms, attach_symbols)) {
+    return nullptr;
+  }
+  if (weight == Weight::One()) return new CompactStringFst<Arc>(fst);
+  return new CompactWeightedStringFst<Arc>(fst);
+}
+
+namespace internal {
+
+// Tokenizes a batch of strings using a single symbol table, which is returned
+// (or null on failure). The labels of all strings are stored contiguously, the
+// labels of the i-th string being those from offsets[i] to offsets[i + 1].
+template <class Label>
+SymbolTable *StringsToLabels(const std::vector<string> &strs,
+                             StringTokenType ttype, const SymbolTable *syms,
+                             std::vector<Label> *labels,
+                             std::vector<size_t> *offsets) {
+  std::unique_ptr<SymbolTable> batch_syms(GetSymbolTable(ttype, syms));
+  size_t size = 0;
+  for (const auto &str : strs) size += str.size();
+  labels->clear();
+  labels->reserve(size);
+  offsets->clear();
+  offsets->reserve(strs.size() + 1);
+  offsets->push_back(0);
+  std::vector<Label> str_labels;
+  for (size_t i = 0; i < strs.size(); ++i) {
+    if (!StringToLabels(strs[i], ttype, &str_labels, batch_syms.get())) {
+      LOG(ERROR) << "StringsToLabels: Compilation failed for string " << i;
+      return nullptr;
+    }
+    labels->insert(labels->end(), str_labels.begin(), str_labels.end());
+    offsets->push_back(labels->size());
+  }
+  return batch_syms.release();
+}
+
+}  // namespace internal
+
+// Compiles a batch of strings into string FSTs, one per string. All strings
+// are tokenized using a single symbol table, so a generated symbol receives
+// the same label in every FST of the batch, and that table is shared by all of
+// the FSTs when attached.
+template <class Arc>
+bool CompileStrings(const std::vector<string> &strs,
+                    const typename Arc::Weight &weight, StringTokenType ttype,
+                    const std::vector<MutableFst<Arc> *> &fsts,
+                    const SymbolTable *syms = nullptr,
+                    bool attach_symbols = true) {
+  using Label = typename Arc::Label;
+  if (strs.size() != fsts.size()) {
+    LOG(ERROR) << "CompileStrings: Expected " << strs.size() << " FSTs, "
+               << "got " << fsts.size();
+    return false;
+  }
+  std::vector<Label> labels;
+  std::vector<size_t> offsets;
+  std::unique_ptr<SymbolTable> batch_syms(internal::StringsToLabels(
+      strs, ttype, syms, &labels, &offsets));
+  if (!batch_syms) return false;
+  for (size_t i = 0; i < fsts.size(); ++i) {
+    internal::CompileStringFromLabels(labels.begin() + offsets[i],
+                                      labels.begin() + offsets[i + 1], weight,
+                                      fsts[i]);
+    if (attach_symbols) internal::AssignSymbolsToFst(*batch_syms, fsts[i]);
+  }
+  return true;
+}
+
+// As above, but each FST is written to a FAR, under the corresponding key,
+// rather than kept in memory.
+template <class Arc>
+bool CompileStringsToFar(const std::vector<string> &strs,
+                         const std::vector<string> &keys,
+                         const typename Arc::Weight &weight,
+                         StringTokenType ttype, FarWriter<Arc> *writer,
+                         const SymbolTable *syms = nullptr,
+                         bool attach_symbols = true) {
+  using Label = typename Arc::Label;
+  if (strs.size() != keys.size()) {
+    LOG(ERROR) << "CompileStringsToFar: Expected " << strs.size() << " keys, "
+               << "got " << keys.size();
+    return false;
+  }
+  std::vector<Label> labels;
+  std::vector<size_t> offsets;
+  std::unique_ptr<SymbolTable> batch_syms(internal::StringsToLabels(
+      strs, ttype, syms, &labels, &offsets));
+  if (!batch_syms) return false;
+  VectorFst<Arc> fst;
+  for (size_t i = 0; i < keys.size(); ++i) {
+    internal::CompileStringFromLabels(labels.begin() + offsets[i],
+                                      labels.begin() + offsets[i + 1], weight,
+                                      &fst);
+    if (attach_symbols) internal::AssignSymbolsToFst(*batch_syms, &fst);
+    writer->Add(keys[i], fst);
+    if (writer->Error()) {
+      LOG(ERROR) << "CompileStringsToFar: Writing failed for key " << keys[i];
+      return false;
+    }
+  }
+  return true;
+}
+
 }  // namespace fst
 
 #endif  // PYNINI_STRINGCOMPILE_H_
@@ -38,6 +38,63 @@ REGISTER_FST_OPERATION(CompileString, StdArc, CompileStringArgs);
 REGISTER_FST_OPERATION(CompileString, LogArc, CompileStringArgs);
 REGISTER_FST_OPERATION(CompileString, Log64Arc, CompileStringArgs);
 
+FstClass *CompileCompactString(const string &str, const WeightClass &wc,
+                               const string &arc_type, StringTokenType ttype,
+                               const SymbolTable *syms, bool attach_symbols) {
+  CompileCompactStringInnerArgs iargs(str, wc, ttype, syms, attach_symbols);
+  CompileCompactStringArgs args(iargs);
+  args.retval = nullptr;
+  Apply<Operation<CompileCompactStringArgs>>("CompileCompactString", arc_type,
+                                             &args);
+  return args.retval;
+}
+
+REGISTER_FST_OPERATION(CompileCompactString, StdArc, CompileCompactStringArgs);
+REGISTER_FST_OPERATION(CompileCompactString, LogArc, CompileCompactStringArgs);
+REGISTER_FST_OPERATION(CompileCompactString, Log64Arc,
+                       CompileCompactStringArgs);
+
+bool CompileStrings(const std::vector<string> &strs, const WeightClass &wc,
+                    StringTokenType ttype,
+                    const std::vector<MutableFstClass *> &fsts,
+                    const SymbolTable *syms, bool attach_symbols) {
+  if (fsts.empty()) return strs.empty();
+  for (const auto *fst : fsts) {
+    if (!internal::ArcTypesMatch(*fsts[0], *fst, "CompileStrings") ||
+        !fst->WeightTypesMatch(wc, "CompileStrings")) {
+      for (auto *error_fst : fsts) error_fst->SetProperties(kError, kError);
+      return false;
+    }
+  }
+  CompileStringsInnerArgs iargs(strs, wc, ttype, fsts, syms, attach_symbols);
+  CompileStringsArgs args(iargs);
+  Apply<Operation<CompileStringsArgs>>("CompileStrings", fsts[0]->ArcType(),
+                                       &args);
+  return args.retval;
+}
+
+REGISTER_FST_OPERATION(CompileStrings, StdArc, CompileStringsArgs);
+REGISTER_FST_OPERATION(CompileStrings, LogArc, CompileStringsArgs);
+REGISTER_FST_OPERATION(CompileStrings, Log64Arc, CompileStringsArgs);
+
+bool CompileStringsToFar(const std::vector<string> &strs,
+                         const std::vector<string> &keys,
+                         const WeightClass &wc, StringTokenType ttype,
+                         FarWriterClass *writer, const SymbolTable *syms,
+                         bool attach_symbols) {
+  CompileStringsToFarInnerArgs iargs(strs, keys, wc, ttype, writer, syms,
+                                     attach_symbols);
+  CompileStringsToFarArgs args(iargs);
+  Apply<Operation<CompileStringsToFarArgs>>("CompileStringsToFar",
+                                            writer->ArcType(), &args);
+  return args.retval;
+}
+
+REGISTER_FST_OPERATION(CompileStringsToFar, StdArc, CompileStringsToFarArgs);
+REGISTER_FST_OPERATION(CompileStringsToFar, LogArc, CompileStringsToFarArgs);
+REGISTER_FST_OPERATION(CompileStringsToFar, Log64Arc,
+                       CompileStringsToFarArgs);
+
 }  // namespace script
 }  // namespace fst
 
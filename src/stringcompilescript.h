@@ -18,6 +18,10 @@
 #ifndef PYNINI_STRINGCOMPILESCRIPT_H_
 #define PYNINI_STRINGCOMPILESCRIPT_H_
 
+#include <memory>
+#include <vector>
+
+#include <fst/extensions/far/far-class.h>
 #include <fst/script/arg-packs.h>
 #include <fst/script/fst-class.h>
 #include "stringcompile.h"
@@ -46,6 +50,90 @@ bool CompileString(const string &str, const WeightClass &wc,
                    const SymbolTable *syms = nullptr,
                    bool attach_symbols = true);
 
+using CompileCompactStringInnerArgs = std::tuple<const string &,
+    const WeightClass &, StringTokenType, const SymbolTable *, bool>;
+
+using CompileCompactStringArgs =
+    WithReturnValue<FstClass *, CompileCompactStringInnerArgs>;
+
+template <class Arc>
+void CompileCompactString(CompileCompactStringArgs *args) {
+  const auto *weight =
+      std::get<1>(args->args).GetWeight<typename Arc::Weight>();
+  if (!weight) {
+    FSTERROR() << "CompileCompactString: Weight type does not match arc type";
+    args->retval = nullptr;
+    return;
+  }
+  std::unique_ptr<Fst<Arc>> fst(CompileCompactString<Arc>(
+      std::get<0>(args->args), *weight, std::get<2>(args->args),
+      std::get<3>(args->args), std::get<4>(args->args)));
+  args->retval = fst ? new FstClass(*fst) : nullptr;
+}
+
+// Returns null on failure.
+FstClass *CompileCompactString(const string &str, const WeightClass &wc,
+                               const string &arc_type, StringTokenType ttype,
+                               const SymbolTable *syms = nullptr,
+                               bool attach_symbols = true);
+
+using CompileStringsInnerArgs = std::tuple<const std::vector<string> &,
+    const WeightClass &, StringTokenType,
+    const std::vector<MutableFstClass *> &, const SymbolTable *, bool>;
+
+using CompileStringsArgs = WithReturnValue<bool, CompileStringsInnerArgs>;
+
+template <class Arc>
+void CompileStrings(CompileStringsArgs *args) {
+  typename Arc::Weight weight =
+      *(std::get<1>(args->args).GetWeight<typename Arc::Weight>());
+  std::vector<MutableFst<Arc> *> fsts;
+  fsts.reserve(std::get<3>(args->args).size());
+  for (auto *fst : std::get<3>(args->args)) {
+    fsts.push_back(fst->GetMutableFst<Arc>());
+  }
+  args->retval = CompileStrings(std::get<0>(args->args), weight,
+      std::get<2>(args->args), fsts, std::get<4>(args->args),
+      std::get<5>(args->args));
+}
+
+// The FSTs must all have the same arc type.
+bool CompileStrings(const std::vector<string> &strs, const WeightClass &wc,
+                    StringTokenType ttype,
+                    const std::vector<MutableFstClass *> &fsts,
+                    const SymbolTable *syms = nullptr,
+                    bool attach_symbols = true);
+
+using CompileStringsToFarInnerArgs = std::tuple<const std::vector<string> &,
+    const std::vector<string> &, const WeightClass &, StringTokenType,
+    FarWriterClass *, const SymbolTable *, bool>;
+
+using CompileStringsToFarArgs =
+    WithReturnValue<bool, CompileStringsToFarInnerArgs>;
+
+template <class Arc>
+void CompileStringsToFar(CompileStringsToFarArgs *args) {
+  const auto *weight =
+      std::get<2>(args->args).GetWeight<typename Arc::Weight>();
+  if (!weight) {
+    FSTERROR() << "CompileStringsToFar: Weight type does not match the FAR's "
+               << "arc type";
+    args->retval = false;
+    return;
+  }
+  FarWriter<Arc> *writer = std::get<4>(args->args)->GetFarWriter<Arc>();
+  args->retval = CompileStringsToFar(std::get<0>(args->args),
+      std::get<1>(args->args), *weight, std::get<3>(args->args), writer,
+      std::get<5>(args->args), std::get<6>(args->args));
+}
+
+bool CompileStringsToFar(const std::vector<string> &strs,
+                         const std::vector<string> &keys,
+                         const WeightClass &wc, StringTokenType ttype,
+                         FarWriterClass *writer,
+                         const SymbolTable *syms = nullptr,
+                         bool attach_symbols = true);
+
 }  // namespace script
 }  // namespace fst
 
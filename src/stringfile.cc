@@ -17,30 +17,88 @@
 
 #include "stringfile.h"
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
 #include "stripcomment.h"
-#include "gtl.h"
 
 namespace fst {
 namespace internal {
 
+StringFile::StringFile(const string &fname)
+    : data_(nullptr),
+      size_(0),
+      mapped_size_(0),
+      pos_(0),
+      linenum_(0),
+      done_(true),
+      fname_(fname) {
+  const int fd = open(fname.c_str(), O_RDONLY);
+  if (fd == -1) return;
+  struct stat st;
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+    void *data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data != MAP_FAILED) {
+      madvise(data, st.st_size, MADV_SEQUENTIAL);
+      data_ = static_cast<const char *>(data);
+      size_ = mapped_size_ = st.st_size;
+    }
+  }
+  close(fd);
+  if (!data_) {
+    // Falls back to reading the whole stream, e.g., for pipes.
+    std::ifstream istrm(fname);
+    if (!istrm) return;
+    std::ostringstream ostrm;
+    ostrm << istrm.rdbuf();
+    contents_ = ostrm.str();
+    data_ = contents_.data();
+    size_ = contents_.size();
+  }
+  done_ = false;
+  Next();
+}
+
+StringFile::~StringFile() {
+  if (mapped_size_) munmap(const_cast<char *>(data_), mapped_size_);
+}
+
 void StringFile::Reset() {
-  istrm_.clear();
-  istrm_.seekg(0, istrm_.beg);
+  if (!data_) return;
+  pos_ = 0;
+  linenum_ = 0;
+  done_ = false;
   Next();
 }
 
 // Tries to read a non-empty line until EOF.
 void StringFile::Next() {
   do {
+    if (pos_ >= size_) {
+      done_ = true;
+      line_ = re2::StringPiece();
+      return;
+    }
     ++linenum_;
-    if (!std::getline(istrm_, line_)) return;
-    line_ = StripCommentAndRemoveEscape(line_);
+    const char *begin = data_ + pos_;
+    const auto *eol =
+        static_cast<const char *>(memchr(begin, '\n', size_ - pos_));
+    const size_t length = eol ? eol - begin : size_ - pos_;
+    pos_ += length + 1;
+    line_ = StripCommentAndRemoveEscape(re2::StringPiece(begin, length),
+                                        &buffer_);
   } while (line_.empty());
 }
 
 void ColumnStringFile::Reset() {
   sf_.Reset();
-  Next();
+  Parse();
 }
 
 void ColumnStringFile::Next() {
@@ -48,6 +106,20 @@ void ColumnStringFile::Next() {
   Parse();
 }
 
+// Splits the line on tabs, skipping over consecutive tabs.
+void ColumnStringFile::Parse() {
+  row_.clear();
+  const auto line = sf_.GetString();
+  const char *begin = line.data();
+  const char *const end = begin + line.size();
+  while (begin < end) {
+    const auto *tab =
+        static_cast<const char *>(memchr(begin, '\t', end - begin));
+    if (!tab) tab = end;
+    if (tab > begin) row_.emplace_back(begin, tab - begin);
+    begin = tab + 1;
+  }
+}
+
 }  // namespace internal
 }  // namespace fst
-
@@ -18,46 +18,64 @@
 #ifndef PYNINI_STRINGFILE_H_
 #define PYNINI_STRINGFILE_H_
 
-#include <istream>
 #include <string>
 using std::string;
 #include <utility>
 #include <vector>
 
-#include <iostream>
 #include <fst/fstlib.h>
 #include "stringcompile.h"
+#include <re2/stringpiece.h>
 
 namespace fst {
 namespace internal {
 
 // Basic line-by-line file iterator, with support for line numbers and
-// \# comment stripping.
+// \# comment stripping. The file is memory-mapped (or, if that is not possible,
+// read into memory at once) and lines are scanned in place; the current line
+// is a view which remains valid until the next call to Next or Reset.
 class StringFile {
  public:
-  // Opens a file input stream using the provided filename.
-  explicit StringFile(const string &fname)
-      : istrm_(fname), linenum_(0), fname_(fname) {
-     if (!!istrm_) Next();
-  }
+  // Opens the file with the provided filename.
+  explicit StringFile(const string &fname);
+
+  ~StringFile();
 
   void Reset();
 
   void Next();
 
-  bool Done() const { return !istrm_ || istrm_.eof(); }
+  bool Done() const { return done_; }
+
+  re2::StringPiece GetString() const { return line_; }
 
-  const string &GetString() const { return line_; }
+  // Indicates whether the current line is a view of the file contents, valid
+  // for the lifetime of the iterator, rather than of a copy from which escapes
+  // were removed.
+  bool InPlace() const { return line_.data() != buffer_.data(); }
 
   size_t LineNumber() const { return linenum_; }
 
   const string &Filename() const { return fname_; }
 
  private:
-  std::ifstream istrm_;
-  string line_;
+  const char *data_;
+  size_t size_;
+  // Size of the memory mapping, if any.
+  size_t mapped_size_;
+  // Contents of the file when it could not be mapped.
+  string contents_;
+  // Offset of the start of the next line.
+  size_t pos_;
+  re2::StringPiece line_;
+  // Holds the current line when escapes had to be removed from it.
+  string buffer_;
   size_t linenum_;
+  bool done_;
   const string fname_;
+
+  StringFile(const StringFile &) = delete;
+  StringFile &operator=(const StringFile &) = delete;
 };
 
 // File iterator expecting multiple columns separated by tab.
@@ -74,18 +92,21 @@ class ColumnStringFile {
 
   bool Done() const { return sf_.Done(); }
 
-  // Access to the underlying row vector.
-  const std::vector<string> Row() const { return row_; }
+  // Access to the non-empty columns of the current line, as views which remain
+  // valid until the next call to Next or Reset.
+  const std::vector<re2::StringPiece> &Row() const { return row_; }
+
+  bool InPlace() const { return sf_.InPlace(); }
 
   size_t LineNumber() const { return sf_.LineNumber(); }
 
   const string &Filename() const { return sf_.Filename(); }
 
  private:
-  void Parse() { row_ = strings::Split(sf_.GetString(), "\t"); }
+  void Parse();
 
   StringFile sf_;
-  std::vector<string> row_;
+  std::vector<re2::StringPiece> row_;
 };
 
 }  // namespace internal
@@ -21,9 +21,14 @@
 // This file contains functions for compiling FSTs from pairs of strings
 // using a prefix tree.
 
+#include <algorithm>
+#include <deque>
+#include <memory>
 #include <sstream>
 #include <string>
 using std::string;
+#include <thread>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
@@ -32,12 +37,58 @@ using std::string;
 #include "optimize.h"
 #include "stringcompile.h"
 #include "stringfile.h"
+#include "minimal_acyclic_builder.h"
 #include "prefix_tree.h"
 
 namespace fst {
 namespace internal {
 
-// Helper class for constructing string maps.
+// Generated symbols added by a shard during parallel string map compilation
+// are numbered from here on, so that they can be told apart from the literal
+// (byte, codepoint, and integer) labels produced by tokenization.
+constexpr int64 kShardGeneratedLabelStart = 1 << 30;
+
+constexpr char kShardDummySymbol[] = "NorwegianBlue";
+
+// A symbol table which keeps a record of the symbols added to it, so that the
+// same additions can later be replayed, in order, against another table.
+class SymbolTableRecorder : public SymbolTable {
+ public:
+  struct Record {
+    string symbol;
+    int64 key;    // The requested key, or kNoSymbol for generated symbols.
+    int64 label;  // The key actually assigned.
+  };
+
+  explicit SymbolTableRecorder(const SymbolTable &syms)
+      : SymbolTable(PlainSymbolTable(syms)) {}
+
+  using SymbolTable::AddSymbol;
+
+  int64 AddSymbol(const string &symbol, int64 key) override {
+    const auto size = NumSymbols();
+    const auto label = SymbolTable::AddSymbol(symbol, key);
+    if (NumSymbols() > size) records_.push_back({symbol, key, label});
+    return label;
+  }
+
+  int64 AddSymbol(const string &symbol) override {
+    const auto size = NumSymbols();
+    const auto label = SymbolTable::AddSymbol(symbol);
+    if (NumSymbols() > size) records_.push_back({symbol, kNoSymbol, label});
+    return label;
+  }
+
+  const std::vector<Record> &Records() const { return records_; }
+
+ private:
+  std::vector<Record> records_;
+};
+
+// Helper class for constructing string maps. If the entries are declared to be
+// presorted, they are added to a minimal acyclic builder rather than a prefix
+// tree; should an entry arrive out of order, the entries so far are moved into
+// the prefix tree, which is used from then on.
 template <class Arc>
 class StringMapCompiler {
  public:
@@ -47,13 +98,15 @@ class StringMapCompiler {
   StringMapCompiler(StringTokenType itype,
                     StringTokenType otype,
                     const SymbolTable *isyms,
-                    const SymbolTable *osyms) :
+                    const SymbolTable *osyms,
+                    bool presorted = false) :
      itype_(itype),
      otype_(otype),
      isyms_(GetSymbolTable(itype_, isyms)),
-     osyms_(GetSymbolTable(otype_, osyms)) {}
+     osyms_(GetSymbolTable(otype_, osyms)),
+     presorted_(presorted) {}
 
-  bool Add(const string &istring, const string &ostring,
+  bool Add(re2::StringPiece istring, re2::StringPiece ostring,
            const Weight &weight = Weight::One()) {
     if (!StringToLabels<Label>(istring, itype_, &ilabels_, isyms_.get())) {
       return false;
@@ -61,6 +114,18 @@ class StringMapCompiler {
     if (!StringToLabels<Label>(ostring, otype_, &olabels_, osyms_.get())) {
       return false;
     }
+    if (presorted_) {
+      if (builder_.Add(ilabels_.begin(), ilabels_.end(),
+                       olabels_.begin(), olabels_.end(),
+                       weight)) {
+        return true;
+      }
+      LOG(WARNING) << "StringMapCompiler::Add: Input is not sorted; "
+                   << "falling back to prefix tree construction";
+      builder_.CopyTo(&ptree_);
+      builder_.Clear();
+      presorted_ = false;
+    }
     ptree_.Add(ilabels_.begin(), ilabels_.end(),
                olabels_.begin(), olabels_.end(),
                weight);
@@ -68,22 +133,70 @@ class StringMapCompiler {
   }
 
   // Also parses a weight string.
-  bool Add(const string &istring, const string &ostring,
-           const string &weight) {
-    std::istringstream strm(weight);
+  bool Add(re2::StringPiece istring, re2::StringPiece ostring,
+           re2::StringPiece weight) {
     Weight w;
-    strm >> w;
-    if (!strm) {
-      LOG(ERROR) << "StringMapCompiler::Add: Bad weight: " << weight;
-      return false;
-    }
+    if (!ParseWeight(weight, &w)) return false;
     return Add(istring, ostring, w);
   }
 
+  // Adds rows of one to three columns: the input string, the optional output
+  // string (defaulting to the input string), and an optional weight string.
+  // Rows are tokenized and inserted into per-shard prefix trees using up to
+  // `threads` threads; the result, including the symbol tables, is the same as
+  // if the rows had been added one at a time, in order. Presorted rows, and
+  // rows with integer labels of kShardGeneratedLabelStart or more or with the
+  // shards' placeholder symbol, are always added serially. The columns may be
+  // strings or string pieces.
+  template <class String>
+  bool AddRows(const std::vector<std::vector<String>> &rows, int threads = 1) {
+    const size_t nshards = std::min<size_t>(std::max(threads, 1), rows.size());
+    if (nshards <= 1 || presorted_ ||
+        isyms_->Find(kShardDummySymbol) != kNoSymbol ||
+        osyms_->Find(kShardDummySymbol) != kNoSymbol) {
+      return AddRowsSerially(rows);
+    }
+    std::vector<std::unique_ptr<Shard>> shards;
+    for (size_t i = 0; i < nshards; ++i) {
+      shards.emplace_back(new Shard(itype_, *isyms_, otype_, *osyms_));
+    }
+    // Tokenizes each contiguous range of rows into a shard.
+    RunShards(nshards, [&rows, &shards, nshards, this](size_t i) {
+      const auto begin = rows.size() * i / nshards;
+      const auto end = rows.size() * (i + 1) / nshards;
+      shards[i]->success = Tokenize(rows, begin, end, shards[i].get());
+    });
+    for (const auto &shard : shards) {
+      if (!shard->success) return false;
+    }
+    // The shards have not yet touched the compiler's state, so they can simply
+    // be discarded if their generated labels might be confused with literals.
+    for (const auto &shard : shards) {
+      if (UsesGeneratedRange(*shard->isyms, shard->ilabels) ||
+          UsesGeneratedRange(*shard->osyms, shard->olabels)) {
+        return AddRowsSerially(rows);
+      }
+    }
+    // Replays the symbols added by each shard, in shard order, so that
+    // generated symbols are assigned the same labels as in serial compilation.
+    for (auto &shard : shards) {
+      ReplaySymbols(*shard->isyms, isyms_.get(), &shard->irelabel);
+      ReplaySymbols(*shard->osyms, osyms_.get(), &shard->orelabel);
+    }
+    // Builds per-shard prefix trees, and merges them in shard order.
+    RunShards(nshards, [&shards](size_t i) { shards[i]->BuildPrefixTree(); });
+    for (const auto &shard : shards) ptree_.Merge(shard->ptree);
+    return true;
+  }
+
   void Compile(MutableFst<Arc> *fst,
                bool attach_input_symbols = true,
-               bool attach_output_symbols = true) const {
-    ptree_.ToFst(fst);
+               bool attach_output_symbols = true) {
+    if (presorted_) {
+      builder_.ToFst(fst);
+    } else {
+      ptree_.ToFst(fst);
+    }
     OptimizeStringCrossProducts(fst);
     // Optionally symbol tables.
     if (attach_input_symbols) fst->SetInputSymbols(isyms_.get());
@@ -91,10 +204,177 @@ class StringMapCompiler {
   }
 
  private:
+  using Relabeling = std::unordered_map<Label, Label>;
+
+  // Tokenized rows, private symbol tables, and prefix tree for one shard of a
+  // parallel compilation.
+  struct Shard {
+    Shard(StringTokenType itype, const SymbolTable &isyms,
+          StringTokenType otype, const SymbolTable &osyms)
+        : isyms(MakeShardSymbolTable(itype, isyms)),
+          osyms(MakeShardSymbolTable(otype, osyms)),
+          success(true) {}
+
+    // Applies the relabelings and inserts the tokenized rows.
+    void BuildPrefixTree() {
+      Relabel(irelabel, &ilabels);
+      Relabel(orelabel, &olabels);
+      size_t ibegin = 0;
+      size_t obegin = 0;
+      for (size_t i = 0; i < weights.size(); ++i) {
+        ptree.Add(ilabels.begin() + ibegin, ilabels.begin() + iends[i],
+                  olabels.begin() + obegin, olabels.begin() + oends[i],
+                  weights[i]);
+        ibegin = iends[i];
+        obegin = oends[i];
+      }
+    }
+
+    std::unique_ptr<SymbolTableRecorder> isyms;
+    std::unique_ptr<SymbolTableRecorder> osyms;
+    // Label strings of all rows, concatenated, and the end offset of each.
+    std::vector<Label> ilabels;
+    std::vector<Label> olabels;
+    std::vector<size_t> iends;
+    std::vector<size_t> oends;
+    std::vector<Weight> weights;
+    Relabeling irelabel;
+    Relabeling orelabel;
+    PrefixTree<Arc> ptree;
+    bool success;
+  };
+
+  static bool ParseWeight(re2::StringPiece str, Weight *weight) {
+    std::istringstream strm(str.ToString());
+    strm >> *weight;
+    if (!strm) {
+      LOG(ERROR) << "StringMapCompiler::Add: Bad weight: " << str;
+      return false;
+    }
+    return true;
+  }
+
+  template <class String>
+  bool AddRow(const std::vector<String> &row) {
+    switch (row.size()) {
+      case 1:
+        return Add(row[0], row[0]);
+      case 2:
+        return Add(row[0], row[1]);
+      case 3:
+        return Add(row[0], row[1], row[2]);
+      default:
+        LOG(ERROR) << "StringMapCompiler::AddRow: Ill-formed row";
+        return false;
+    }
+  }
+
+  template <class String>
+  bool AddRowsSerially(const std::vector<std::vector<String>> &rows) {
+    for (const auto &row : rows) {
+      if (!AddRow(row)) return false;
+    }
+    return true;
+  }
+
+  // Creates a shard's copy of a symbol table. Except for user-provided tables,
+  // which tokenization never modifies, the copy numbers generated symbols from
+  // kShardGeneratedLabelStart, which is reserved by a placeholder symbol. See
+  // UsesGeneratedRange for rows which reach that far.
+  static SymbolTableRecorder *MakeShardSymbolTable(StringTokenType ttype,
+                                                   const SymbolTable &syms) {
+    auto *shard_syms = new SymbolTableRecorder(syms);
+    if (ttype != SYMBOL && syms.AvailableKey() < kShardGeneratedLabelStart) {
+      shard_syms->SymbolTable::AddSymbol(kShardDummySymbol,
+                                         kShardGeneratedLabelStart);
+    }
+    return shard_syms;
+  }
+
+  template <class String>
+  bool Tokenize(const std::vector<std::vector<String>> &rows, size_t begin,
+                size_t end, Shard *shard) const {
+    std::vector<Label> labels;
+    for (auto i = begin; i < end; ++i) {
+      const auto &row = rows[i];
+      if (row.empty() || row.size() > 3) {
+        LOG(ERROR) << "StringMapCompiler::AddRows: Ill-formed row";
+        return false;
+      }
+      Weight weight = Weight::One();
+      if (row.size() == 3 && !ParseWeight(row[2], &weight)) return false;
+      if (!StringToLabels<Label>(row[0], itype_, &labels,
+                                 shard->isyms.get())) {
+        return false;
+      }
+      shard->ilabels.insert(shard->ilabels.end(), labels.begin(),
+                            labels.end());
+      shard->iends.push_back(shard->ilabels.size());
+      if (!StringToLabels<Label>(row.size() == 1 ? row[0] : row[1], otype_,
+                                 &labels, shard->osyms.get())) {
+        return false;
+      }
+      shard->olabels.insert(shard->olabels.end(), labels.begin(),
+                            labels.end());
+      shard->oends.push_back(shard->olabels.size());
+      shard->weights.push_back(weight);
+    }
+    return true;
+  }
+
+  // Returns true if the shard's labels may be confused with those it generated:
+  // that is, if it added an integer label of kShardGeneratedLabelStart or more,
+  // or if a row used the placeholder symbol, whose label is never replayed.
+  // Should the table already have had a label that large, the shard instead
+  // numbers generated symbols from past it.
+  static bool UsesGeneratedRange(const SymbolTableRecorder &shard_syms,
+                                 const std::vector<Label> &labels) {
+    for (const auto &record : shard_syms.Records()) {
+      if (record.key != kNoSymbol && record.key >= kShardGeneratedLabelStart) {
+        return true;
+      }
+    }
+    return std::find(labels.begin(), labels.end(),
+                     kShardGeneratedLabelStart) != labels.end();
+  }
+
+  // Adds the symbols recorded by a shard to the table, and records how the
+  // shard's generated labels map onto the table's.
+  static void ReplaySymbols(const SymbolTableRecorder &shard_syms,
+                            SymbolTable *syms, Relabeling *relabel) {
+    for (const auto &record : shard_syms.Records()) {
+      if (record.key == kNoSymbol) {
+        const Label label = syms->AddSymbol(record.symbol);
+        if (label != record.label) (*relabel)[record.label] = label;
+      } else {
+        syms->AddSymbol(record.symbol, record.key);
+      }
+    }
+  }
+
+  static void Relabel(const Relabeling &relabel, std::vector<Label> *labels) {
+    if (relabel.empty()) return;
+    for (auto &label : *labels) {
+      const auto it = relabel.find(label);
+      if (it != relabel.end()) label = it->second;
+    }
+  }
+
+  // Calls fn(0), ..., fn(n - 1), each on its own thread.
+  template <class F>
+  static void RunShards(size_t n, const F &fn) {
+    std::vector<std::thread> threads;
+    threads.reserve(n);
+    for (size_t i = 0; i < n; ++i) threads.emplace_back(fn, i);
+    for (auto &thread : threads) thread.join();
+  }
+
   const StringTokenType itype_;
   const StringTokenType otype_;
   const std::unique_ptr<SymbolTable> isyms_;
   const std::unique_ptr<SymbolTable> osyms_;
+  bool presorted_;
+  MinimalAcyclicBuilder<Arc> builder_;
   PrefixTree<Arc> ptree_;
 
   // Transient data.
@@ -106,31 +386,51 @@ class StringMapCompiler {
 
 // Compiles deterministic FST representing the union of the cross-product of
 // pairs of weighted string cross-products from a TSV file of string triples.
+// If more than one thread is requested, the file is read in its entirety and
+// then compiled in parallel shards; the result is the same either way. If the
+// file is declared to be presorted (see StringMapCompiler above), the minimal
+// transducer is instead built directly, in a single pass.
 template <class Arc>
 bool CompileStringFile(const string &fname,
     StringTokenType itype, StringTokenType otype, MutableFst<Arc> *fst,
     const SymbolTable *isyms = nullptr, const SymbolTable *osyms = nullptr,
-    bool attach_input_symbols = true, bool attach_output_symbols = true) {
-  internal::StringMapCompiler<Arc> compiler(itype, otype, isyms, osyms);
+    bool attach_input_symbols = true, bool attach_output_symbols = true,
+    int threads = 1, bool presorted = false) {
+  internal::StringMapCompiler<Arc> compiler(itype, otype, isyms, osyms,
+                                            presorted);
   internal::ColumnStringFile csf(fname);
   if (csf.Done()) return false;  // File opening failed.
+  // Rows are kept as views of the file, which stays mapped until compilation
+  // is complete, except for columns of lines from which escapes were removed;
+  // those are copied, as the line is only valid until the next one is read.
+  std::vector<std::vector<re2::StringPiece>> rows;
+  std::deque<string> unescaped;
   for (; !csf.Done(); csf.Next()) {
     const auto &line = csf.Row();
+    // In parallel mode, well-formed rows are collected for AddRows.
+    if (threads > 1 && !presorted && !line.empty() && line.size() <= 3) {
+      if (csf.InPlace()) {
+        rows.push_back(line);
+      } else {
+        rows.emplace_back();
+        for (const auto &column : line) {
+          unescaped.push_back(column.ToString());
+          rows.back().push_back(unescaped.back());
+        }
+      }
+      continue;
+    }
     switch (line.size()) {
       case 1: {
-        const string iostring(line[0]);
-        if (!compiler.Add(iostring, iostring)) return false;
+        if (!compiler.Add(line[0], line[0])) return false;
         break;
       }
       case 2: {
-        if (!compiler.Add(string(line[0]), string(line[1]))) return false;
+        if (!compiler.Add(line[0], line[1])) return false;
         break;
       }
       case 3: {
-        if (!compiler.Add(string(line[0]), string(line[1]),
-                          string(line[2]))) {
-          return false;
-        }
+        if (!compiler.Add(line[0], line[1], line[2])) return false;
         break;
       }
       default: {
@@ -141,6 +441,7 @@ bool CompileStringFile(const string &fname,
       }
     }
   }
+  if (!compiler.AddRows(rows, threads)) return false;
   compiler.Compile(fst);
   return true;
 }
@@ -152,8 +453,21 @@ bool CompileStringMap(
     const std::vector<std::vector<string>> &lines,
     StringTokenType itype, StringTokenType otype, MutableFst<Arc> *fst,
     const SymbolTable *isyms = nullptr, const SymbolTable *osyms = nullptr,
-    bool attach_input_symbols = true, bool attach_output_symbols = true) {
-  internal::StringMapCompiler<Arc> compiler(itype, otype, isyms, osyms);
+    bool attach_input_symbols = true, bool attach_output_symbols = true,
+    int threads = 1, bool presorted = false) {
+  internal::StringMapCompiler<Arc> compiler(itype, otype, isyms, osyms,
+                                            presorted);
+  if (threads > 1 && !presorted) {
+    for (const auto &line : lines) {
+      if (line.empty() || line.size() > 3) {
+        LOG(ERROR) << "CompileStringMap: Illformed line";
+        return false;
+      }
+    }
+    if (!compiler.AddRows(lines, threads)) return false;
+    compiler.Compile(fst);
+    return true;
+  }
   for (const auto &line : lines) {
     switch (line.size()) {
       case 1: {
@@ -181,4 +495,3 @@ bool CompileStringMap(
 }  // namespace fst
 
 #endif  // PYNINI_STRINGMAP_H_
-
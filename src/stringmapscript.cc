@@ -25,9 +25,11 @@ bool StringFile(const string &fname, StringTokenType itype,
                 StringTokenType otype, MutableFstClass *fst,
                 const SymbolTable *isyms, const SymbolTable *osyms,
                 bool attach_input_symbols,
-                bool attach_output_symbols) {
+                bool attach_output_symbols, int threads,
+                bool presorted) {
   StringFileInnerArgs iargs(fname, itype, otype, fst, isyms, osyms,
-                            attach_input_symbols, attach_output_symbols);
+                            attach_input_symbols, attach_output_symbols,
+                            threads, presorted);
   StringFileArgs args(iargs);
   Apply<Operation<StringFileArgs>>("StringFile", fst->ArcType(), &args);
   return args.retval;
@@ -41,9 +43,10 @@ bool StringMap(const std::vector<std::vector<string>> &lines,
                StringTokenType itype, StringTokenType otype,
                MutableFstClass *fst, const SymbolTable *isyms,
                const SymbolTable *osyms, bool attach_input_symbols,
-               bool attach_output_symbols) {
+               bool attach_output_symbols, int threads, bool presorted) {
   StringMapInnerArgs iargs(lines, itype, otype, fst, isyms, osyms,
-                           attach_input_symbols, attach_output_symbols);
+                           attach_input_symbols, attach_output_symbols,
+                           threads, presorted);
   StringMapArgs args(iargs);
   Apply<Operation<StringMapArgs>>("StringMap", fst->ArcType(), &args);
   return args.retval;
@@ -33,7 +33,7 @@ namespace script {
 
 using StringFileInnerArgs = std::tuple<const string &, StringTokenType,
     StringTokenType, MutableFstClass *, const SymbolTable *,
-    const SymbolTable *, bool, bool>;
+    const SymbolTable *, bool, bool, int, bool>;
 
 using StringFileArgs = WithReturnValue<bool, StringFileInnerArgs>;
 
@@ -43,7 +43,8 @@ void StringFile(StringFileArgs *args) {
   args->retval = CompileStringFile(
       std::get<0>(args->args), std::get<1>(args->args), std::get<2>(args->args),
       fst, std::get<4>(args->args), std::get<5>(args->args),
-      std::get<6>(args->args), std::get<7>(args->args));
+      std::get<6>(args->args), std::get<7>(args->args),
+      std::get<8>(args->args), std::get<9>(args->args));
 }
 
 bool StringFile(const string &fname, StringTokenType itype,
@@ -51,12 +52,13 @@ bool StringFile(const string &fname, StringTokenType itype,
                 const SymbolTable *isyms = nullptr,
                 const SymbolTable *osyms = nullptr,
                 bool attach_input_symbols = true,
-                bool attach_output_symbols = true);
+                bool attach_output_symbols = true,
+                int threads = 1, bool presorted = false);
 
 using StringMapInnerArgs = std::tuple<
     const std::vector<std::vector<string>> &, StringTokenType,
     StringTokenType, MutableFstClass *, const SymbolTable *,
-    const SymbolTable *, bool, bool>;
+    const SymbolTable *, bool, bool, int, bool>;
 
 using StringMapArgs = WithReturnValue<bool, StringMapInnerArgs>;
 
@@ -66,7 +68,8 @@ void StringMap(StringMapArgs *args) {
   args->retval = CompileStringMap(
       std::get<0>(args->args), std::get<1>(args->args), std::get<2>(args->args),
       fst, std::get<4>(args->args), std::get<5>(args->args),
-      std::get<6>(args->args), std::get<7>(args->args));
+      std::get<6>(args->args), std::get<7>(args->args),
+      std::get<8>(args->args), std::get<9>(args->args));
 }
 
 bool StringMap(const std::vector<std::vector<string>> &lines,
@@ -74,7 +77,8 @@ bool StringMap(const std::vector<std::vector<string>> &lines,
                MutableFstClass *fst, const SymbolTable *isyms = nullptr,
                const SymbolTable *osyms = nullptr,
                bool attach_input_symbols = true,
-               bool attach_output_symbols = true);
+               bool attach_output_symbols = true,
+               int threads = 1, bool presorted = false);
 
 }  // namespace script
 }  // namespace fst
@@ -26,6 +26,7 @@ using std::string;
 #include <fst/fst-decl.h>
 #include <fst/icu.h>
 #include <fst/string.h>
+#include "utf8.h"
 
 namespace fst {
 namespace internal {
@@ -94,7 +95,7 @@ bool LabelsToString(const std::vector<Label> &labels, StringTokenType ttype,
       return true;
     }
     case UTF8: {
-      return LabelsToUTF8String(labels, result);
+      return LabelsToUTF8(labels, result);
     }
     case SYMBOL: {
       std::stringstream sstrm;
@@ -18,11 +18,12 @@
 #ifndef PYNINI_STRIPCOMMENT_H_
 #define PYNINI_STRIPCOMMENT_H_
 
+#include <cctype>
+#include <cstring>
 #include <string>
 using std::string;
 
-
-#include "gtl.h"
+#include <re2/stringpiece.h>
 
 // Defines comment syntax for string files.
 //
@@ -35,29 +36,44 @@ using std::string;
 // TODO(rws,kbg): Merge stringfile functionality across Pynini and Thrax.
 
 namespace fst {
-namespace internal {
 
-inline string StripComment(const string &line) {
-  char prev_char = '\0';
-  for (size_t i = 0; i < line.size(); ++i) {
-    const char this_char = line[i];
-    if (this_char == '#' && prev_char != '\\') {
-      // Strips comment and any trailing whitespace.
-      return string(strings::StripTrailingAsciiWhitespace(line.substr(0, i)));
+// Strips the comment (and any whitespace preceding it) from a line, and
+// removes the escaping '\' from each "\#", in a single pass. The result is a
+// view of the input line unless an escape must be removed, in which case the
+// line is copied into `buffer` and the result is a view of that.
+inline re2::StringPiece StripCommentAndRemoveEscape(re2::StringPiece line,
+                                                    string *buffer) {
+  const char *const begin = line.data();
+  const char *end = begin + line.size();
+  bool escaped = false;
+  for (const char *p = begin;
+       (p = static_cast<const char *>(memchr(p, '#', end - p))); ++p) {
+    if (p > begin && p[-1] == '\\') {
+      escaped = true;
+      continue;
     }
-    prev_char = this_char;
+    // Strips comment and any trailing whitespace.
+    end = p;
+    while (end > begin && std::isspace(end[-1])) --end;
+    break;
   }
-  return line;
-}
-
-inline string RemoveEscape(const string &line) {
-  return strings::StringReplace(StripComment(line), "\\#", "#", true);
+  if (!escaped) return re2::StringPiece(begin, end - begin);
+  // All remaining instances of '#' are escaped.
+  buffer->clear();
+  const char *prev = begin;
+  for (const char *p = begin;
+       (p = static_cast<const char *>(memchr(p, '#', end - p))); ++p) {
+    buffer->append(prev, p - 1 - prev);
+    prev = p;
+  }
+  buffer->append(prev, end - prev);
+  return re2::StringPiece(*buffer);
 }
 
-}  // namespace internal
-
 inline string StripCommentAndRemoveEscape(const string &line) {
-  return internal::RemoveEscape(internal::StripComment(line));
+  string buffer;
+  return StripCommentAndRemoveEscape(re2::StringPiece(line), &buffer)
+      .ToString();
 }
 
 }  // namespace fst
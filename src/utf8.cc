@@ -0,0 +1,138 @@
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Copyright 2017 and onwards Google, Inc.
+//
+// For general information on the Pynini grammar compilation library, see
+// pynini.opengrm.org.
+
+#include "utf8.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define PYNINI_UTF8_X86 1
+#include <immintrin.h>
+#endif
+
+// This file contains the ASCII-scanning kernels used for UTF-8 conversion,
+// and their runtime dispatch.
+
+namespace fst {
+namespace internal {
+namespace {
+
+size_t ASCIIPrefixLengthScalar(const char *p, size_t n) {
+  size_t i = 0;
+  while (i < n && static_cast<unsigned char>(p[i]) < 0x80) ++i;
+  return i;
+}
+
+size_t ASCIILabelPrefixLengthScalar(const int32 *p, size_t n) {
+  size_t i = 0;
+  while (i < n && !(p[i] & ~0x7f)) ++i;
+  return i;
+}
+
+#ifdef PYNINI_UTF8_X86
+
+__attribute__((target("sse2")))
+size_t ASCIIPrefixLengthSSE2(const char *p, size_t n) {
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    const auto chunk =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + i));
+    // The mask has a bit set for each byte with its high bit set.
+    const int mask = _mm_movemask_epi8(chunk);
+    if (mask) return i + __builtin_ctz(mask);
+  }
+  return i + ASCIIPrefixLengthScalar(p + i, n - i);
+}
+
+__attribute__((target("sse2")))
+size_t ASCIILabelPrefixLengthSSE2(const int32 *p, size_t n) {
+  const auto high = _mm_set1_epi32(~0x7f);
+  const auto zero = _mm_setzero_si128();
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    const auto chunk =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + i));
+    const auto ascii = _mm_cmpeq_epi32(_mm_and_si128(chunk, high), zero);
+    const int mask = _mm_movemask_ps(_mm_castsi128_ps(ascii));
+    if (mask != 0xf) return i + __builtin_ctz(~mask);
+  }
+  return i + ASCIILabelPrefixLengthScalar(p + i, n - i);
+}
+
+__attribute__((target("avx2")))
+size_t ASCIIPrefixLengthAVX2(const char *p, size_t n) {
+  size_t i = 0;
+  for (; i + 32 <= n; i += 32) {
+    const auto chunk =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + i));
+    const unsigned mask = _mm256_movemask_epi8(chunk);
+    if (mask) return i + __builtin_ctz(mask);
+  }
+  return i + ASCIIPrefixLengthSSE2(p + i, n - i);
+}
+
+__attribute__((target("avx2")))
+size_t ASCIILabelPrefixLengthAVX2(const int32 *p, size_t n) {
+  const auto high = _mm256_set1_epi32(~0x7f);
+  const auto zero = _mm256_setzero_si256();
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    const auto chunk =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + i));
+    const auto ascii = _mm256_cmpeq_epi32(_mm256_and_si256(chunk, high), zero);
+    const int mask = _mm256_movemask_ps(_mm256_castsi256_ps(ascii));
+    if (mask != 0xff) return i + __builtin_ctz(~mask);
+  }
+  return i + ASCIILabelPrefixLengthSSE2(p + i, n - i);
+}
+
+#endif  // PYNINI_UTF8_X86
+
+using ASCIIPrefixLengthFn = size_t (*)(const char *, size_t);
+
+using ASCIILabelPrefixLengthFn = size_t (*)(const int32 *, size_t);
+
+ASCIIPrefixLengthFn SelectASCIIPrefixLength() {
+#ifdef PYNINI_UTF8_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) return ASCIIPrefixLengthAVX2;
+  if (__builtin_cpu_supports("sse2")) return ASCIIPrefixLengthSSE2;
+#endif
+  return ASCIIPrefixLengthScalar;
+}
+
+ASCIILabelPrefixLengthFn SelectASCIILabelPrefixLength() {
+#ifdef PYNINI_UTF8_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) return ASCIILabelPrefixLengthAVX2;
+  if (__builtin_cpu_supports("sse2")) return ASCIILabelPrefixLengthSSE2;
+#endif
+  return ASCIILabelPrefixLengthScalar;
+}
+
+}  // namespace
+
+size_t ASCIIPrefixLength(const char *p, size_t n) {
+  static const auto kernel = SelectASCIIPrefixLength();
+  return kernel(p, n);
+}
+
+size_t ASCIILabelPrefixLength(const int32 *p, size_t n) {
+  static const auto kernel = SelectASCIILabelPrefixLength();
+  return kernel(p, n);
+}
+
+}  // namespace internal
+}  // namespace fst
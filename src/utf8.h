@@ -0,0 +1,173 @@
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Copyright 2017 and onwards Google, Inc.
+//
+// For general information on the Pynini grammar compilation library, see
+// pynini.opengrm.org.
+
+#ifndef PYNINI_UTF8_H_
+#define PYNINI_UTF8_H_
+
+#include <cstddef>
+#include <string>
+using std::string;
+#include <vector>
+
+#include <fst/types.h>
+#include <fst/log.h>
+
+// Conversion between UTF-8 strings and vectors of Unicode code point labels.
+// These accept and produce exactly what the FST library's UTF8StringToLabels
+// and LabelsToUTF8String do, but runs of ASCII are found using vectorized
+// kernels, selected at runtime according to the CPU's features, and are
+// converted in bulk; only the remaining multibyte sequences are handled one
+// at a time.
+
+namespace fst {
+namespace internal {
+
+// Returns the length of the longest prefix of the n bytes at p consisting of
+// ASCII bytes.
+size_t ASCIIPrefixLength(const char *p, size_t n);
+
+// Returns the length of the longest prefix of the n labels at p consisting of
+// labels in the ASCII range.
+size_t ASCIILabelPrefixLength(const int32 *p, size_t n);
+
+template <class Label>
+size_t ASCIILabelPrefixLength(const Label *p, size_t n) {
+  size_t i = 0;
+  while (i < n && p[i] >= 0 && p[i] < 0x80) ++i;
+  return i;
+}
+
+// Decodes a single multibyte UTF-8 sequence starting at *p, which must precede
+// end, appending the code point to labels and advancing *p past it.
+template <class Label>
+bool DecodeUTF8Sequence(const char **p, const char *end,
+                        std::vector<Label> *labels) {
+  const char *q = *p;
+  const int c = *q++ & 0xff;
+  if ((c & 0xc0) == 0x80) {
+    LOG(ERROR) << "UTF8ToLabels: Continuation byte as lead byte";
+    return false;
+  }
+  int count = (c >= 0xc0) + (c >= 0xe0) + (c >= 0xf0) + (c >= 0xf8) +
+              (c >= 0xfc);
+  int32 code = c & ((1 << (6 - count)) - 1);
+  for (; count != 0; --count) {
+    if (q == end) {
+      LOG(ERROR) << "UTF8ToLabels: Truncated UTF-8 byte sequence";
+      return false;
+    }
+    const int cb = *q++ & 0xff;
+    if ((cb & 0xc0) != 0x80) {
+      LOG(ERROR) << "UTF8ToLabels: Missing/invalid continuation byte";
+      return false;
+    }
+    code = (code << 6) | (cb & 0x3f);
+  }
+  if (code < 0) {
+    LOG(ERROR) << "UTF8ToLabels: Invalid character found: " << c;
+    return false;
+  }
+  labels->push_back(code);
+  *p = q;
+  return true;
+}
+
+// Encodes a single non-ASCII code point label, appending it to str.
+template <class Label>
+bool EncodeUTF8Sequence(Label label, string *str) {
+  const int32 code = label;
+  if (code < 0) {
+    LOG(ERROR) << "LabelsToUTF8: Invalid character found: " << code;
+    return false;
+  } else if (code < 0x800) {
+    str->push_back((code >> 6) | 0xc0);
+    str->push_back((code & 0x3f) | 0x80);
+  } else if (code < 0x10000) {
+    str->push_back((code >> 12) | 0xe0);
+    str->push_back(((code >> 6) & 0x3f) | 0x80);
+    str->push_back((code & 0x3f) | 0x80);
+  } else if (code < 0x200000) {
+    str->push_back((code >> 18) | 0xf0);
+    str->push_back(((code >> 12) & 0x3f) | 0x80);
+    str->push_back(((code >> 6) & 0x3f) | 0x80);
+    str->push_back((code & 0x3f) | 0x80);
+  } else if (code < 0x4000000) {
+    str->push_back((code >> 24) | 0xf8);
+    str->push_back(((code >> 18) & 0x3f) | 0x80);
+    str->push_back(((code >> 12) & 0x3f) | 0x80);
+    str->push_back(((code >> 6) & 0x3f) | 0x80);
+    str->push_back((code & 0x3f) | 0x80);
+  } else {
+    str->push_back((code >> 30) | 0xfc);
+    str->push_back(((code >> 24) & 0x3f) | 0x80);
+    str->push_back(((code >> 18) & 0x3f) | 0x80);
+    str->push_back(((code >> 12) & 0x3f) | 0x80);
+    str->push_back(((code >> 6) & 0x3f) | 0x80);
+    str->push_back((code & 0x3f) | 0x80);
+  }
+  return true;
+}
+
+// Decodes the UTF-8 string in [begin, end), appending the code points to
+// labels.
+template <class Label>
+bool UTF8ToLabels(const char *begin, const char *end,
+                  std::vector<Label> *labels) {
+  for (const char *p = begin; p < end;) {
+    if (static_cast<unsigned char>(*p) < 0x80) {
+      const auto n = ASCIIPrefixLength(p, end - p);
+      const auto *ascii = reinterpret_cast<const unsigned char *>(p);
+      labels->insert(labels->end(), ascii, ascii + n);
+      p += n;
+    } else if (!DecodeUTF8Sequence(&p, end, labels)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+template <class Label>
+bool UTF8ToLabels(const string &str, std::vector<Label> *labels) {
+  return UTF8ToLabels(str.data(), str.data() + str.size(), labels);
+}
+
+// Encodes a vector of code point labels as a UTF-8 string.
+template <class Label>
+bool LabelsToUTF8(const std::vector<Label> &labels, string *str) {
+  str->clear();
+  str->reserve(labels.size());
+  const auto size = labels.size();
+  for (size_t i = 0; i < size;) {
+    const auto n = ASCIILabelPrefixLength(labels.data() + i, size - i);
+    if (n) {
+      const auto offset = str->size();
+      str->resize(offset + n);
+      for (size_t j = 0; j < n; ++j) (*str)[offset + j] = labels[i + j];
+      i += n;
+    } else if (EncodeUTF8Sequence(labels[i], str)) {
+      ++i;
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace internal
+}  // namespace fst
+
+#endif  // PYNINI_UTF8_H_